@@ -0,0 +1,50 @@
+# Loading shuffled rows: one `insert` per row vs `.import` of the same rows.
+#
+#   ruby bench/bulk_import.rb [rows]
+#
+# Run it from the directory holding build/ToyDB, like the specs.
+
+require "tempfile"
+
+DB = "bench.db"
+BINARY = "./build/ToyDB"
+
+rows = (ARGV[0] || 100_000).to_i
+
+def run_script(commands, options = "")
+  # Commands go through a file so a large output can't fill the pipe and stall us
+  Tempfile.create("toydb_bench") do |script|
+    script.puts(commands)
+    script.flush
+    IO.popen("#{BINARY} #{DB} #{options}", in: script.path) { |pipe| pipe.read }
+  end
+end
+
+def timed_load(commands, rows)
+  File.delete(DB) if File.exist?(DB)
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  run_script(commands)
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+  count = run_script(["select", ".exit"]).count("\n") - 1
+  abort "loaded #{count} of #{rows} rows" if count != rows
+  [elapsed * 1000.0, File.size(DB) / 1048576.0]
+end
+
+ids = (1..rows).to_a.shuffle(random: Random.new(42))
+csv = Tempfile.create(["toydb_bench", ".csv"])
+ids.each { |i| csv.puts("#{i},user#{i},person#{i}@example.com") }
+csv.close
+
+puts "rows: #{rows}"
+printf("%-16s %12s %10s\n", "load", "time", "file")
+{
+  "insert" => ids.map { |i| "insert #{i} user#{i} person#{i}@example.com" } << ".exit",
+  ".import" => [".import #{csv.path}", ".exit"],
+  ".import 90%" => [".import #{csv.path} 90", ".exit"],
+}.each do |name, commands|
+  ms, mb = timed_load(commands, rows)
+  printf("%-16s %9.1f ms %7.1f MB\n", name, ms, mb)
+end
+
+File.delete(csv.path)
+File.delete(DB)
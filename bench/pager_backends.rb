@@ -0,0 +1,60 @@
+# Cold-start `select` over a large file: buffer pool pager vs mmap pager.
+#
+#   ruby bench/pager_backends.rb [rows] [runs]
+#
+# Run it from the directory holding build/ToyDB, like the specs. Before each
+# cold run the db file is dropped from the OS page cache with
+# `dd iflag=nocache`; when that isn't supported the runs are only process-cold.
+
+require "tempfile"
+
+DB = "bench.db"
+BINARY = "./build/ToyDB"
+
+rows = (ARGV[0] || 200_000).to_i
+runs = (ARGV[1] || 5).to_i
+
+def run_script(commands, options = "")
+  # Commands go through a file so a large output can't fill the pipe and stall us
+  Tempfile.create("toydb_bench") do |script|
+    script.puts(commands)
+    script.flush
+    IO.popen("#{BINARY} #{DB} #{options}", in: script.path) { |pipe| pipe.read }
+  end
+end
+
+def drop_page_cache
+  system("dd if=#{DB} iflag=nocache count=0 status=none", err: File::NULL)
+end
+
+def median(samples)
+  sorted = samples.sort
+  sorted[sorted.length / 2]
+end
+
+def time_select(options, cold)
+  drop_page_cache if cold
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  output = run_script(["select", ".exit"], options)
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+  [elapsed * 1000.0, output.count("\n")]
+end
+
+File.delete(DB) if File.exist?(DB)
+run_script((1..rows).map { |i| "insert #{i} user#{i} person#{i}@example.com" } << ".exit")
+puts "rows: #{rows}, file: #{(File.size(DB) / 1048576.0).round(1)} MB, runs: #{runs}"
+
+printf("%-10s %14s %14s\n", "backend", "cold median", "warm median")
+{ "buffered" => "", "mmap" => "--mmap" }.each do |name, options|
+  cold = []
+  warm = []
+  runs.times do
+    ms, lines = time_select(options, true)
+    abort "#{name}: select returned #{lines} lines" if lines < rows
+    cold << ms
+    warm << time_select(options, false).first
+  end
+  printf("%-10s %11.1f ms %11.1f ms\n", name, median(cold), median(warm))
+end
+
+File.delete(DB)
@@ -0,0 +1,189 @@
+/*
+    Point lookup throughput as reader threads are added.
+
+        read_scaling [rows] [lookups per thread] [--writer] [--mmap]
+
+    Builds with the library (the read_scaling target) and runs from any
+    directory, the table goes to bench.db there. rows are loaded with
+    tdb_insert_batch, then 1, 2, 4, ... threads up to the core count share
+    the connection and each times `lookups` random `select where id = ?`.
+    With --writer one more thread inserts new rows the whole time, so the
+    readers run into its latches and the tree changes under them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "toydb.h"
+
+#define DB "bench.db"
+#define LOAD_BATCH_ROWS 10000
+
+typedef struct {
+    tdb* db;
+    uint32_t rows;
+    uint32_t lookups;
+    uint32_t seed;
+    uint32_t missing;
+} reader_args;
+
+typedef struct {
+    tdb* db;
+    uint32_t next_id;
+    uint32_t inserted;
+    atomic_bool stop;
+} writer_args;
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fill_row(tdb_row* row, uint32_t id) {
+    row->id = id;
+    snprintf(row->user_name, sizeof(row->user_name), "user%u", id);
+    snprintf(row->email, sizeof(row->email), "person%u@example.com", id);
+}
+
+void load_rows(tdb* db, uint32_t rows) {
+    tdb_row* batch = malloc(LOAD_BATCH_ROWS * sizeof(tdb_row));
+    for (uint32_t first = 1; first <= rows; first += LOAD_BATCH_ROWS) {
+        uint32_t count = rows - first + 1 < LOAD_BATCH_ROWS ? rows - first + 1 : LOAD_BATCH_ROWS;
+        for (uint32_t i = 0; i < count; i++) {
+            fill_row(&batch[i], first + i);
+        }
+        tdb_insert_batch(db, batch, count, NULL);
+    }
+    free(batch);
+}
+
+void* run_reader(void* arg) {
+    reader_args* args = arg;
+    tdb_stmt* stmt;
+    tdb_prepare(args->db, "select where id = ?", &stmt);
+
+    uint32_t state = args->seed;
+    tdb_row row;
+    for (uint32_t i = 0; i < args->lookups; i++) {
+        // xorshift, rand() takes a lock
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        tdb_bind_int(stmt, 1, state % args->rows + 1);
+        if (tdb_step(stmt, &row) != TDB_ROW) {
+            args->missing++;
+        }
+        tdb_reset(stmt);
+    }
+
+    tdb_finalize(stmt);
+    return NULL;
+}
+
+void* run_writer(void* arg) {
+    writer_args* args = arg;
+    tdb_stmt* stmt;
+    tdb_prepare(args->db, "insert ?, ?, ?", &stmt);
+
+    tdb_row row;
+    while (!atomic_load(&args->stop)) {
+        fill_row(&row, args->next_id++);
+        tdb_bind_int(stmt, 1, row.id);
+        tdb_bind_text(stmt, 2, row.user_name);
+        tdb_bind_text(stmt, 3, row.email);
+        if (tdb_step(stmt, NULL) == TDB_DONE) {
+            args->inserted++;
+        }
+        tdb_reset(stmt);
+    }
+
+    tdb_finalize(stmt);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    uint32_t rows = 200000;
+    uint32_t lookups = 200000;
+    bool with_writer = false;
+    tdb_config cfg;
+    tdb_default_config(&cfg);
+
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--writer") == 0) {
+            with_writer = true;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            cfg.mode = TDB_PAGER_MMAP;
+        } else if (positional == 0) {
+            rows = atoi(argv[i]);
+            positional++;
+        } else {
+            lookups = atoi(argv[i]);
+        }
+    }
+
+    unlink(DB);
+    unlink(DB "-wal");
+    tdb* db = tdb_open(DB, &cfg);
+    load_rows(db, rows);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("rows: %u, lookups per thread: %u, cores: %ld%s\n",
+           rows, lookups, cores, with_writer ? ", with a writer" : "");
+    printf("%8s %14s %10s %14s\n", "threads", "lookups/s", "speedup", "inserts/s");
+
+    double base_rate = 0;
+    uint32_t next_id = rows + 1;
+    for (long threads = 1; threads <= cores; threads *= 2) {
+        pthread_t* ids = malloc(threads * sizeof(pthread_t));
+        reader_args* args = calloc(threads, sizeof(reader_args));
+        writer_args writer = { db, next_id, 0, false };
+        pthread_t writer_id;
+
+        double started = now_seconds();
+        if (with_writer) {
+            pthread_create(&writer_id, NULL, run_writer, &writer);
+        }
+        for (long t = 0; t < threads; t++) {
+            args[t] = (reader_args){ db, rows, lookups, 2463534242u + t * 7919, 0 };
+            pthread_create(&ids[t], NULL, run_reader, &args[t]);
+        }
+        uint32_t missing = 0;
+        for (long t = 0; t < threads; t++) {
+            pthread_join(ids[t], NULL);
+            missing += args[t].missing;
+        }
+        double elapsed = now_seconds() - started;
+        if (with_writer) {
+            atomic_store(&writer.stop, true);
+            pthread_join(writer_id, NULL);
+            next_id = writer.next_id;
+        }
+
+        double rate = threads * (double)lookups / elapsed;
+        if (threads == 1) {
+            base_rate = rate;
+        }
+        printf("%8ld %14.0f %9.2fx %14.0f\n", threads, rate, rate / base_rate,
+               with_writer ? writer.inserted / elapsed : 0.0);
+        if (missing > 0) {
+            printf("%u lookups found no row\n", missing);
+        }
+
+        free(args);
+        free(ids);
+    }
+
+    tdb_close(db);
+    unlink(DB);
+    unlink(DB "-wal");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+# Tree height and point lookup cost as the table grows.
+#
+#   ruby bench/tree_depth.rb [max rows] [lookups]
+#
+# Run it from the directory holding build/ToyDB, like the specs. Tables of
+# 1k, 10k, ... rows up to max rows are bulk loaded, then `lookups` random
+# `select where id = N` are timed. Pages per lookup comes from the buffer
+# pool counters (hits + misses). Point TOYDB at another build, e.g. one of
+# an older commit, to compare against it.
+
+require "tempfile"
+
+DB = "bench.db"
+BINARY = ENV.fetch("TOYDB", "./build/ToyDB")
+
+max_rows = (ARGV[0] || 1_000_000).to_i
+lookups = (ARGV[1] || 10_000).to_i
+
+def run_script(commands, options = "")
+  # Commands go through a file so a large output can't fill the pipe and stall us
+  Tempfile.create("toydb_bench") do |script|
+    script.puts(commands)
+    script.flush
+    IO.popen("#{BINARY} #{DB} #{options}", in: script.path) { |pipe| pipe.read }
+  end
+end
+
+def load_rows(rows)
+  File.delete(DB) if File.exist?(DB)
+  Tempfile.create(["toydb_bench", ".csv"]) do |csv|
+    (1..rows).each { |i| csv.puts("#{i},user#{i},person#{i}@example.com") }
+    csv.flush
+    run_script([".import #{csv.path}", ".exit"])
+  end
+end
+
+def tree_height
+  # Leaves are the most indented nodes, two spaces per level
+  run_script([".btree", ".exit"]).each_line
+    .select { |line| line.include?("- leaf") }
+    .map { |line| line.index("-") / 2 + 1 }
+    .max
+end
+
+def page_requests(output)
+  output.scan(/^(?:hits|misses): (\d+)$/).flatten.map(&:to_i).sum
+end
+
+def time_lookups(rows, lookups)
+  random = Random.new(42)
+  script = (1..lookups).map { "select where id = #{random.rand(1..rows)}" }
+  before = page_requests(run_script([".pool", ".exit"]))
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  output = run_script(script + [".pool", ".exit"])
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+  requests = page_requests(output.split("Buffer pool:").last) - before
+  [requests.to_f / lookups, elapsed * 1_000_000.0 / lookups]
+end
+
+puts "binary: #{BINARY}, lookups: #{lookups}"
+printf("%10s %8s %16s %14s\n", "rows", "height", "pages/lookup", "us/lookup")
+rows = 1_000
+while rows <= max_rows
+  load_rows(rows)
+  pages, us = time_lookups(rows, lookups)
+  printf("%10d %8d %16.2f %14.2f\n", rows, tree_height, pages, us)
+  rows *= 10
+end
+
+File.delete(DB)
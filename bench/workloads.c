@@ -0,0 +1,318 @@
+/*
+    Throughput, latency and page I/O of the main workloads, as JSON.
+
+        workloads [rows] [lookups] [--mmap] [--pool-frames N] [--compress]
+                  [--checkpoint-ms N]
+
+    Builds with the library (the workloads target) and runs from any
+    directory, the table goes to bench.db there. In order:
+
+        insert_sequential   rows inserted with ids 1, 2, 3, ...
+        insert_random       the same ids in random order, into a new table
+        point_lookup        lookups random `select where id = ?` on it
+        range_scan          selects of RANGE_ROWS ids from a random start
+        full_scan           FULL_SCANS selects of the whole table
+        open_close_cold     tdb_open and tdb_close, the file dropped from
+                            the OS cache before each open
+        open_close_warm     the same with the file cached
+
+    Inserts commit every INSERT_COMMIT_ROWS rows, so they time the tree
+    rather than an fsync per row. Each workload reports ops per second,
+    the 50th and 99th percentile latency of an op in microseconds, and the
+    pages read from and written to the db file and the WAL while it ran.
+    The output goes to stdout, to be kept and compared between builds.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "toydb.h"
+
+#define DB "bench.db"
+#define INSERT_COMMIT_ROWS  1000
+#define RANGE_ROWS          100
+#define FULL_SCANS          5
+#define OPEN_CYCLES         20
+
+typedef struct {
+    const char* name;
+    uint64_t* latencies;    // ns of each op
+    uint64_t ops;
+    uint64_t rows;          // rows inserted or handed back
+    uint64_t started;
+    tdb_io_stats io;        // so far, of connections already closed
+} workload;
+
+static bool first_result = true;
+
+uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint32_t xorshift(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+void fill_row(tdb_row* row, uint32_t id) {
+    row->id = id;
+    snprintf(row->user_name, sizeof(row->user_name), "user%u", id);
+    snprintf(row->email, sizeof(row->email), "person%u@example.com", id);
+}
+
+void exec(tdb* db, const char* sql) {
+    tdb_stmt* stmt;
+    tdb_prepare(db, sql, &stmt);
+    tdb_step(stmt, NULL);
+    tdb_finalize(stmt);
+}
+
+tdb* open_fresh(const tdb_config* cfg) {
+    unlink(DB);
+    unlink(DB "-wal");
+    return tdb_open(DB, cfg);
+}
+
+void start_workload(workload* w, const char* name, uint64_t max_ops) {
+    *w = (workload){ .name = name };
+    w->latencies = malloc(max_ops * sizeof(uint64_t));
+    w->started = clock_ns();
+}
+
+/// @brief Add the I/O of a connection that is about to close, or is done with the workload
+/// @param w
+/// @param db
+/// @param before its counters when the workload started on it
+void add_io(workload* w, tdb* db, const tdb_io_stats* before) {
+    tdb_io_stats now;
+    tdb_get_io_stats(db, &now);
+    w->io.pages_read += now.pages_read - before->pages_read;
+    w->io.pages_written += now.pages_written - before->pages_written;
+    w->io.wal_frames += now.wal_frames - before->wal_frames;
+}
+
+int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+double percentile_us(uint64_t* sorted, uint64_t count, uint32_t pct) {
+    return count == 0 ? 0 : sorted[(count - 1) * pct / 100] / 1e3;
+}
+
+void finish_workload(workload* w) {
+    double seconds = (clock_ns() - w->started) / 1e9;
+    qsort(w->latencies, w->ops, sizeof(uint64_t), compare_u64);
+
+    printf("%s    {\"name\": \"%s\", \"ops\": %llu, \"rows\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+           "\"p50_us\": %.3f, \"p99_us\": %.3f, \"pages_read\": %llu, \"pages_written\": %llu, \"wal_frames\": %llu}",
+           first_result ? "" : ",\n", w->name, (unsigned long long)w->ops, (unsigned long long)w->rows,
+           seconds, w->ops / seconds, percentile_us(w->latencies, w->ops, 50), percentile_us(w->latencies, w->ops, 99),
+           (unsigned long long)w->io.pages_read, (unsigned long long)w->io.pages_written,
+           (unsigned long long)w->io.wal_frames);
+    first_result = false;
+    free(w->latencies);
+}
+
+/// @brief Insert ids 1 to rows, in order or shuffled, into a new table
+/// @param cfg
+/// @param rows
+/// @param shuffled
+/// @return the connection, still open
+tdb* run_inserts(const tdb_config* cfg, uint32_t rows, bool shuffled) {
+    uint32_t* ids = malloc(rows * sizeof(uint32_t));
+    for (uint32_t i = 0; i < rows; i++) {
+        ids[i] = i + 1;
+    }
+    uint32_t state = 2463534242u;
+    for (uint32_t i = rows; shuffled && i > 1; i--) {
+        uint32_t j = xorshift(&state) % i;
+        uint32_t id = ids[i - 1];
+        ids[i - 1] = ids[j];
+        ids[j] = id;
+    }
+
+    tdb* db = open_fresh(cfg);
+    tdb_io_stats before;
+    tdb_get_io_stats(db, &before);
+    tdb_stmt* stmt;
+    tdb_prepare(db, "insert ?, ?, ?", &stmt);
+
+    workload w;
+    start_workload(&w, shuffled ? "insert_random" : "insert_sequential", rows);
+    exec(db, "begin");
+    for (uint32_t i = 0; i < rows; i++) {
+        tdb_row row;
+        fill_row(&row, ids[i]);
+        tdb_bind_int(stmt, 1, row.id);
+        tdb_bind_text(stmt, 2, row.user_name);
+        tdb_bind_text(stmt, 3, row.email);
+
+        uint64_t started = clock_ns();
+        tdb_result result = tdb_step(stmt, NULL);
+        if (result == TDB_TRANSACTION_FULL) {
+            // Too many pages for the pool, the row goes into the next transaction
+            tdb_reset(stmt);
+            exec(db, "commit");
+            exec(db, "begin");
+            result = tdb_step(stmt, NULL);
+        }
+        w.latencies[w.ops++] = clock_ns() - started;
+        w.rows += result == TDB_DONE;
+        tdb_reset(stmt);
+
+        if ((i + 1) % INSERT_COMMIT_ROWS == 0) {
+            exec(db, "commit");
+            exec(db, "begin");
+        }
+    }
+    exec(db, "commit");
+    tdb_finalize(stmt);
+    add_io(&w, db, &before);
+    finish_workload(&w);
+
+    free(ids);
+    return db;
+}
+
+void run_point_lookups(tdb* db, uint32_t rows, uint32_t lookups) {
+    tdb_io_stats before;
+    tdb_get_io_stats(db, &before);
+    tdb_stmt* stmt;
+    tdb_prepare(db, "select where id = ?", &stmt);
+
+    workload w;
+    start_workload(&w, "point_lookup", lookups);
+    uint32_t state = 88675123u;
+    tdb_row row;
+    for (uint32_t i = 0; i < lookups; i++) {
+        tdb_bind_int(stmt, 1, xorshift(&state) % rows + 1);
+        uint64_t started = clock_ns();
+        w.rows += tdb_step(stmt, &row) == TDB_ROW;
+        tdb_reset(stmt);
+        w.latencies[w.ops++] = clock_ns() - started;
+    }
+    tdb_finalize(stmt);
+    add_io(&w, db, &before);
+    finish_workload(&w);
+}
+
+/// @brief Select ranges of RANGE_ROWS ids from random starts, or the whole table
+/// @param db
+/// @param rows
+/// @param scans
+/// @param full select the whole table each time
+void run_scans(tdb* db, uint32_t rows, uint32_t scans, bool full) {
+    tdb_io_stats before;
+    tdb_get_io_stats(db, &before);
+    tdb_stmt* stmt;
+    tdb_prepare(db, full ? "select" : "select where id between ? and ?", &stmt);
+
+    workload w;
+    start_workload(&w, full ? "full_scan" : "range_scan", scans);
+    uint32_t state = 521288629u;
+    tdb_row row;
+    for (uint32_t i = 0; i < scans; i++) {
+        if (!full) {
+            uint32_t first = xorshift(&state) % rows + 1;
+            tdb_bind_int(stmt, 1, first);
+            tdb_bind_int(stmt, 2, first + RANGE_ROWS - 1);
+        }
+        uint64_t started = clock_ns();
+        while (tdb_step(stmt, &row) == TDB_ROW) {
+            w.rows++;
+        }
+        tdb_reset(stmt);
+        w.latencies[w.ops++] = clock_ns() - started;
+    }
+    tdb_finalize(stmt);
+    add_io(&w, db, &before);
+    finish_workload(&w);
+}
+
+/// @brief Drop the db file's pages from the OS cache, it has to be closed and synced
+void evict_file(void) {
+    int fd = open(DB, O_RDONLY);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+void run_open_close(const tdb_config* cfg, bool cold) {
+    workload w;
+    start_workload(&w, cold ? "open_close_cold" : "open_close_warm", OPEN_CYCLES);
+    for (uint32_t i = 0; i < OPEN_CYCLES; i++) {
+        // Only the open and close are timed, the eviction is taken out
+        uint64_t started = clock_ns();
+        if (cold) {
+            evict_file();
+            w.started += clock_ns() - started;
+            started = clock_ns();
+        }
+        tdb* db = tdb_open(DB, cfg);
+        tdb_io_stats none = { 0 };
+        add_io(&w, db, &none);
+        tdb_close(db);
+        w.latencies[w.ops++] = clock_ns() - started;
+    }
+    finish_workload(&w);
+}
+
+int main(int argc, char** argv) {
+    uint32_t rows = 100000;
+    uint32_t lookups = 100000;
+    tdb_config cfg;
+    tdb_default_config(&cfg);
+
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mmap") == 0) {
+            cfg.mode = TDB_PAGER_MMAP;
+        } else if (strcmp(argv[i], "--pool-frames") == 0 && i + 1 < argc) {
+            cfg.pool_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            cfg.compress = true;
+        } else if (strcmp(argv[i], "--checkpoint-ms") == 0 && i + 1 < argc) {
+            cfg.checkpoint_interval_ms = atoi(argv[++i]);
+        } else if (positional == 0) {
+            rows = atoi(argv[i]);
+            positional++;
+        } else {
+            lookups = atoi(argv[i]);
+        }
+    }
+    if (rows == 0) {
+        fprintf(stderr, "Usage: workloads [rows] [lookups] [--mmap] [--pool-frames N] [--compress] [--checkpoint-ms N]\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n  \"rows\": %u,\n  \"lookups\": %u,\n  \"pager\": \"%s\",\n  \"pool_frames\": %u,\n  \"compress\": %s,\n  \"checkpoint_ms\": %u,\n  \"results\": [\n",
+           rows, lookups, cfg.mode == TDB_PAGER_MMAP ? "mmap" : "buffered", cfg.pool_frames,
+           cfg.compress ? "true" : "false", cfg.checkpoint_interval_ms);
+
+    tdb_close(run_inserts(&cfg, rows, false));
+    tdb* db = run_inserts(&cfg, rows, true);
+    run_point_lookups(db, rows, lookups);
+    run_scans(db, rows, lookups / RANGE_ROWS + 1, false);
+    run_scans(db, rows, FULL_SCANS, true);
+    tdb_close(db);
+    run_open_close(&cfg, true);
+    run_open_close(&cfg, false);
+
+    printf("\n  ]\n}\n");
+    unlink(DB);
+    unlink(DB "-wal");
+    return EXIT_SUCCESS;
+}
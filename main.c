@@ -2,25 +2,40 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <fcntl.h>
-#include <errno.h>
-#include <unistd.h>
-#include <sys/stat.h>
+#include <string.h>
 
-#define BUFFER_SIZE 2048
-static char buffer[BUFFER_SIZE];
+#include "toydb.h"
+#include "output.h"
 
 #ifdef _WIN32
 #include <string.h>
 
+#define LINE_CHUNK 2048
+
+/// @brief Read a line of any length, a multi-row insert can take several kilobytes
+/// @param prompt 
+/// @return the line without its line break, NULL at the end of input
 char* realine(char* prompt)
 {
     fputs(prompt, stdout);
-    fgets(buffer, BUFFER_SIZE, stdin);
-    char *cpy = malloc(strlen(buffer) + 1);
-    strcpy(cpy, buffer);
-    cpy[strlen(cpy) - 1] = '\0';
-    return cpy;
+    fflush(stdout);
+    size_t capacity = LINE_CHUNK;
+    size_t len = 0;
+    char* line = malloc(capacity);
+    while (fgets(line + len, (int)(capacity - len), stdin) != NULL) {
+        len += strlen(line + len);
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+            return line;
+        }
+        capacity *= 2;
+        line = realloc(line, capacity);
+    }
+    if (len == 0) {
+        free(line);
+        return NULL;
+    }
+    return line;
 }
 
 void add_history(char* unused) {}
@@ -30,933 +45,137 @@ void add_history(char* unused) {}
 #include <editline/history.h>
 #endif
 
-
-#define COLUMN_USERNAME_SIZE 32
-#define COLUMN_EMAIL_SIZE 255
-#define INVALID_PAGE_NUM UINT32_MAX
-
-typedef struct {
-    uint32_t id;
-    char user_name[COLUMN_USERNAME_SIZE + 1];
-    char email[COLUMN_EMAIL_SIZE + 1];
-} row;
-
-#define SIZE_OF_ATTRIBUTE(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
-const uint32_t ID_SIZE          = SIZE_OF_ATTRIBUTE(row, id);
-const uint32_t USERNAME_SIZE    = SIZE_OF_ATTRIBUTE(row, user_name);
-const uint32_t EMAIL_SIZE       = SIZE_OF_ATTRIBUTE(row, email);
-#define ID_OFFSET        0
-#define USERNAME_OFFSET  (uint32_t)(ID_OFFSET + ID_SIZE)
-#define EMAIL_OFFSET     (uint32_t)(USERNAME_OFFSET + USERNAME_SIZE)
-#define ROW_SIZE         (uint32_t)(ID_SIZE + USERNAME_SIZE + EMAIL_SIZE)
-
-/*
-    Common node header layout
-*/
-#define NODE_TYPE_SIZE              (uint32_t)(sizeof(uint8_t))
-#define NODE_TYPE_OFFSET            (uint32_t)0
-#define IS_ROOT_SIZE                (uint32_t)(sizeof(uint8_t))
-#define IS_ROOT_OFFSET              NODE_TYPE_SIZE
-#define PARENT_POINTER_SIZE         sizeof(uint32_t)
-#define PARENT_POINTER_OFFSET       (IS_ROOT_OFFSET + IS_ROOT_SIZE)
-#define COMMON_NODE_HEADER_SIZE     (uint8_t)(NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE)
-
-/*
-    Leaf node header layout
-*/
-#define LEAF_NODE_NUM_CELLS_SIZE    (uint32_t)(sizeof(uint32_t))
-#define LEAF_NODE_NUM_CELLS_OFFSET  COMMON_NODE_HEADER_SIZE
-
-#define LEAF_NODE_NEXT_LEAF_SIZE    (uint32_t)(sizeof(uint32_t))
-#define LEAF_NODE_NEXT_LEAF_OFFSET  (uint32_t)(LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE)
-#define LEAF_NODE_HEADER_SIZE       (uint32_t)(COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE)
-
-/*
-    Leaf node body layout
-*/
-#define LEAF_NODE_KEY_SIZE          (uint32_t)(sizeof(uint32_t))
-#define LEAF_NODE_KEY_OFFSET        (uint32_t)0
-#define LEAF_NODE_VALUE_SIZE        ROW_SIZE
-#define LEAF_NODE_VALUE_OFFSET      (uint32_t)(LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE)
-#define LEAF_NODE_CELL_SIZE         (uint32_t)(LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE)
-#define LEAF_NODE_SPACE_FOR_CELLS   (uint32_t)(PAGE_SIZE - LEAF_NODE_HEADER_SIZE)
-#define LEAF_NODE_MAX_CELLS         (uint32_t)(LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE)
-#define LEAF_NODE_RIGHT_SPLIT_COUNT (uint32_t)((LEAF_NODE_MAX_CELLS + 1) / 2)
-#define LEAF_NODE_LEFT_SPLIT_COUNT  (uint32_t)((LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT)
-
-/*
-    Internal node header layout
-*/
-#define INTERNAL_NODE_NUM_KEYS_SIZE         (uint32_t)(sizeof(uint32_t))
-#define INTERNAL_NODE_NUM_KEYS_OFFSET       COMMON_NODE_HEADER_SIZE
-#define INTERNAL_NODE_RIGHT_CHILD_SIZE      (uint32_t)(sizeof(uint32_t))
-#define INTERNAL_NODE_RIGHT_CHILD_OFFSET    (uint32_t)(INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_NUM_KEYS_OFFSET)
-#define INTERNAL_NODE_HEADER_SIZE           (uint32_t)(COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE)
-
 /*
-    Internal node body layout
+    The REPL: reads a line at a time and runs it through the library API.
+    Lines starting with '.' are meta commands handled here.
 */
-#define INTERNAL_NODE_KEY_SIZE      (uint32_t)(sizeof(uint32_t))
-#define INTERNAL_NODE_CHILD_SIZE    (uint32_t)(sizeof(uint32_t))
-#define INTERNAL_NODE_CELL_SIZE     (uint32_t)(INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE)
-#define INTERNAL_NODE_CELL_MAX_SIZE ((uint32_t)3)
-
-
-typedef enum {
-    NODE_INTERNAL,
-    NODE_LEAF,
-} node_type;
-
-uint32_t* get_node_parent(void* node) {
-    return node + PARENT_POINTER_OFFSET;
-}
-
-uint32_t* get_leaf_node_cells_num(void* node) {
-    return node + LEAF_NODE_NUM_CELLS_OFFSET;
-}
-
-void* get_leaf_node_cell(void* node, uint32_t cell_num) {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
-}
-
-uint32_t* get_leaf_node_key(void* node, uint32_t cell_num) {
-    return get_leaf_node_cell(node, cell_num);
-}
-
-void* get_leaf_node_value(void* node, uint32_t cell_num) {
-    return get_leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_OFFSET;
-}
-
-uint32_t* get_leaf_node_next_leaf(void* node) {
-    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
-}
-
-node_type get_node_type(void* node) {
-    uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
-    return (node_type)value;
-}
-
-void set_node_type(void* node, node_type nt) {
-    uint8_t value = nt;
-    *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
-}
-
-void init_leaf_node(void* node) {
-    *get_leaf_node_cells_num(node) = 0;
-    *get_leaf_node_next_leaf(node) = 0;
-    set_node_type(node, NODE_LEAF);
-}
-
-
-void serialize_row(row* src, void* des) {
-    memcpy(des + ID_OFFSET, &(src->id), ID_SIZE);
-    // memcpy(des + USERNAME_OFFSET, &(src->user_name), USERNAME_SIZE);
-    // memcpy(des + EMAIL_OFFSET, &(src->email), EMAIL_SIZE);
-    /*
-        Difference between the code follow and above is 
-        the code follow ensure the all bytes are intialized
-    */ 
-    strncpy(des + USERNAME_OFFSET, src->user_name, USERNAME_SIZE);
-    strncpy(des + EMAIL_OFFSET, src->email, EMAIL_SIZE);
-}
-
-void deserialize_row(void* src, row* des) {
-    memcpy(&(des->id), src + ID_OFFSET, ID_SIZE);
-    memcpy(&(des->user_name), src + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(des->email), src + EMAIL_OFFSET, EMAIL_SIZE);
-}
-
-// 4kb, same size as a page used in the virtual memory systems of most computer architectures
-#define PAGE_SIZE        4096
-#define TABLE_MAX_PAGES  400
-
-typedef struct {
-    int fd; //file descriptor
-    uint32_t file_length;
-    uint32_t num_pages;
-    void* pages[TABLE_MAX_PAGES];
-} pager;
-
-typedef struct {
-    uint32_t root_page_num;
-    pager* pager;
-} table;
-
-typedef struct {
-    table* table;
-    uint32_t page_num;
-    uint32_t cell_num;
-    bool end_of_table;
-} cursor;
-
-void* get_page(pager* pager, uint32_t page_num) {
-    if (page_num > TABLE_MAX_PAGES) {
-        printf("Attempted to fetch page number out of bounds. %d", TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
-    }
-
-    if (pager->pages[page_num] == NULL) {
-        // Cache miss. Allocate memory and load from file
-        void* page = malloc(PAGE_SIZE); //lazy allocate memory
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
-
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
-        }
-
-        if (page_num <= num_pages) {
-            lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->fd, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
-                exit(EXIT_FAILURE);
-            }
-        }
-
-        pager->pages[page_num] = page;
-
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
-        }
-
-    }
-
-    return pager->pages[page_num];
-}
-
-cursor* find_leaf_node(table* tbl, uint32_t page_num, uint32_t key) {
-    void* node = get_page(tbl->pager, page_num);
-    uint32_t num_cells = *get_leaf_node_cells_num(node);
-
-    cursor* cur = malloc(sizeof(cursor));
-    cur->table = tbl;
-    cur->page_num = page_num;
-
-    // Binary search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index  = num_cells;
-    while (one_past_max_index != min_index) {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *get_leaf_node_key(node, index);
-        if (key == key_at_index) {
-            cur->cell_num = index;
-            return cur;
-        }
-
-        if (key < key_at_index) {
-            one_past_max_index = index;
-        } else {
-            min_index = index + 1;
-        }
-    }
-
-    cur->cell_num = min_index;
-    return cur;
-}
-
-/// @brief  Get page, get row and calculate row byte offset in page
-/// @param cur 
-/// @return row pointer base on page and offset
-void* get_cursor_value(cursor* cur) {
-
-    uint32_t page_num = cur->page_num;  // calculate page num
-    void* page = get_page(cur->table->pager, page_num);// get page pointer
-    return get_leaf_node_value(page, cur->cell_num);
-}
-
-void move_cursor_forward(cursor* cur) {
-    uint32_t page_num = cur->page_num;
-    void* node = get_page(cur->table->pager, page_num);
-
-    cur->cell_num += 1;
-    if (cur->cell_num >= (*get_leaf_node_cells_num(node))) {
-        uint32_t next_page_num = *get_leaf_node_next_leaf(node);
-        if (next_page_num == 0) {
-            cur->end_of_table = true;
-        } else {
-            cur->page_num = next_page_num;
-            cur->cell_num = 0;
-        }
-    }
-}
-
-/// @brief Until we start recycling free pages, new pages will always go onto the end of the database file
-/// @param pg 
-/// @return 
-uint32_t get_unused_page_num(pager* pg) {
-    return pg->num_pages;
-}
-
-int is_node_root(void* node) {
-    uint8_t value = *((uint8_t*)(node + IS_ROOT_OFFSET));
-    return (bool)value;
-}
-
-void set_node_root(void* node, bool is_root) {
-    uint8_t value = is_root;
-    *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
-}
-
-uint32_t* get_internal_node_keys_count(void* node) {
-    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
-}
-
-uint32_t* get_internal_node_right_child(void* node) {
-    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
-}
-
-void init_internal_node(void* node) {
-    set_node_root(node, false);
-    set_node_type(node, NODE_INTERNAL);
-    *get_internal_node_keys_count(node) = 0;
-    *get_internal_node_right_child(node) = INVALID_PAGE_NUM;
-}
-
-uint32_t* get_internal_node_cell(void* node, uint32_t cell_num) {
-    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
-}
-
-uint32_t* get_internal_node_child(void* node, uint32_t child_num) {
-    uint32_t num_keys = *get_internal_node_keys_count(node);
-    if (child_num > num_keys) {
-        printf("Tried to access child num %d > num keys %d\n", child_num, num_keys);
-        exit(EXIT_FAILURE);
-    } else if (child_num == num_keys) {
-        uint32_t* right_child = get_internal_node_right_child(node);
-        if (*right_child == INVALID_PAGE_NUM) {
-            printf("Tired to access right child of node which is an invalid page.\n");
-            exit(EXIT_FAILURE);
-        }
-        return right_child;
-    } else {
-        uint32_t* child = get_internal_node_cell(node, child_num);
-        if (*child == INVALID_PAGE_NUM) {
-            printf("Tired to access child %d of node which is an invalid page.\n", child_num);
-            exit(EXIT_FAILURE);
-        }
-        return child;
-    }
-}
-
-uint32_t* get_internal_node_key(void* node, uint32_t key_num) {
-    return (void*)get_internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE; 
-}
-
-uint32_t get_node_max_key(pager* pg, void* node) {                                          
-    switch (get_node_type(node)) {
-        case NODE_INTERNAL:
-        {
-            void* right_child = get_page(pg, *get_internal_node_right_child(node));
-            return get_node_max_key(pg, right_child);
-        }
-        case NODE_LEAF:
-            return *get_leaf_node_key(node, *get_leaf_node_cells_num(node) - 1);
-    }
-}
-
-uint32_t find_internal_node_child(void* node, uint32_t key) {
-    uint32_t num_keys = *get_internal_node_keys_count(node);
-    uint32_t low_idx = 0;
-    uint32_t high_idx = num_keys;
-
-    while (low_idx != high_idx) {
-        uint32_t idx = (low_idx + high_idx) / 2;
-        uint32_t key_to_right = *get_internal_node_key(node, idx);
-        if (key_to_right >= key) {
-            high_idx = idx;
-        } else {
-            low_idx = idx + 1;
-        }
-    }
-
-    return low_idx;
-}
-
-void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
-    uint32_t old_child_index = find_internal_node_child(node, old_key);
-    *get_internal_node_key(node, old_child_index) = new_key;
-}
-
-cursor* find_internal_node(table* tbl, uint32_t page_num, uint32_t key) {
-    void* node = get_page(tbl->pager, page_num);
-    uint32_t child_idx = find_internal_node_child(node, key);
-    uint32_t child_num = *get_internal_node_child(node, child_idx);
-
-    void* child = get_page(tbl->pager, child_num);
-    switch (get_node_type(child)) {
-        case NODE_LEAF:
-            return find_leaf_node(tbl, child_num, key);
-        case NODE_INTERNAL:
-            return find_internal_node(tbl, child_num, key);
-    }
-}
-
-void* create_new_root(table* tbl, uint32_t right_child_page_num) {
-    /*
-        Splitting the root.
-        Old root copied to new page and became the left child.
-        Address of right child passed in.
-        Re-initialize root page to contain the new root.
-        New root points two children
-    */
-
-    void* root = get_page(tbl->pager, tbl->root_page_num);
-    void* right_child = get_page(tbl->pager, right_child_page_num);
-    uint32_t left_child_page_num = get_unused_page_num(tbl->pager);
-    void* left_child = get_page(tbl->pager, left_child_page_num);
-
-    if (get_node_type(root) == NODE_INTERNAL) {
-        init_internal_node(right_child);
-        init_internal_node(left_child);
-    }
-
-    /*
-        Left child holds the data copied from old root
-    */
-    memcpy(left_child, root, PAGE_SIZE);
-    set_node_root(left_child, false);
-    if (get_node_type(left_child) == NODE_INTERNAL) {
-        void* child;
-        for (int i = 0; i < *get_internal_node_keys_count(left_child); i++) {
-            child = get_page(tbl->pager, *get_internal_node_child(left_child, i));
-            *get_node_parent(child) = left_child_page_num;
-        }
-        child = get_page(tbl->pager, *get_internal_node_right_child(left_child));
-        *get_node_parent(child) = left_child_page_num;
-    }
-
-    /*
-        New root is an internal node with 1 key and 2 children
-    */
-    init_internal_node(root);
-    set_node_root(root, true);
-
-    *get_internal_node_keys_count(root) = 1;
-    *get_internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(tbl->pager, left_child);
-    *get_internal_node_key(root, 0) = left_child_max_key;
-    *get_internal_node_right_child(root) = right_child_page_num;       
-    
-    *get_node_parent(left_child) = tbl->root_page_num;
-    *get_node_parent(right_child) = tbl->root_page_num;
-}
-void insert_and_split_internal_node(table* tbl, uint32_t parent_page_num, uint32_t child_page_num);
-
-void insert_internal_node(table* tbl, uint32_t parent_page_num, uint32_t child_page_num) {
-    void* parent = get_page(tbl->pager, parent_page_num);
-    void* child = get_page(tbl->pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(tbl->pager, child);
-    uint32_t index = find_internal_node_child(parent, child_max_key);
-
-    uint32_t origin_num_keys = *get_internal_node_keys_count(parent);
-
-    if (origin_num_keys >= INTERNAL_NODE_CELL_MAX_SIZE) {
-        insert_and_split_internal_node(tbl, parent_page_num, child_page_num);
-        return;
-    }
-
-    uint32_t right_child_page_num = *get_internal_node_right_child(parent);
-    if (right_child_page_num == INVALID_PAGE_NUM) {
-        *get_internal_node_right_child(parent) = child_page_num;
-        return;
-    }
-
-    void* right_child = get_page(tbl->pager, right_child_page_num);
-
-    *get_internal_node_keys_count(parent) = origin_num_keys + 1;
-
-    if (child_max_key > get_node_max_key(tbl->pager, right_child)) {
-        *get_internal_node_child(parent, origin_num_keys) = right_child_page_num;
-        *get_internal_node_key(parent, origin_num_keys) = get_node_max_key(tbl->pager, right_child);
-        *get_internal_node_right_child(parent) = child_page_num;
-    } else {
-        for (uint32_t i = origin_num_keys; i > index; i--) {
-            void* dest = get_internal_node_cell(parent, i);
-            void* src = get_internal_node_cell(parent, i - 1);
-            memcpy(dest, src, INTERNAL_NODE_CELL_SIZE);
-        }
-        
-        *get_internal_node_child(parent, index) = child_page_num;
-        *get_internal_node_key(parent, index) = child_max_key;
-    }
-
-
-}
-
-void insert_and_split_internal_node(table* tbl, uint32_t parent_page_num, uint32_t child_page_num)  {
-    uint32_t old_page_num = parent_page_num;
-    void* old_node = get_page(tbl->pager, parent_page_num);
-    uint32_t old_max = get_node_max_key(tbl->pager, old_node);
-
-    void* child = get_page(tbl->pager, child_page_num);
-    uint32_t child_max = get_node_max_key(tbl->pager, child);
-
-    uint32_t new_page_num = get_unused_page_num(tbl->pager);
-
-    uint32_t splitting_root = is_node_root(old_node);
-
-    void* parent;
-    void* new_node;
-
-    if (splitting_root) {
-        create_new_root(tbl, new_page_num);
-        parent = get_page(tbl->pager, tbl->root_page_num);
-
-        old_page_num = *get_internal_node_child(parent, 0);
-        old_node = get_page(tbl->pager, old_page_num);
-    } else {
-        parent = get_page(tbl->pager, *get_node_parent(old_node));
-        new_node = get_page(tbl->pager, new_page_num);
-        init_internal_node(new_node);
-    }
-
-    uint32_t* old_num_keys = get_internal_node_keys_count(old_node);
-    uint32_t current_page_num = *get_internal_node_right_child(old_node);
-    void* current = get_page(tbl->pager, current_page_num);
-
-    insert_internal_node(tbl, new_page_num, current_page_num);
-    *get_node_parent(current) = new_page_num;
-    *get_internal_node_right_child(old_node) = INVALID_PAGE_NUM;
-
-    for (int i = INTERNAL_NODE_CELL_MAX_SIZE - 1; i > INTERNAL_NODE_CELL_MAX_SIZE / 2; i--) {
-        current_page_num = *get_internal_node_child(old_node, i);
-        current = get_page(tbl->pager, current_page_num);
-
-        insert_internal_node(tbl, new_page_num, current_page_num);
-        *get_node_parent(current) = new_page_num;
-
-        (*old_num_keys)--;
-    }
-    
-    uint32_t max_after_split = get_node_max_key(tbl->pager, old_node);
-    uint32_t dest_page_num = child_max < max_after_split ? old_page_num : new_page_num;
-    insert_internal_node(tbl, dest_page_num, child_page_num);
-
-    *get_node_parent(child) = dest_page_num;
-    update_internal_node_key(parent, old_max, get_node_max_key(tbl->pager, old_node));
-
-    if (!splitting_root) {
-        insert_internal_node(tbl, *get_node_parent(old_node), new_page_num);
-        *get_node_parent(new_node) = *get_node_parent(old_node);
-    }
-}
-
-cursor* find_table(table* tbl, uint32_t key) {
-    uint32_t root_page_num = tbl->root_page_num;
-    void* root_node = get_page(tbl->pager, root_page_num);
-
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return find_leaf_node(tbl, root_page_num, key);
-    } else {
-       return find_internal_node(tbl, root_page_num, key);
-    }
-}
-
-cursor* begin_table(table* tbl) {
-    cursor* curs = find_table(tbl, 0);
-    void* node = get_page(curs->table->pager, curs->page_num);
-    uint32_t num_cells = *get_leaf_node_cells_num(node);
-    curs->end_of_table = num_cells == 0;
-    return curs;
-}
-
-void insert_and_split_leaf_node(cursor* cur, uint32_t key, row* value) {
-    /*
-        Create a new node and move half the cells over.
-        Insert the new value in one of the two nodes.
-        Update parent or create a new parent.
-    */
-    void* old_node = get_page(cur->table->pager, cur->page_num);
-    uint32_t old_max = get_node_max_key(cur->table->pager, old_node);
-    uint32_t new_page_num = get_unused_page_num(cur->table->pager);
-    void* new_node = get_page(cur->table->pager, new_page_num);
-    init_leaf_node(new_node);
-    *get_leaf_node_next_leaf(new_node) = *get_leaf_node_next_leaf(old_node);
-    *get_leaf_node_next_leaf(old_node) = new_page_num;
-
-    /*
-        All existing keys plus new key should be divided
-        evenly between old (left) and new (right) nodes.
-        Starting from the right, move each key to correct position.
-    */
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        void* des_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            des_node = new_node;
-        } else {
-            des_node = old_node;
-        }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* dest = get_leaf_node_cell(des_node, index_within_node);
-
-        if (i == cur->cell_num) {
-            serialize_row(value, get_leaf_node_value(des_node, index_within_node));
-            *get_leaf_node_key(des_node, index_within_node) = key;
-        } else if (i > cur->cell_num) {
-            memcpy(dest, get_leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
-        } else {
-            memcpy(dest, get_leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
-        }
-    }
-
-    /*
-        Update cell count on both leaf nodes
-    */
-    *(get_leaf_node_cells_num(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(get_leaf_node_cells_num(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
-
-    if (is_node_root(old_node)) {
-        create_new_root(cur->table, new_page_num);
-    } else {
-
-        // Update node parent
-        uint32_t parent_page_num = *get_node_parent(old_node);
-        uint32_t new_max = get_node_max_key(cur->table->pager, old_node);
-        void* parent = get_page(cur->table->pager, parent_page_num);
-
-        //TODO:
-        update_internal_node_key(parent, old_max, new_max);
-        insert_internal_node(cur->table, parent_page_num, new_page_num);
-    }
-}
-
-void insert_leaf_node(cursor* cur, uint32_t key, row* value) {
-    void* node = get_page(cur->table->pager, cur->page_num);
-
-    uint32_t num_cells = *get_leaf_node_cells_num(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
-        insert_and_split_leaf_node(cur, key, value);
-        return;
-    }
-
-    if (cur->cell_num < num_cells) {
-        for (uint32_t i = num_cells; i > cur->cell_num; i--) {
-            memcpy(
-                get_leaf_node_cell(node, i), 
-                get_leaf_node_cell(node, i - 1), 
-                LEAF_NODE_CELL_SIZE);
-        }
-    }
-    
-    *(get_leaf_node_cells_num(node)) += 1;
-    *(get_leaf_node_key(node, cur->cell_num)) = key;
-    serialize_row(value, get_leaf_node_value(node, cur->cell_num));
-}
-
-void indent(uint32_t level) {
-    for (uint32_t i = 0; i < level; ++i) {
-        printf("  ");
-    }
-}
-
-void print_tree(pager* pg, uint32_t page_num, uint32_t indent_level) {
-    void* node = get_page(pg, page_num);
-    uint32_t num_keys, child;
-
-    switch (get_node_type(node)) {
-        case NODE_LEAF:
-            num_keys = *get_leaf_node_cells_num(node);
-            indent(indent_level);
-            printf("- leaf (size %d)\n", num_keys);
-            for (uint32_t i = 0; i < num_keys; i++) {
-                indent(indent_level + 1);
-                printf("- %d\n", *get_leaf_node_key(node, i));
-            }
-            break;
-        case NODE_INTERNAL:
-            num_keys = *get_internal_node_keys_count(node);
-            indent(indent_level);
-            printf("- internal (size %d)\n", num_keys);
-            if (num_keys > 0) {
-                for (uint32_t i = 0; i < num_keys; i++) {
-                    child = *get_internal_node_child(node, i);
-                    print_tree(pg, child, indent_level + 1);
-
-                    indent(indent_level + 1);
-                    printf("- key %d\n", *get_internal_node_key(node, i));
-                }
-
-                child = *get_internal_node_right_child(node);
-                print_tree(pg, child, indent_level + 1);
-            }
-            break;
-    }
-}
-
-
-typedef enum {
-    EXECUTE_SUCCESS,
-    EXECUTE_TATBLE_FULL,
-    EXECUTE_DUPICATE_KEY,
-} execute_result;
-
 
 typedef enum {
     META_COMMAND_SUCCESS,
     META_COMMAND_UNDEFINED,
 } meta_command_result;
 
-typedef enum {
-    PREPARE_SUCCESS,
-    PREPARE_FAIL,
-    PREPARE_SYNTAX_ERROR,
-    PREPARE_STRING_TOO_LONG,
-    PREPARE_NEGATIVE_ID,
-} prepare_result;
-
-typedef enum {
-    STATEMENT_INSERT,
-    STATEMENT_SELECT,
-} statement_type;
-
-typedef struct {
-    statement_type type;
-    row row_to_insert;
-} statement;
-
-pager* open_pager(const char* file_name) {
-    int fd = open(file_name,
-                  O_RDWR | O_CREAT,     // Read/write mode | Create if not exist
-                  S_IWUSR | S_IRUSR    // User write permission | User read permission
-                 );
-    if (fd == -1) {
-        printf("Unable to open file\n");
-        exit(EXIT_FAILURE);
-    }
-
-    off_t file_len = lseek(fd, 0, SEEK_END);
-
-    pager* pg = malloc(sizeof(pager));
-    pg->fd = fd;
-    pg->file_length = file_len;
-    pg->num_pages = (file_len / PAGE_SIZE);
-
-    if (file_len % PAGE_SIZE != 0) {
-        printf("Db file is not a whole number of pages. Corrupt file.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pg->pages[i] = NULL;
-    }
-    
-    return pg;
-}
-
-void page_flush(pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        printf("Attempted to flush null page\n");
-        exit(EXIT_FAILURE);
-    }
-
-    off_t offset = lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
-    }
-
-    ssize_t bytes_written = write(pager->fd, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1) {
-        printf("Error writing: %d\n", errno);
-        exit(EXIT_FAILURE);
-    }
-}
-
-
-table* open_db(const char* file_name) {
-    pager* pager = open_pager(file_name);
-
-    table* tbl = malloc(sizeof(table));
-    tbl->root_page_num = 0;
-    tbl->pager = pager;
-
-    if (pager->num_pages == 0) {
-        void* root_node = get_page(pager, 0);
-        init_leaf_node(root_node);
-        set_node_root(root_node, true);
-    }
-
-    return tbl;
-}
-
-void close_db(table* tbl) {
-    pager* pager = tbl->pager;
-
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
-        }
-
-        page_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
-    }
-
-    int result = close(pager->fd);
-    if (result == -1) {
-        printf("Error closing db file.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    free(pager);
-    free(tbl);
-}
-
-
-void free_table(table* tbl) {
-    for (size_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        free(tbl->pager->pages[i]);
-    }
-    free(tbl->pager);
-    free(tbl);
-}
-
-void print_constants() {
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
-    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
-}
-
-meta_command_result validate_mata_command(char* cmd, table* tbl) {
+meta_command_result validate_mata_command(char* cmd, tdb* db, output* out) {
 
     if (strcmp(cmd, ".exit") == 0) {
-        close_db(tbl);
+        tdb_close(db);
         exit(EXIT_SUCCESS);
     }
     else if (strcmp(cmd, ".constants") == 0) {
         printf("Constants:\n");
-        print_constants();
+        tdb_print_constants();
         return META_COMMAND_SUCCESS;
     }
     else if (strcmp(cmd, ".btree") == 0) {
         printf("Tree:\n");
-        print_tree(tbl->pager, 0, 0);
+        tdb_print_tree(db);
         return META_COMMAND_SUCCESS;
     }
-
-    return META_COMMAND_UNDEFINED;
-}
-
-prepare_result prepare_insert(char* input, statement* stmt) {
-    stmt->type = STATEMENT_INSERT;
-    char* keyword = strtok(input, " ");
-    char* id_str = strtok(NULL, " ");
-    char* user_name = strtok(NULL, " ");
-    char* email = strtok(NULL, " ");
-
-    if (id_str == NULL || user_name == NULL || email == NULL) {
-        return PREPARE_SYNTAX_ERROR;
+    else if (strcmp(cmd, ".pool") == 0) {
+        printf("Buffer pool:\n");
+        tdb_print_pool_stats(db);
+        return META_COMMAND_SUCCESS;
     }
-
-    int id = atoi(id_str);
-    
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
+    else if (strcmp(cmd, ".wal") == 0) {
+        printf("WAL:\n");
+        tdb_print_wal_stats(db);
+        return META_COMMAND_SUCCESS;
     }
-
-    if (strlen(user_name) > COLUMN_USERNAME_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+    else if (strcmp(cmd, ".stats") == 0) {
+        printf("Statistics:\n");
+        tdb_print_stats(db);
+        return META_COMMAND_SUCCESS;
     }
-
-    if (strlen(email) > COLUMN_EMAIL_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+    else if (strcmp(cmd, ".stats reset") == 0) {
+        tdb_reset_stats(db);
+        return META_COMMAND_SUCCESS;
     }
-
-    stmt->row_to_insert.id = id;
-    strcpy(stmt->row_to_insert.user_name, user_name);
-    strcpy(stmt->row_to_insert.email, email);
-
-    return PREPARE_SUCCESS;
-}
-
-prepare_result prepare_statement(char* input, statement* stmt) {
-    
-    if (strncmp(input, "insert", 6) == 0) {
-        return prepare_insert(input, stmt);
+    else if (strcmp(cmd, ".checkpoint") == 0) {
+        tdb_checkpoint(db);
+        return META_COMMAND_SUCCESS;
     }
-
-    if (strcmp(input, "select") == 0) {
-        stmt->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+    else if (strcmp(cmd, ".integrity_check") == 0) {
+        printf("Integrity check:\n");
+        tdb_integrity_check(db);
+        return META_COMMAND_SUCCESS;
     }
-
-    return PREPARE_FAIL;
-}
-
-void print_row(row* row) {
-    printf("(%d, %s, %s)\n", row->id, row->user_name, row->email);
-}
-
-execute_result execute_insert(statement* stmt, table* tbl) {
-
-    void* node = get_page(tbl->pager, tbl->root_page_num);
-    uint32_t num_cells = (*get_leaf_node_cells_num(node));
-    // if (num_cells >= LEAF_NODE_MAX_CELLS) {
-    //     return EXECUTE_TATBLE_FULL;
-    // }
-
-    row* row_to_insert = &(stmt->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
-    cursor* cur = find_table(tbl, key_to_insert);
-
-    if (cur->cell_num < num_cells) {
-        uint32_t key_at_index = *get_leaf_node_key(node, cur->cell_num);
-        if (key_at_index == key_to_insert) {
-            return EXECUTE_DUPICATE_KEY;
-        }                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                
+    else if (strcmp(cmd, ".vacuum") == 0) {
+        tdb_vacuum(db);
+        return META_COMMAND_SUCCESS;
     }
-
-    insert_leaf_node(cur, row_to_insert->id, row_to_insert);
-
-    free(cur);
-
-    return EXECUTE_SUCCESS;
-}
-
-execute_result execute_select(statement* stmt, table* tbl) {
-    cursor* cur = begin_table(tbl);
-
-    row row;
-
-    while (!cur->end_of_table) {
-        deserialize_row(get_cursor_value(cur), &row);
-        print_row(&row);
-        move_cursor_forward(cur);
+    else if (strncmp(cmd, ".mode", 5) == 0 && (cmd[5] == ' ' || cmd[5] == '\0')) {
+        char* name = strtok(cmd + 5, " ");
+        if (name == NULL || !output_set_mode(out, name)) {
+            printf("Usage: .mode text|csv|binary|arrow\n");
+        }
+        return META_COMMAND_SUCCESS;
     }
-
-    free(cur);
-
-    return EXECUTE_SUCCESS;
-}
-
-execute_result execute_statement(statement* stmt, table* tbl) {
-    switch (stmt->type) {
-        case STATEMENT_INSERT:
-            return execute_insert(stmt, tbl);
-        case STATEMENT_SELECT:
-            return execute_select(stmt, tbl);
+    else if (strncmp(cmd, ".output", 7) == 0 && (cmd[7] == ' ' || cmd[7] == '\0')) {
+        char* file_name = strtok(cmd + 7, " ");
+        if (!output_set_file(out, file_name)) {
+            printf("Unable to open '%s'.\n", file_name);
+        }
+        return META_COMMAND_SUCCESS;
+    }
+    else if (strncmp(cmd, ".import ", 8) == 0) {
+        char* file_name = strtok(cmd + 8, " ");
+        char* fill_str = strtok(NULL, " ");
+        int fill_percent = fill_str == NULL ? 100 : atoi(fill_str);
+        if (file_name == NULL || fill_percent < 1 || fill_percent > 100) {
+            printf("Usage: .import <file> [fill percent 1-100]\n");
+            return META_COMMAND_SUCCESS;
+        }
+        tdb_import(db, file_name, fill_percent);
+        return META_COMMAND_SUCCESS;
     }
+
+    return META_COMMAND_UNDEFINED;
 }
 
 int main(int argc, char** argv) {
-    
+
     if (argc < 2) {
         printf("A database filename is required.\n");
         exit(EXIT_FAILURE);
     }
 
     char* file_name = argv[1];
-    table* table = open_db(file_name);
+    tdb_config cfg;
+    tdb_default_config(&cfg);
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--pool-frames") == 0 && i + 1 < argc) {
+            cfg.pool_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            cfg.mode = TDB_PAGER_MMAP;
+        } else if (strcmp(argv[i], "--wal-sync-ms") == 0 && i + 1 < argc) {
+            cfg.wal_sync_window_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-ms") == 0 && i + 1 < argc) {
+            cfg.checkpoint_interval_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-pages") == 0 && i + 1 < argc) {
+            cfg.checkpoint_pages = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            cfg.compress = true;
+        } else {
+            printf("Unknown option '%s'.\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Before anything is printed, it sets up stdout's buffer
+    output* out = output_open();
+    tdb* db = tdb_open(file_name, &cfg);
 
     for (;;) {
         char* input = realine("tdb > ");
+        if (input == NULL) {
+            // End of input, as .exit
+            input = strdup(".exit");
+        }
         add_history(input);
 
         if (input[0] == '.') {
-           switch (validate_mata_command(input, table)) {
+           switch (validate_mata_command(input, db, out)) {
                 case META_COMMAND_SUCCESS:
                     continue;
                 default:
@@ -966,37 +185,68 @@ int main(int argc, char** argv) {
            }
         }
 
-        statement stmt;
-        switch (prepare_statement(input, &stmt)) {
-            case PREPARE_SUCCESS:
+        tdb_stmt* stmt;
+        switch (tdb_prepare(db, input, &stmt)) {
+            case TDB_OK:
                 break;
-            case PREPARE_SYNTAX_ERROR:
+            case TDB_SYNTAX_ERROR:
                 printf("Syntax error. Failed to parse statement.\n");
                 continue;
-            case PREPARE_STRING_TOO_LONG:
+            case TDB_STRING_TOO_LONG:
                 printf("String is too long.\n");
                 continue;
-            case PREPARE_NEGATIVE_ID:
+            case TDB_NEGATIVE_ID:
                 printf("ID must be positive.\n");
                 continue;
+            case TDB_NO_SUCH_TABLE:
+                printf("No such table.\n");
+                continue;
+            case TDB_ROW_TOO_LARGE:
+                printf("Row is too large.\n");
+                continue;
             default:
-            case PREPARE_FAIL:
+            case TDB_UNRECOGNIZED:
                 printf("Unrecognized keyword at start of '%s'.\n", input);
                 continue;
         }
 
-        switch(execute_statement(&stmt, table)) {
-            case EXECUTE_SUCCESS:
-                printf("Executed.\n");
-                break;
-            case EXECUTE_DUPICATE_KEY:
+        tdb_result result;
+        output_begin(out, stmt);
+        while ((result = tdb_step(stmt, NULL)) == TDB_ROW) {
+            output_row(out, stmt);
+        }
+        output_end(out);
+        tdb_finalize(stmt);
+
+        switch (result) {
+            case TDB_DUPLICATE_KEY:
                 printf("Error: Duplicate key.\n");
                 break;
-            case EXECUTE_TATBLE_FULL:
+            case TDB_TABLE_FULL:
                 printf("Error: Table is full.\n");
                 break;
+            case TDB_MISUSE:
+                printf("Error: Statement has unbound parameters.\n");
+                break;
+            case TDB_TRANSACTION_OPEN:
+                printf("Error: A transaction is already open.\n");
+                break;
+            case TDB_NO_TRANSACTION:
+                printf("Error: No transaction is open.\n");
+                break;
+            case TDB_TRANSACTION_FULL:
+                printf("Error: Transaction is too large for the buffer pool.\n");
+                break;
+            case TDB_INDEX_EXISTS:
+                printf("Error: Index already exists.\n");
+                break;
+            case TDB_TABLE_EXISTS:
+                printf("Error: Table already exists.\n");
+                break;
+            default:
+                printf("Executed.\n");
+                break;
         }
     }
 
 }
-
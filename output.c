@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "output.h"
+
+#define OUTPUT_BUFFER_SIZE  (1024 * 1024)
+#define OUTPUT_TEXT_BYTES   (64 * 1024)     // a text column's bytes to start with, grown as needed
+
+typedef enum {
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_BINARY,
+    OUTPUT_ARROW,
+} output_mode;
+
+static const char* MODE_NAMES[] = { "text", "csv", "binary", "arrow" };
+
+typedef struct {
+    int64_t* ints;          // int column: a value per row
+    uint32_t* offsets;      // text column: where each row's text starts in bytes, and where the last one ends
+    char* bytes;
+    uint32_t bytes_capacity;
+} column_batch;
+
+struct output {
+    output_mode mode;
+    FILE* file;
+    char* stdout_buf;
+    char* file_buf;             // of the file .output opened, if any
+    bool active;                // between output_begin and output_end of a select
+    uint32_t column_count;
+    tdb_type types[TDB_MAX_COLUMNS];
+    uint32_t rows;              // rows in the batch so far
+    column_batch columns[TDB_MAX_COLUMNS];
+};
+
+/*
+    The large buffer is the stream's own, so what the REPL and the engine
+    print goes out in order with the rows, also when the engine exits on a
+    fatal error. A row costs a copy into it, and a full buffer goes out in
+    one write.
+*/
+
+output* output_open(void) {
+    output* out = calloc(1, sizeof(output));
+    out->mode = OUTPUT_TEXT;
+    out->file = stdout;
+    out->stdout_buf = malloc(OUTPUT_BUFFER_SIZE);
+    setvbuf(stdout, out->stdout_buf, _IOFBF, OUTPUT_BUFFER_SIZE);
+    return out;
+}
+
+void output_bytes(output* out, const void* data, uint32_t size) {
+    fwrite(data, 1, size, out->file);
+}
+
+void output_u32(output* out, uint32_t value) {
+    output_bytes(out, &value, sizeof(value));
+}
+
+/// @brief Zeros after a part of the given size, up to a multiple of 8 bytes
+/// @param out
+/// @param size
+void output_pad(output* out, uint64_t size) {
+    static const uint8_t zeros[8];
+    output_bytes(out, zeros, (8 - size % 8) % 8);
+}
+
+static uint64_t padded(uint64_t size) {
+    return (size + 7) / 8 * 8;
+}
+
+bool output_set_mode(output* out, const char* name) {
+    for (uint32_t i = 0; i < sizeof(MODE_NAMES) / sizeof(MODE_NAMES[0]); i++) {
+        if (strcmp(name, MODE_NAMES[i]) == 0) {
+            out->mode = i;
+#ifdef _WIN32
+            // Line ends would be translated in the middle of the binary modes' data
+            if (out->file == stdout) {
+                _setmode(_fileno(stdout), i >= OUTPUT_BINARY ? _O_BINARY : _O_TEXT);
+            }
+#endif
+            return true;
+        }
+    }
+    return false;
+}
+
+bool output_set_file(output* out, const char* file_name) {
+    FILE* file = stdout;
+    char* file_buf = NULL;
+    if (file_name != NULL) {
+        file = fopen(file_name, "wb");
+        if (file == NULL) {
+            return false;
+        }
+        file_buf = malloc(OUTPUT_BUFFER_SIZE);
+        setvbuf(file, file_buf, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+    if (out->file != stdout) {
+        fclose(out->file);
+        free(out->file_buf);
+    }
+    out->file = file;
+    out->file_buf = file_buf;
+    output_set_mode(out, MODE_NAMES[out->mode]);
+    return true;
+}
+
+/*
+    Text and csv: a row is formatted straight into the buffer.
+*/
+
+void output_int(output* out, int64_t value) {
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    output_bytes(out, p, digits + sizeof(digits) - p);
+}
+
+void output_csv_text(output* out, const char* text) {
+    size_t length = strlen(text);
+    if (strpbrk(text, ",\"\r\n") == NULL) {
+        output_bytes(out, text, length);
+        return;
+    }
+    output_bytes(out, "\"", 1);
+    for (const char* quote; (quote = strchr(text, '"')) != NULL; text = quote + 1) {
+        output_bytes(out, text, quote + 1 - text);
+        output_bytes(out, "\"", 1);
+    }
+    output_bytes(out, text, strlen(text));
+    output_bytes(out, "\"", 1);
+}
+
+void output_text_row(output* out, tdb_stmt* stmt) {
+    bool csv = out->mode == OUTPUT_CSV;
+    if (!csv) {
+        output_bytes(out, "(", 1);
+    }
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        if (i > 0) {
+            output_bytes(out, csv ? "," : ", ", csv ? 1 : 2);
+        }
+        if (out->types[i] == TDB_TYPE_INT) {
+            output_int(out, tdb_column_int(stmt, i));
+        } else if (csv) {
+            output_csv_text(out, tdb_column_text(stmt, i));
+        } else {
+            const char* text = tdb_column_text(stmt, i);
+            output_bytes(out, text, strlen(text));
+        }
+    }
+    output_bytes(out, csv ? "\n" : ")\n", csv ? 1 : 2);
+}
+
+/*
+    Arrow IPC stream.
+    Every message is 0xFFFFFFFF, the size of its metadata, the metadata (a
+    flatbuffer of Message.fbs) and a body holding the buffers of a record
+    batch. The flatbuffers here are small and always have the same shape,
+    so they are laid out front to back by hand: a table is preceded by its
+    vtable, and the strings, vectors and tables it points to follow it.
+*/
+#define ARROW_METADATA_SIZE     8192
+#define ARROW_METADATA_V5       4
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_BATCH      3
+#define ARROW_TYPE_INT          2
+#define ARROW_TYPE_UTF8         5
+
+typedef struct {
+    uint8_t data[ARROW_METADATA_SIZE];
+    uint32_t size;
+} flatbuffer;
+
+void fb_align(flatbuffer* fb, uint32_t align) {
+    while (fb->size % align != 0) {
+        fb->data[fb->size++] = 0;
+    }
+}
+
+void fb_set(flatbuffer* fb, uint32_t at, const void* value, uint32_t size) {
+    memcpy(fb->data + at, value, size);
+}
+
+/// @brief Point the offset field at to an object written after it
+/// @param fb
+/// @param at
+/// @param target
+void fb_link(flatbuffer* fb, uint32_t at, uint32_t target) {
+    uint32_t offset = target - at;
+    fb_set(fb, at, &offset, sizeof(offset));
+}
+
+/// @brief Add a table with zeroed fields
+/// @param fb
+/// @param field_count
+/// @param sizes bytes of each field in order of id, 0 for a field left out
+/// @param fields set to where each field is
+/// @return where the table starts
+uint32_t fb_table(flatbuffer* fb, uint32_t field_count, const uint8_t* sizes, uint32_t* fields) {
+    uint16_t table_size = sizeof(int32_t);
+    uint16_t field_offsets[8];
+    for (uint32_t i = 0; i < field_count; i++) {
+        field_offsets[i] = 0;
+        if (sizes[i] > 0) {
+            table_size = (table_size + sizes[i] - 1) / sizes[i] * sizes[i];
+            field_offsets[i] = table_size;
+            table_size += sizes[i];
+        }
+    }
+
+    fb_align(fb, sizeof(uint16_t));
+    uint32_t vtable = fb->size;
+    uint16_t vtable_size = (2 + field_count) * sizeof(uint16_t);
+    fb_set(fb, vtable, &vtable_size, sizeof(uint16_t));
+    fb_set(fb, vtable + 2, &table_size, sizeof(uint16_t));
+    fb_set(fb, vtable + 4, field_offsets, field_count * sizeof(uint16_t));
+    fb->size += vtable_size;
+
+    // 8 bytes aligned, so are its 8 byte fields
+    fb_align(fb, 8);
+    uint32_t table = fb->size;
+    int32_t to_vtable = table - vtable;
+    memset(fb->data + table, 0, table_size);
+    fb_set(fb, table, &to_vtable, sizeof(to_vtable));
+    fb->size += table_size;
+    for (uint32_t i = 0; i < field_count; i++) {
+        fields[i] = table + field_offsets[i];
+    }
+    return table;
+}
+
+/// @brief Add a vector of zeroed elements
+/// @param fb
+/// @param count
+/// @param element_size
+/// @return where its length is, the elements follow
+uint32_t fb_vector(flatbuffer* fb, uint32_t count, uint32_t element_size) {
+    // Structs of int64s start 8 bytes aligned, right after the 4 byte length
+    fb_align(fb, 4);
+    if (element_size % 8 == 0 && fb->size % 8 == 0) {
+        fb_set(fb, fb->size, &(uint32_t){ 0 }, sizeof(uint32_t));
+        fb->size += 4;
+    }
+    uint32_t vector = fb->size;
+    fb_set(fb, vector, &count, sizeof(count));
+    memset(fb->data + vector + 4, 0, count * element_size);
+    fb->size += 4 + count * element_size;
+    return vector;
+}
+
+uint32_t fb_string(flatbuffer* fb, const char* s) {
+    fb_align(fb, 4);
+    uint32_t string = fb->size;
+    uint32_t length = strlen(s);
+    fb_set(fb, string, &length, sizeof(length));
+    memcpy(fb->data + string + 4, s, length + 1);
+    fb->size += 4 + length + 1;
+    return string;
+}
+
+/// @brief Start the metadata of a message
+/// @param fb
+/// @param header_type
+/// @param body_length
+/// @return where the offset of its header goes
+uint32_t arrow_message(flatbuffer* fb, uint8_t header_type, int64_t body_length) {
+    // version, header_type, header, bodyLength
+    static const uint8_t sizes[] = { 2, 1, 4, 8 };
+    uint32_t fields[4];
+    fb->size = sizeof(uint32_t);
+    fb_link(fb, 0, fb_table(fb, 4, sizes, fields));
+
+    int16_t version = ARROW_METADATA_V5;
+    fb_set(fb, fields[0], &version, sizeof(version));
+    fb_set(fb, fields[1], &header_type, sizeof(header_type));
+    fb_set(fb, fields[3], &body_length, sizeof(body_length));
+    return fields[2];
+}
+
+/// @brief Write a message's metadata, its body follows
+/// @param out
+/// @param fb
+void output_arrow_metadata(output* out, flatbuffer* fb) {
+    fb_align(fb, 8);
+    output_u32(out, UINT32_MAX);
+    output_u32(out, fb->size);
+    output_bytes(out, fb->data, fb->size);
+}
+
+void output_arrow_schema(output* out, tdb_stmt* stmt) {
+    static const uint8_t schema_sizes[] = { 2, 4 };                 // endianness, fields
+    static const uint8_t field_sizes[] = { 4, 1, 1, 4, 0, 4 };      // name, nullable, type_type, type, dictionary, children
+    static const uint8_t int_sizes[] = { 4, 1 };                    // bitWidth, is_signed
+    flatbuffer fb;
+    uint32_t schema_fields[2];
+    uint32_t header = arrow_message(&fb, ARROW_HEADER_SCHEMA, 0);
+    fb_link(&fb, header, fb_table(&fb, 2, schema_sizes, schema_fields));
+
+    // Little (0) or big (1) endian, the buffers are in the machine's byte order
+    uint16_t one = 1;
+    int16_t endianness = *(uint8_t*)&one == 0;
+    fb_set(&fb, schema_fields[0], &endianness, sizeof(endianness));
+
+    uint32_t vector = fb_vector(&fb, out->column_count, sizeof(uint32_t));
+    fb_link(&fb, schema_fields[1], vector);
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        uint32_t fields[6];
+        fb_link(&fb, vector + 4 + 4 * i, fb_table(&fb, 6, field_sizes, fields));
+        fb_link(&fb, fields[0], fb_string(&fb, tdb_column_name(stmt, i)));
+
+        uint8_t type_type = out->types[i] == TDB_TYPE_INT ? ARROW_TYPE_INT : ARROW_TYPE_UTF8;
+        fb_set(&fb, fields[2], &type_type, sizeof(type_type));
+        if (out->types[i] == TDB_TYPE_INT) {
+            uint32_t int_fields[2];
+            fb_link(&fb, fields[3], fb_table(&fb, 2, int_sizes, int_fields));
+            int32_t bit_width = 64;
+            bool is_signed = true;
+            fb_set(&fb, int_fields[0], &bit_width, sizeof(bit_width));
+            fb_set(&fb, int_fields[1], &is_signed, sizeof(is_signed));
+        } else {
+            fb_link(&fb, fields[3], fb_table(&fb, 0, NULL, NULL));
+        }
+        fb_link(&fb, fields[5], fb_vector(&fb, 0, sizeof(uint32_t)));
+    }
+    output_arrow_metadata(out, &fb);
+}
+
+/// @brief Bytes of a column's buffers in the batch
+/// @param out
+/// @param column
+/// @param sizes set to the size of each buffer, data and offsets for a text
+/// @return number of buffers, 1 or 2
+uint32_t batch_buffers(output* out, uint32_t column, uint64_t* sizes) {
+    column_batch* c = &out->columns[column];
+    if (out->types[column] == TDB_TYPE_INT) {
+        sizes[0] = (uint64_t)out->rows * sizeof(int64_t);
+        return 1;
+    }
+    sizes[0] = (uint64_t)(out->rows + 1) * sizeof(uint32_t);
+    sizes[1] = c->offsets[out->rows];
+    return 2;
+}
+
+void output_arrow_batch(output* out) {
+    static const uint8_t batch_sizes[] = { 8, 4, 4 };   // length, nodes, buffers
+    flatbuffer fb;
+    uint32_t buffer_count = 0;
+    int64_t body_length = 0;
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        uint64_t sizes[2];
+        uint32_t count = batch_buffers(out, i, sizes);
+        buffer_count += 1 + count;      // and an empty validity bitmap
+        for (uint32_t j = 0; j < count; j++) {
+            body_length += padded(sizes[j]);
+        }
+    }
+
+    uint32_t fields[3];
+    uint32_t header = arrow_message(&fb, ARROW_HEADER_BATCH, body_length);
+    fb_link(&fb, header, fb_table(&fb, 3, batch_sizes, fields));
+    int64_t length = out->rows;
+    fb_set(&fb, fields[0], &length, sizeof(length));
+
+    // FieldNode { length, null_count } and Buffer { offset, length }, both two int64s
+    uint32_t nodes = fb_vector(&fb, out->column_count, 16);
+    fb_link(&fb, fields[1], nodes);
+    uint32_t buffers = fb_vector(&fb, buffer_count, 16);
+    fb_link(&fb, fields[2], buffers);
+    int64_t offset = 0;
+    uint32_t buffer = 0;
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        fb_set(&fb, nodes + 4 + 16 * i, &length, sizeof(length));
+
+        uint64_t sizes[2];
+        uint32_t count = batch_buffers(out, i, sizes);
+        fb_set(&fb, buffers + 4 + 16 * buffer++, &offset, sizeof(offset));
+        for (uint32_t j = 0; j < count; j++) {
+            int64_t buffer_length = sizes[j];
+            fb_set(&fb, buffers + 4 + 16 * buffer, &offset, sizeof(offset));
+            fb_set(&fb, buffers + 4 + 16 * buffer + 8, &buffer_length, sizeof(buffer_length));
+            buffer++;
+            offset += padded(sizes[j]);
+        }
+    }
+    output_arrow_metadata(out, &fb);
+}
+
+/*
+    Column batches, of the binary and arrow modes.
+*/
+
+void output_column_header(output* out, tdb_stmt* stmt) {
+    uint32_t size = 4 + sizeof(uint32_t);
+    output_bytes(out, "TDBC", 4);
+    output_u32(out, out->column_count);
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        const char* name = tdb_column_name(stmt, i);
+        uint8_t prefix[2] = { out->types[i] == TDB_TYPE_INT ? 0 : 1, strlen(name) };
+        output_bytes(out, prefix, sizeof(prefix));
+        output_bytes(out, name, prefix[1]);
+        size += sizeof(prefix) + prefix[1];
+    }
+    output_pad(out, size);
+}
+
+/// @brief Write the rows batched so far and start the next batch
+/// @param out
+void output_batch(output* out) {
+    if (out->mode == OUTPUT_ARROW) {
+        output_arrow_batch(out);
+    } else {
+        output_u32(out, out->rows);
+        output_u32(out, 0);
+    }
+
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        uint64_t sizes[2];
+        uint32_t count = batch_buffers(out, i, sizes);
+        column_batch* c = &out->columns[i];
+        const void* data[2] = { c->ints, c->bytes };
+        if (out->types[i] == TDB_TYPE_TEXT) {
+            data[0] = c->offsets;
+        }
+        for (uint32_t j = 0; j < count; j++) {
+            output_bytes(out, data[j], sizes[j]);
+            output_pad(out, sizes[j]);
+        }
+    }
+    out->rows = 0;
+}
+
+void output_column_row(output* out, tdb_stmt* stmt) {
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        column_batch* c = &out->columns[i];
+        if (out->types[i] == TDB_TYPE_INT) {
+            c->ints[out->rows] = tdb_column_int(stmt, i);
+            continue;
+        }
+        const char* text = tdb_column_text(stmt, i);
+        uint32_t start = c->offsets[out->rows];
+        uint32_t length = strlen(text);
+        if (start + length > c->bytes_capacity) {
+            while (start + length > c->bytes_capacity) {
+                c->bytes_capacity *= 2;
+            }
+            c->bytes = realloc(c->bytes, c->bytes_capacity);
+        }
+        memcpy(c->bytes + start, text, length);
+        c->offsets[out->rows + 1] = start + length;
+    }
+
+    if (++out->rows == OUTPUT_BATCH_ROWS) {
+        output_batch(out);
+    }
+}
+
+void output_begin(output* out, tdb_stmt* stmt) {
+    out->column_count = tdb_column_count(stmt);
+    out->active = out->column_count > 0;
+    if (!out->active) {
+        return;
+    }
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        out->types[i] = tdb_column_type(stmt, i);
+    }
+    if (out->mode == OUTPUT_TEXT || out->mode == OUTPUT_CSV) {
+        return;
+    }
+
+    // The batches of the first select in a column mode are kept for the next ones
+    for (uint32_t i = 0; i < out->column_count; i++) {
+        column_batch* c = &out->columns[i];
+        if (c->ints == NULL) {
+            c->ints = malloc(OUTPUT_BATCH_ROWS * sizeof(int64_t));
+            c->offsets = malloc((OUTPUT_BATCH_ROWS + 1) * sizeof(uint32_t));
+            c->bytes_capacity = OUTPUT_TEXT_BYTES;
+            c->bytes = malloc(c->bytes_capacity);
+        }
+        c->offsets[0] = 0;
+    }
+    out->rows = 0;
+    if (out->mode == OUTPUT_ARROW) {
+        output_arrow_schema(out, stmt);
+    } else {
+        output_column_header(out, stmt);
+    }
+}
+
+void output_row(output* out, tdb_stmt* stmt) {
+    if (out->mode == OUTPUT_TEXT || out->mode == OUTPUT_CSV) {
+        output_text_row(out, stmt);
+    } else {
+        output_column_row(out, stmt);
+    }
+}
+
+void output_end(output* out) {
+    if (!out->active) {
+        return;
+    }
+    out->active = false;
+
+    if (out->mode == OUTPUT_BINARY || out->mode == OUTPUT_ARROW) {
+        if (out->rows > 0) {
+            output_batch(out);
+        }
+        // An empty batch ends a binary stream, a message of no size an arrow one
+        output_u32(out, out->mode == OUTPUT_ARROW ? UINT32_MAX : 0);
+        output_u32(out, 0);
+    }
+    fflush(out->file);
+}
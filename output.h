@@ -0,0 +1,76 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+
+#include "toydb.h"
+
+/*
+    How the REPL writes the rows of a select, chosen with ".mode":
+
+        text    (1, alice, a@b.c) a row per line, the default
+        csv     1,alice,a@b.c a row per line, as .import reads it. A text
+                holding a comma, a quote or a line break is quoted.
+        binary  column batches, laid out below
+        arrow   an Arrow IPC stream per select, a record batch per
+                OUTPUT_BATCH_ROWS rows. Ints are int64 and texts utf8,
+                no column is nullable.
+
+    Rows are put together in one large buffer, which goes out in a single
+    write when it fills up and when the select finishes, rather than being
+    printed a row at a time. ".output FILE" sends them to a file instead of
+    stdout, where the binary modes would mix with the prompts.
+
+    The binary mode writes, for every select, in the machine's byte order:
+
+        "TDBC" | column count (4 bytes) | per column: type (1 byte, 0 for
+        int, 1 for text), name length (1 byte), name | zeros up to 8 bytes
+
+    and then batches of up to OUTPUT_BATCH_ROWS rows, ending with a row
+    count of 0 and its 4 zero bytes:
+
+        row count (4 bytes) | 4 zero bytes | per column:
+            int:  row count int64s
+            text: row count + 1 uint32 offsets of the texts in the bytes
+                  that follow, the last one being where they end, then
+                  the bytes. Each part padded with zeros up to 8 bytes.
+
+    Every array starts 8 bytes aligned from the start of the stream, so a
+    reader can map the columns as they are without parsing them.
+*/
+
+#define OUTPUT_BATCH_ROWS 4096
+
+typedef struct output output;
+
+/// @brief Start writing rows to stdout in text mode
+/// @return
+output* output_open(void);
+
+/// @brief Switch to another mode for the selects from now on
+/// @param out
+/// @param name text, csv, binary or arrow
+/// @return false if there's no mode of that name
+bool output_set_mode(output* out, const char* name);
+
+/// @brief Write the rows of selects from now on to a file, which is truncated
+/// @param out
+/// @param file_name NULL for stdout
+/// @return false if the file can't be opened, the rows keep going where they did
+bool output_set_file(output* out, const char* file_name);
+
+/// @brief Get ready for the rows of a prepared statement, does nothing if it isn't a select
+/// @param out
+/// @param stmt
+void output_begin(output* out, tdb_stmt* stmt);
+
+/// @brief Add the row tdb_step just handed out
+/// @param out
+/// @param stmt
+void output_row(output* out, tdb_stmt* stmt);
+
+/// @brief Finish the statement's rows and write out whatever is buffered
+/// @param out
+void output_end(output* out);
+
+#endif
@@ -5,11 +5,12 @@ describe 'database' do
     #`rm -rf ./test.db`
     # in windows
     `del .\\test.db`
+    `del .\\test.db-wal`
   end
 
-  def run_script(commands)
+  def run_script(commands, options = "")
     raw_output = nil
-    IO.popen("./build/ToyDB test.db", "r+") do |pipe|
+    IO.popen("./build/ToyDB test.db #{options}", "r+") do |pipe|
       commands.each do |command|
         begin 
           pipe.puts command
@@ -26,6 +27,11 @@ describe 'database' do
     raw_output.split("\n")
   end
 
+  # Rows of the largest size, a leaf holds LEAF_NODE_MIN_CELLS of them
+  def full_size_insert(id)
+    "insert #{id} #{"u" * 32} #{"e" * 255}"
+  end
+
   it 'inserts and retrieves a row' do
     result = run_script([
       "insert 1 user1 person1@example.com",
@@ -40,18 +46,158 @@ describe 'database' do
     ])
   end
 
-  it 'prints error message when table is full' do
+  it 'keeps inserting past the old page limit with a small buffer pool' do
     script = (1..1401).map do |i|
       "insert #{i} user#{i} person#{i}@example.com"
     end
+    script << "select"
     script << ".exit"
-    result = run_script(script)
-    expect(result.last(2)).to match_array([
+    result = run_script(script, "--pool-frames 32")
+    expect(result.last(3)).to match_array([
+      "(1401, user1401, person1401@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'splits the root at its most children with a small buffer pool' do
+    # Past 340 leaves the full root splits, with far more children than frames
+    ids = (1..8000).to_a.shuffle(random: Random.new(7))
+    script = ids.each_slice(50).map do |slice|
+      "insert " + slice.map { |i| "(#{i}, user#{i}, #{"e" * 200})" }.join(", ")
+    end
+    script << "select where id between 7999 and 8000"
+    script << ".integrity_check"
+    script << ".exit"
+    result = run_script(script, "--pool-frames 32")
+    expect(result.last(6)).to match_array([
+      "tdb > (7999, user7999, #{"e" * 200})",
+      "(8000, user8000, #{"e" * 200})",
+      "Executed.",
+      "tdb > Integrity check:",
+      "ok",
+      "tdb > ",
+    ])
+  end
+
+  it 'updates and deletes every row with a small buffer pool' do
+    script = (1..2000).each_slice(50).map do |slice|
+      "insert " + slice.map { |i| "(#{i}, #{"u" * 32}, #{"e" * 255})" }.join(", ")
+    end
+    script << "update set email = short"
+    script << "select where id between 1999 and 2000"
+    script << "begin"
+    script << "delete"
+    script << "rollback"
+    script << "delete"
+    script << "select"
+    script << ".integrity_check"
+    script << ".exit"
+    result = run_script(script, "--pool-frames 32")
+    expect(result.last(12)).to match_array([
+      "tdb > Executed.",
+      "tdb > (1999, #{"u" * 32}, short)",
+      "(2000, #{"u" * 32}, short)",
+      "Executed.",
+      "tdb > Executed.",
+      "tdb > Error: Transaction is too large for the buffer pool.",
       "tdb > Executed.",
-      "tdb > Splitting internal node is not implemented yet.",
+      "tdb > Executed.",
+      "tdb > Executed.",
+      "tdb > Integrity check:",
+      "ok",
+      "tdb > ",
     ])
   end
 
+  it 'prints buffer pool counters' do
+    script = (1..400).map { |i| full_size_insert(i) }
+    script << ".pool"
+    script << ".exit"
+    result = run_script(script, "--pool-frames 32")
+    stats = result.drop_while { |line| line != "tdb > Buffer pool:" }
+
+    expect(stats[1..3]).to match_array([
+      "frames: 32",
+      "resident: 32",
+      "pinned: 0",
+    ])
+    evictions = stats.find { |line| line.start_with?("evictions: ") }
+    expect(evictions.split(": ").last.to_i > 0).to eq(true)
+  end
+
+  it 'reads leaves ahead of a scan' do
+    script = (1..400).map { |i| full_size_insert(i) }
+    script << ".exit"
+    run_script(script)
+
+    result = run_script(["select", ".pool", ".exit"], "--pool-frames 32")
+    expect(result.count { |line| line.include?("(") }).to eq(400)
+    stats = result.drop_while { |line| line != "tdb > Buffer pool:" }
+    read_aheads = stats.find { |line| line.start_with?("read-aheads: ") }
+    expect(read_aheads.split(": ").last.to_i > 0).to eq(true)
+  end
+
+  it 'writes committed pages back in the background' do
+    result = nil
+    IO.popen("./build/ToyDB test.db --checkpoint-ms 1 --checkpoint-pages 4", "r+") do |pipe|
+      (1..100).each { |i| pipe.puts full_size_insert(i) }
+      # Ask until the checkpointer has caught up, a slow fsync can hold it back a while
+      deadline = Time.now + 10
+      loop do
+        pipe.puts ".pool"
+        pipe.puts ".wal"
+        result = []
+        loop do
+          result << pipe.gets.chomp
+          break if result.last.start_with?("checkpoints: ")
+        end
+        break if (result.include?("dirty: 0") && result.include?("frames: 0")) || Time.now > deadline
+        sleep 0.05
+      end
+      pipe.puts ".exit"
+      pipe.close_write
+      pipe.gets(nil)
+    end
+
+    expect(result).to include("dirty: 0", "frames: 0")
+    background_writes = result.find { |line| line.start_with?("background writes: ") }
+    expect(background_writes.split(": ").last.to_i > 0).to eq(true)
+
+    result = run_script(["select where id between 100 and 200", ".exit"])
+    expect(result[0]).to eq("tdb > (100, #{"u" * 32}, #{"e" * 255})")
+  end
+
+  it 'counts and times the hot paths until reset' do
+    script = (1..30).map { |i| full_size_insert(i) }
+    script << "select"
+    script << ".stats"
+    script << ".stats reset"
+    script << ".stats"
+    script << ".exit"
+    result = run_script(script)
+    stats = result.drop_while { |line| line != "tdb > Statistics:" }
+    after_reset = stats.drop(1).drop_while { |line| line != "tdb > tdb > Statistics:" }
+
+    expect(stats).to include("cursor steps: 30")
+    leaf_splits = stats.find { |line| line.start_with?("leaf splits") }
+    expect(leaf_splits.split[2].to_i > 0).to eq(true)
+    expect(after_reset).to include("page gets: 0", "cursor steps: 0")
+  end
+
+  it 'keeps no old page versions once no select needs them' do
+    script = (1..40).map { |i| full_size_insert(i) }
+    script << "update set email = changed where id between 1 and 40"
+    script << "delete where id between 5 and 30"
+    script << "select where id = 3"
+    script << ".pool"
+    script << ".exit"
+    result = run_script(script)
+    stats = result.drop_while { |line| line != "tdb > Buffer pool:" }
+
+    expect(stats).to include("page versions: 0", "snapshots: 0")
+  end
+
 
   it 'allows inserting strings that are the maximum length' do
     long_username = "a"*32
@@ -120,6 +266,542 @@ describe 'database' do
     ])
   end
 
+  it 'recovers committed rows from the wal after a crash' do
+    IO.popen("./build/ToyDB test.db", "r+") do |pipe|
+      (1..20).each do |i|
+        pipe.puts "insert #{i} user#{i} person#{i}@example.com"
+        pipe.gets("Executed.")
+      end
+      Process.kill("KILL", pipe.pid)
+    end
+
+    result = run_script([
+      "select",
+      ".exit",
+    ])
+    expect(result.length).to eq(22)
+    expect(result.last(3)).to match_array([
+      "(20, user20, person20@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'undoes every statement of a rolled back transaction' do
+    result = run_script([
+      "insert 1 user1 person1@example.com",
+      "commit",
+      "begin",
+      "begin",
+      "insert 2 user2 person2@example.com",
+      "delete where id = 1",
+      "select",
+      "rollback",
+      "select",
+      ".exit",
+    ])
+    expect(result).to match_array([
+      "tdb > Executed.",
+      "tdb > Error: No transaction is open.",
+      "tdb > Executed.",
+      "tdb > Error: A transaction is already open.",
+      "tdb > Executed.",
+      "tdb > Executed.",
+      "tdb > (2, user2, person2@example.com)",
+      "Executed.",
+      "tdb > Executed.",
+      "tdb > (1, user1, person1@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'rolls back a transaction that split leaves' do
+    script = (1..5).map { |i| full_size_insert(i) }
+    script << "begin"
+    script += (6..40).map { |i| full_size_insert(i) }
+    script += ["rollback", full_size_insert(6), ".btree", ".exit"]
+    result = run_script(script)
+
+    expect(result.last(10)).to match_array([
+      "tdb > Executed.",
+      "tdb > Tree:",
+      "- leaf (size 6)",
+      "  - 1",
+      "  - 2",
+      "  - 3",
+      "  - 4",
+      "  - 5",
+      "  - 6",
+      "tdb > ",
+    ])
+  end
+
+  it 'keeps a committed transaction and drops an open one after a crash' do
+    IO.popen("./build/ToyDB test.db", "r+") do |pipe|
+      commands = ["begin"]
+      commands += (1..20).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+      commands += ["commit", "begin", "insert 21 user21 person21@example.com"]
+      commands.each do |command|
+        pipe.puts command
+        pipe.gets("Executed.")
+      end
+      Process.kill("KILL", pipe.pid)
+    end
+
+    result = run_script([
+      "select",
+      ".exit",
+    ])
+    expect(result.length).to eq(22)
+    expect(result.last(3)).to match_array([
+      "(20, user20, person20@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'finds nothing wrong with a tree after splits and merges' do
+    script = (1..60).map { |i| full_size_insert(i) }
+    script += (10..40).map { |i| "delete where id = #{i}" }
+    script += [".integrity_check", ".exit"]
+    result = run_script(script)
+
+    expect(result.last(3)).to match_array([
+      "tdb > Integrity check:",
+      "ok",
+      "tdb > ",
+    ])
+  end
+
+  it 'detects a page changed behind its back by its checksum' do
+    script = (1..30).map { |i| full_size_insert(i) }
+    script << ".exit"
+    run_script(script)
+
+    # A byte inside the records of the leaf on page 2
+    File.open("test.db", "r+b") do |file|
+      file.seek(2 * 4096 + 4000)
+      byte = file.read(1).ord
+      file.seek(2 * 4096 + 4000)
+      file.write((byte ^ 0xFF).chr)
+    end
+
+    result = run_script([
+      ".integrity_check",
+      "select",
+    ])
+    expect(result.first(3)).to match_array([
+      "tdb > Integrity check:",
+      "page 2: checksum mismatch",
+      "1 problem found.",
+    ])
+    expect(result.last).to eq("Page 2 failed its checksum. Corrupt file, or written by an older version.")
+  end
+
+  it 'reads back rows written through the mmap pager' do
+    script = (1..30).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    run_script(script, "--mmap")
+
+    result = run_script(["select", ".exit"])
+    expect(result.length).to eq(32)
+    expect(result.last(3)).to match_array([
+      "(30, user30, person30@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'bulk loads rows from a csv file in key order' do
+    rows = (1..30).to_a.reverse.map { |i| "#{i},user#{i},person#{i}@example.com" }
+    File.write("test.csv", (rows + ["7,again,again@example.com", "not a row"]).join("\n"))
+
+    result = run_script([
+      ".import test.csv",
+      "select",
+      ".exit",
+    ])
+    File.delete("test.csv")
+
+    expect(result[0..3]).to match_array([
+      "tdb > Line 32: expected id,user_name,email.",
+      "Imported 30 rows.",
+      "Skipped 1 rows with duplicate ids.",
+      "Skipped 1 malformed lines.",
+    ])
+    expect(result[4]).to eq("tdb > (1, user1, person1@example.com)")
+    expect(result.last(3)).to match_array([
+      "(30, user30, person30@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'selects rows by id, by id range and with a limit' do
+    script = (1..50).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select where id = 17"
+    script << "select where id between 30 and 32"
+    script << "select where id between 45 and 100 limit 2"
+    script << "select where id = 99"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.last(11)).to match_array([
+      "tdb > (17, user17, person17@example.com)",
+      "Executed.",
+      "tdb > (30, user30, person30@example.com)",
+      "(31, user31, person31@example.com)",
+      "(32, user32, person32@example.com)",
+      "Executed.",
+      "tdb > (45, user45, person45@example.com)",
+      "(46, user46, person46@example.com)",
+      "Executed.",
+      "tdb > Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'selects rows by user_name or email with and without an index' do
+    script = (1..50).map do |i|
+      "insert #{i} user#{i % 5} person#{i}@example.com"
+    end
+    script << "select where email = person17@example.com"
+    script << "create index on user_name"
+    script << "create index on user_name"
+    script << "select where user_name = 'user3'"
+    script << "select where email = nobody"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.last(17)).to match_array([
+      "tdb > (17, user2, person17@example.com)",
+      "Executed.",
+      "tdb > Executed.",
+      "tdb > Error: Index already exists.",
+      "tdb > (3, user3, person3@example.com)",
+      "(8, user3, person8@example.com)",
+      "(13, user3, person13@example.com)",
+      "(18, user3, person18@example.com)",
+      "(23, user3, person23@example.com)",
+      "(28, user3, person28@example.com)",
+      "(33, user3, person33@example.com)",
+      "(38, user3, person38@example.com)",
+      "(43, user3, person43@example.com)",
+      "(48, user3, person48@example.com)",
+      "Executed.",
+      "tdb > Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'keeps an index in step with updates, deletes, rollback and vacuum' do
+    script = (1..200).map { |i| full_size_insert(i) }
+    script << "create index on email"
+    script << "update set email = moved where id between 10 and 12"
+    script << "delete where id = 11"
+    script << "begin"
+    script << "update set email = gone where id = 12"
+    script << "rollback"
+    script << ".exit"
+    run_script(script)
+
+    result = run_script([
+      ".vacuum",
+      "select where email = moved",
+      ".integrity_check",
+      ".exit",
+    ])
+    expect(result).to match_array([
+      "tdb > tdb > (10, #{"u" * 32}, moved)",
+      "(12, #{"u" * 32}, moved)",
+      "Executed.",
+      "tdb > Integrity check:",
+      "ok",
+      "tdb > ",
+    ])
+  end
+
+  it 'indexes any number of rows that share a value' do
+    script = ["create index on email", "create index on user_name"]
+    script += (1..70000).each_slice(500).map do |slice|
+      "insert " + slice.map { |i| "(#{i}, user#{i}, same)" }.join(", ")
+    end
+    script << "delete where id between 3 and 69998"
+    script << "select where email = same"
+    script << ".integrity_check"
+    script << ".exit"
+    result = run_script(script, "--pool-frames 32")
+
+    expect(result.last(8)).to match_array([
+      "tdb > (1, user1, same)",
+      "(2, user2, same)",
+      "(69999, user69999, same)",
+      "(70000, user70000, same)",
+      "Executed.",
+      "tdb > Integrity check:",
+      "ok",
+      "tdb > ",
+    ])
+  end
+
+  it 'creates tables and keeps their rows apart from users' do
+    script = [
+      "create table items (id int, name text(10), price int)",
+      "create table items (id int)",
+      "insert into items 2, pear, -7",
+      "insert into items (3, fig, 2), (1, apple, 3)",
+      "update items set price = 10 where id = 3",
+      "delete from items where id = 1",
+      "insert 1 user1 person1@example.com",
+      ".exit",
+    ]
+    run_script(script)
+
+    result = run_script([
+      ".vacuum",
+      "select from items",
+      "select from users",
+      "select from nothing",
+      ".integrity_check",
+      ".exit",
+    ])
+    expect(result).to match_array([
+      "tdb > tdb > (2, pear, -7)",
+      "(3, fig, 10)",
+      "Executed.",
+      "tdb > (1, user1, person1@example.com)",
+      "Executed.",
+      "tdb > No such table.",
+      "tdb > Integrity check:",
+      "ok",
+      "tdb > ",
+    ])
+  end
+
+  it 'checks the columns of create table and of rows put in' do
+    result = run_script([
+      "create table t (name text, id int)",
+      "create table t (id int, a text, b text)",
+      "create table t (id int, a text(300))",
+      "create table t (id int, a text(4))",
+      "insert into t 1 abcde",
+      "insert into t 1 abcd extra",
+      ".exit",
+    ])
+    expect(result).to match_array([
+      "tdb > Syntax error. Failed to parse statement.",
+      "tdb > Row is too large.",
+      "tdb > Syntax error. Failed to parse statement.",
+      "tdb > Executed.",
+      "tdb > String is too long.",
+      "tdb > Syntax error. Failed to parse statement.",
+      "tdb > ",
+    ])
+  end
+
+  it 'writes rows as csv and as column batches' do
+    result = run_script([
+      "create table items (id int, name text(10), price int)",
+      "insert into items (1, apple, 3), (2, pear, -7)",
+      ".mode csv",
+      "select from items",
+      ".mode binary",
+      ".output test.bin",
+      "select from items",
+      ".output",
+      ".mode text",
+      "select from items where id = 2",
+      ".mode json",
+      ".exit",
+    ])
+    expect(result).to match_array([
+      "tdb > Executed.",
+      "tdb > Executed.",
+      "tdb > tdb > 1,apple,3",
+      "2,pear,-7",
+      "Executed.",
+      "tdb > tdb > tdb > Executed.",
+      "tdb > tdb > tdb > (2, pear, -7)",
+      "Executed.",
+      "tdb > Usage: .mode text|csv|binary|arrow",
+      "tdb > ",
+    ])
+
+    data = File.binread("test.bin")
+    File.delete("test.bin")
+    expect(data[0, 4]).to eq("TDBC")
+    header = 8 + 3 * 2 + "id".size + "name".size + "price".size
+    batch = (header + 7) / 8 * 8
+    expect(data[batch, 4].unpack1("L")).to eq(2)
+    expect(data[batch + 8, 16].unpack("q2")).to eq([1, 2])
+    expect(data[batch + 24, 12].unpack("L3")).to eq([0, 5, 9])
+    expect(data[batch + 40, 9]).to eq("applepear")
+    expect(data[batch + 56, 16].unpack("q2")).to eq([3, -7])
+    expect(data[batch + 72, 8].unpack("L2")).to eq([0, 0])
+    expect(data.size).to eq(batch + 80)
+  end
+
+  it 'deletes rows and reuses the pages they leave empty' do
+    script = (1..100).map { |i| full_size_insert(i) }
+    script << ".exit"
+    run_script(script)
+    size = File.size("test.db")
+
+    script = ["delete where id between 1 and 100"]
+    script += (101..200).map { |i| full_size_insert(i) }
+    script << "delete where id = 150"
+    script << "select where id between 149 and 151"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(File.size("test.db")).to eq(size)
+    expect(result.last(4)).to match_array([
+      "tdb > (149, #{"u" * 32}, #{"e" * 255})",
+      "(151, #{"u" * 32}, #{"e" * 255})",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'accepts commas in insert and refuses to run unbound parameters' do
+    result = run_script([
+      "insert 1, user1, person1@example.com",
+      "insert ?, ?, ?",
+      "select where id = ?",
+      "select",
+      ".exit",
+    ])
+    expect(result).to match_array([
+      "tdb > Executed.",
+      "tdb > Error: Statement has unbound parameters.",
+      "tdb > Error: Statement has unbound parameters.",
+      "tdb > (1, user1, person1@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'inserts several rows in one statement and skips ids already taken' do
+    result = run_script([
+      "insert (3, user3, person3@example.com), (1, user1, person1@example.com),(2,user2,person2@example.com)",
+      "insert (4, user4, person4@example.com), (2, again, again@example.com)",
+      "insert (5, user5, person5@example.com), (6, user6",
+      "select",
+      ".exit",
+    ])
+    expect(result).to match_array([
+      "tdb > Executed.",
+      "tdb > Error: Duplicate key.",
+      "tdb > Syntax error. Failed to parse statement.",
+      "tdb > (1, user1, person1@example.com)",
+      "(2, user2, person2@example.com)",
+      "(3, user3, person3@example.com)",
+      "(4, user4, person4@example.com)",
+      "Executed.",
+      "tdb > ",
+    ])
+  end
+
+  it 'spreads a batch over as many leaves as it needs' do
+    rows = (1..39).map { |i| "(#{i}, #{"u" * 32}, #{"e" * 255})" }
+    result = run_script([
+      "insert #{rows.join(", ")}",
+      ".btree",
+      ".exit",
+    ])
+
+    expect(result[0..2]).to match_array([
+      "tdb > Executed.",
+      "tdb > Tree:",
+      "- internal (size 2)",
+    ])
+    expect(result.count { |line| line == "  - leaf (size 13)" }).to eq(3)
+  end
+
+  it 'merges a sparse leaf into its sibling after deletes' do
+    script = (1..14).map { |i| full_size_insert(i) }
+    script << "delete where id between 8 and 11"
+    script << ".btree"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result[15..]).to match_array([
+      "tdb > Tree:",
+      "- leaf (size 10)",
+      "  - 1",
+      "  - 2",
+      "  - 3",
+      "  - 4",
+      "  - 5",
+      "  - 6",
+      "  - 7",
+      "  - 12",
+      "  - 13",
+      "  - 14",
+      "tdb > ",
+    ])
+  end
+
+  it 'updates rows in place and splits leaves they outgrow' do
+    script = (1..20).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+    script << "update set user_name = #{"u" * 32}, email = #{"e" * 255}"
+    script << "update set email = short where id = 20"
+    script << "select where id between 19 and 20"
+    script << ".btree"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result[22..24]).to match_array([
+      "tdb > (19, #{"u" * 32}, #{"e" * 255})",
+      "(20, #{"u" * 32}, short)",
+      "Executed.",
+    ])
+    expect(result.count { |line| line.start_with?("  - leaf") }).to eq(2)
+  end
+
+  it 'stores pages compressed in a file created with --compress' do
+    script = (1..200).map { |i| full_size_insert(i) }
+    script << ".exit"
+    run_script(script)
+    plain_size = File.size("test.db")
+    `del .\\test.db`
+    `del .\\test.db-wal`
+
+    run_script(script, "--compress")
+    expect(File.size("test.db") < plain_size / 4).to eq(true)
+
+    # Later opens find the format in the file, the mmap pager can't map it
+    result = run_script(["select where id between 199 and 300", ".integrity_check", ".exit"], "--mmap")
+    expect(result).to match_array([
+      "Compressed db files can't be mapped, using the buffer pool.",
+      "tdb > (199, #{"u" * 32}, #{"e" * 255})",
+      "(200, #{"u" * 32}, #{"e" * 255})",
+      "Executed.",
+      "tdb > Integrity check:",
+      "ok",
+      "tdb > ",
+    ])
+  end
+
+  it 'shrinks the file on vacuum and keeps the remaining rows' do
+    script = (1..100).map { |i| full_size_insert(i) }
+    script << "delete where id between 1 and 90"
+    script << ".exit"
+    run_script(script)
+    size = File.size("test.db")
+
+    result = run_script([".vacuum", "select", ".exit"])
+
+    expect(File.size("test.db") < size).to eq(true)
+    expect(result.length).to eq(12)
+    expect(result[0]).to eq("tdb > tdb > (91, #{"u" * 32}, #{"e" * 255})")
+  end
+
   it 'prints constants' do
     script = [
       ".constants",
@@ -130,11 +812,11 @@ describe 'database' do
     expect(result).to match_array([
       "tdb > Constants:",
       "ROW_SIZE: 293",
-      "COMMON_NODE_HEADER_SIZE: 6",
+      "COMMON_NODE_HEADER_SIZE: 2",
       "LEAF_NODE_HEADER_SIZE: 14",
-      "LEAF_NODE_CELL_SIZE: 297",
-      "LEAF_NODE_SPACE_FOR_CELLS: 4082",
-      "LEAF_NODE_MAX_CELLS: 13",
+      "LEAF_NODE_SLOT_SIZE: 12",
+      "LEAF_NODE_SPACE_FOR_CELLS: 4078",
+      "LEAF_NODE_MIN_CELLS: 13",
       "tdb > ",
     ])
   end
@@ -177,12 +859,24 @@ describe 'database' do
     ])
   end
 
-  it 'allows printing out the structure of a 3-leaf-node btree' do
-    script = (1..14).map do |i|
+  it 'fits more short rows into a leaf than full size ones' do
+    script = (1..80).map do |i|
       "insert #{i} user#{i} person#{i}@example.com"
     end
     script << ".btree"
-    script << "insert 15 user15 person15@example.com"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result[80..81]).to match_array([
+      "tdb > Tree:",
+      "- leaf (size 80)",
+    ])
+  end
+
+  it 'allows printing out the structure of a 3-leaf-node btree' do
+    script = (1..14).map { |i| full_size_insert(i) }
+    script << ".btree"
+    script << full_size_insert(15)
     script << ".exit"
     result = run_script(script)
 
@@ -242,36 +936,36 @@ describe 'database' do
 
   it 'allows printing out the structure of a 4-leaf-node btree' do
     script = [
-      "insert 18 user18 person18@example.com",
-      "insert 7 user7 person7@example.com",
-      "insert 10 user10 person10@example.com",
-      "insert 29 user29 person29@example.com",
-      "insert 23 user23 person23@example.com",
-      "insert 4 user4 person4@example.com",
-      "insert 14 user14 person14@example.com",
-      "insert 30 user30 person30@example.com",
-      "insert 15 user15 person15@example.com",
-      "insert 26 user26 person26@example.com",
-      "insert 22 user22 person22@example.com",
-      "insert 19 user19 person19@example.com",
-      "insert 2 user2 person2@example.com",
-      "insert 1 user1 person1@example.com",
-      "insert 21 user21 person21@example.com",
-      "insert 11 user11 person11@example.com",
-      "insert 6 user6 person6@example.com",
-      "insert 20 user20 person20@example.com",
-      "insert 5 user5 person5@example.com",
-      "insert 8 user8 person8@example.com",
-      "insert 9 user9 person9@example.com",
-      "insert 3 user3 person3@example.com",
-      "insert 12 user12 person12@example.com",
-      "insert 27 user27 person27@example.com",
-      "insert 17 user17 person17@example.com",
-      "insert 16 user16 person16@example.com",
-      "insert 13 user13 person13@example.com",
-      "insert 24 user24 person24@example.com",
-      "insert 25 user25 person25@example.com",
-      "insert 28 user28 person28@example.com",
+      full_size_insert(18),
+      full_size_insert(7),
+      full_size_insert(10),
+      full_size_insert(29),
+      full_size_insert(23),
+      full_size_insert(4),
+      full_size_insert(14),
+      full_size_insert(30),
+      full_size_insert(15),
+      full_size_insert(26),
+      full_size_insert(22),
+      full_size_insert(19),
+      full_size_insert(2),
+      full_size_insert(1),
+      full_size_insert(21),
+      full_size_insert(11),
+      full_size_insert(6),
+      full_size_insert(20),
+      full_size_insert(5),
+      full_size_insert(8),
+      full_size_insert(9),
+      full_size_insert(3),
+      full_size_insert(12),
+      full_size_insert(27),
+      full_size_insert(17),
+      full_size_insert(16),
+      full_size_insert(13),
+      full_size_insert(24),
+      full_size_insert(25),
+      full_size_insert(28),
       ".btree",
       ".exit",
     ]
@@ -322,70 +1016,70 @@ describe 'database' do
 
   it 'allows printing out the structure of a 7-leaf-node btree' do
     script = [
-      "insert 58 user58 person58@example.com",
-      "insert 56 user56 person56@example.com",
-      "insert 8 user8 person8@example.com",
-      "insert 54 user54 person54@example.com",
-      "insert 77 user77 person77@example.com",
-      "insert 7 user7 person7@example.com",
-      "insert 25 user25 person25@example.com",
-      "insert 71 user71 person71@example.com",
-      "insert 13 user13 person13@example.com",
-      "insert 22 user22 person22@example.com",
-      "insert 53 user53 person53@example.com",
-      "insert 51 user51 person51@example.com",
-      "insert 59 user59 person59@example.com",
-      "insert 32 user32 person32@example.com",
-      "insert 36 user36 person36@example.com",
-      "insert 79 user79 person79@example.com",
-      "insert 10 user10 person10@example.com",
-      "insert 33 user33 person33@example.com",
-      "insert 20 user20 person20@example.com",
-      "insert 4 user4 person4@example.com",
-      "insert 35 user35 person35@example.com",
-      "insert 76 user76 person76@example.com",
-      "insert 49 user49 person49@example.com",
-      "insert 24 user24 person24@example.com",
-      "insert 70 user70 person70@example.com",
-      "insert 48 user48 person48@example.com",
-      "insert 39 user39 person39@example.com",
-      "insert 15 user15 person15@example.com",
-      "insert 47 user47 person47@example.com",
-      "insert 30 user30 person30@example.com",
-      "insert 86 user86 person86@example.com",
-      "insert 31 user31 person31@example.com",
-      "insert 68 user68 person68@example.com",
-      "insert 37 user37 person37@example.com",
-      "insert 66 user66 person66@example.com",
-      "insert 63 user63 person63@example.com",
-      "insert 40 user40 person40@example.com",
-      "insert 78 user78 person78@example.com",
-      "insert 19 user19 person19@example.com",
-      "insert 46 user46 person46@example.com",
-      "insert 14 user14 person14@example.com",
-      "insert 81 user81 person81@example.com",
-      "insert 72 user72 person72@example.com",
-      "insert 6 user6 person6@example.com",
-      "insert 50 user50 person50@example.com",
-      "insert 85 user85 person85@example.com",
-      "insert 67 user67 person67@example.com",
-      "insert 2 user2 person2@example.com",
-      "insert 55 user55 person55@example.com",
-      "insert 69 user69 person69@example.com",
-      "insert 5 user5 person5@example.com",
-      "insert 65 user65 person65@example.com",
-      "insert 52 user52 person52@example.com",
-      "insert 1 user1 person1@example.com",
-      "insert 29 user29 person29@example.com",
-      "insert 9 user9 person9@example.com",
-      "insert 43 user43 person43@example.com",
-      "insert 75 user75 person75@example.com",
-      "insert 21 user21 person21@example.com",
-      "insert 82 user82 person82@example.com",
-      "insert 12 user12 person12@example.com",
-      "insert 18 user18 person18@example.com",
-      "insert 60 user60 person60@example.com",
-      "insert 44 user44 person44@example.com",
+      full_size_insert(58),
+      full_size_insert(56),
+      full_size_insert(8),
+      full_size_insert(54),
+      full_size_insert(77),
+      full_size_insert(7),
+      full_size_insert(25),
+      full_size_insert(71),
+      full_size_insert(13),
+      full_size_insert(22),
+      full_size_insert(53),
+      full_size_insert(51),
+      full_size_insert(59),
+      full_size_insert(32),
+      full_size_insert(36),
+      full_size_insert(79),
+      full_size_insert(10),
+      full_size_insert(33),
+      full_size_insert(20),
+      full_size_insert(4),
+      full_size_insert(35),
+      full_size_insert(76),
+      full_size_insert(49),
+      full_size_insert(24),
+      full_size_insert(70),
+      full_size_insert(48),
+      full_size_insert(39),
+      full_size_insert(15),
+      full_size_insert(47),
+      full_size_insert(30),
+      full_size_insert(86),
+      full_size_insert(31),
+      full_size_insert(68),
+      full_size_insert(37),
+      full_size_insert(66),
+      full_size_insert(63),
+      full_size_insert(40),
+      full_size_insert(78),
+      full_size_insert(19),
+      full_size_insert(46),
+      full_size_insert(14),
+      full_size_insert(81),
+      full_size_insert(72),
+      full_size_insert(6),
+      full_size_insert(50),
+      full_size_insert(85),
+      full_size_insert(67),
+      full_size_insert(2),
+      full_size_insert(55),
+      full_size_insert(69),
+      full_size_insert(5),
+      full_size_insert(65),
+      full_size_insert(52),
+      full_size_insert(1),
+      full_size_insert(29),
+      full_size_insert(9),
+      full_size_insert(43),
+      full_size_insert(75),
+      full_size_insert(21),
+      full_size_insert(82),
+      full_size_insert(12),
+      full_size_insert(18),
+      full_size_insert(60),
+      full_size_insert(44),
       ".btree",
       ".exit",
     ]
@@ -393,86 +1087,84 @@ describe 'database' do
 
     expect(result[64...(result.length)]).to match_array([
       "tdb > Tree:",
-      "- internal (size 1)",
-      "  - internal (size 2)",
-      "    - leaf (size 7)",
-      "      - 1",
-      "      - 2",
-      "      - 4",
-      "      - 5",
-      "      - 6",
-      "      - 7",
-      "      - 8",
-      "    - key 8",
-      "    - leaf (size 11)",
-      "      - 9",
-      "      - 10",
-      "      - 12",
-      "      - 13",
-      "      - 14",
-      "      - 15",
-      "      - 18",
-      "      - 19",
-      "      - 20",
-      "      - 21",
-      "      - 22",
-      "    - key 22",
-      "    - leaf (size 8)",
-      "      - 24",
-      "      - 25",
-      "      - 29",
-      "      - 30",
-      "      - 31",
-      "      - 32",
-      "      - 33",
-      "      - 35",
+      "- internal (size 6)",
+      "  - leaf (size 7)",
+      "    - 1",
+      "    - 2",
+      "    - 4",
+      "    - 5",
+      "    - 6",
+      "    - 7",
+      "    - 8",
+      "  - key 8",
+      "  - leaf (size 11)",
+      "    - 9",
+      "    - 10",
+      "    - 12",
+      "    - 13",
+      "    - 14",
+      "    - 15",
+      "    - 18",
+      "    - 19",
+      "    - 20",
+      "    - 21",
+      "    - 22",
+      "  - key 22",
+      "  - leaf (size 8)",
+      "    - 24",
+      "    - 25",
+      "    - 29",
+      "    - 30",
+      "    - 31",
+      "    - 32",
+      "    - 33",
+      "    - 35",
       "  - key 35",
-      "  - internal (size 3)",
-      "    - leaf (size 12)",
-      "      - 36",
-      "      - 37",
-      "      - 39",
-      "      - 40",
-      "      - 43",
-      "      - 44",
-      "      - 46",
-      "      - 47",
-      "      - 48",
-      "      - 49",
-      "      - 50",
-      "      - 51",
-      "    - key 51",
-      "    - leaf (size 11)",
-      "      - 52",
-      "      - 53",
-      "      - 54",
-      "      - 55",
-      "      - 56",
-      "      - 58",
-      "      - 59",
-      "      - 60",
-      "      - 63",
-      "      - 65",
-      "      - 66",
-      "    - key 66",
-      "    - leaf (size 7)",
-      "      - 67",
-      "      - 68",
-      "      - 69",
-      "      - 70",
-      "      - 71",
-      "      - 72",
-      "      - 75",
-      "    - key 75",
-      "    - leaf (size 8)",
-      "      - 76",
-      "      - 77",
-      "      - 78",
-      "      - 79",
-      "      - 81",
-      "      - 82",
-      "      - 85",
-      "      - 86",
+      "  - leaf (size 12)",
+      "    - 36",
+      "    - 37",
+      "    - 39",
+      "    - 40",
+      "    - 43",
+      "    - 44",
+      "    - 46",
+      "    - 47",
+      "    - 48",
+      "    - 49",
+      "    - 50",
+      "    - 51",
+      "  - key 51",
+      "  - leaf (size 11)",
+      "    - 52",
+      "    - 53",
+      "    - 54",
+      "    - 55",
+      "    - 56",
+      "    - 58",
+      "    - 59",
+      "    - 60",
+      "    - 63",
+      "    - 65",
+      "    - 66",
+      "  - key 66",
+      "  - leaf (size 7)",
+      "    - 67",
+      "    - 68",
+      "    - 69",
+      "    - 70",
+      "    - 71",
+      "    - 72",
+      "    - 75",
+      "  - key 75",
+      "  - leaf (size 8)",
+      "    - 76",
+      "    - 77",
+      "    - 78",
+      "    - 79",
+      "    - 81",
+      "    - 82",
+      "    - 85",
+      "    - 86",
       "tdb > ",
     ])
   end
@@ -0,0 +1,7619 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/uio.h>
+#else
+#include <io.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_X86
+#endif
+
+#include "toydb.h"
+
+#define COLUMN_USERNAME_SIZE TDB_COLUMN_USERNAME_SIZE
+#define COLUMN_EMAIL_SIZE TDB_COLUMN_EMAIL_SIZE
+#define INVALID_PAGE_NUM UINT32_MAX
+
+typedef tdb_row row;
+
+#define SIZE_OF_ATTRIBUTE(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
+const uint32_t ID_SIZE          = SIZE_OF_ATTRIBUTE(row, id);
+const uint32_t USERNAME_SIZE    = SIZE_OF_ATTRIBUTE(row, user_name);
+const uint32_t EMAIL_SIZE       = SIZE_OF_ATTRIBUTE(row, email);
+#define ROW_SIZE         (uint32_t)(ID_SIZE + USERNAME_SIZE + EMAIL_SIZE)   // largest serialized row
+
+// 4kb, same size as a page used in the virtual memory systems of most computer architectures
+#define PAGE_SIZE 4096
+
+// The last word of every page holds its checksum, nodes use the bytes before it
+#define PAGE_CHECKSUM_SIZE      (uint32_t)(sizeof(uint32_t))
+#define PAGE_CHECKSUM_OFFSET    (uint32_t)(PAGE_SIZE - PAGE_CHECKSUM_SIZE)
+#define PAGE_USABLE_SIZE        PAGE_CHECKSUM_OFFSET
+
+/*
+    Common node header layout
+    Nodes keep no parent pointer. A split finds the parent on the path it
+    came down by, so moving children between nodes never has to touch the
+    children.
+*/
+#define NODE_TYPE_SIZE              (uint32_t)(sizeof(uint8_t))
+#define NODE_TYPE_OFFSET            (uint32_t)0
+#define IS_ROOT_SIZE                (uint32_t)(sizeof(uint8_t))
+#define IS_ROOT_OFFSET              NODE_TYPE_SIZE
+#define COMMON_NODE_HEADER_SIZE     (uint8_t)(NODE_TYPE_SIZE + IS_ROOT_SIZE)
+
+/*
+    Leaf node header layout
+*/
+#define LEAF_NODE_NUM_CELLS_SIZE    (uint32_t)(sizeof(uint32_t))
+#define LEAF_NODE_NUM_CELLS_OFFSET  COMMON_NODE_HEADER_SIZE
+
+#define LEAF_NODE_NEXT_LEAF_SIZE    (uint32_t)(sizeof(uint32_t))
+#define LEAF_NODE_NEXT_LEAF_OFFSET  (uint32_t)(LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE)
+#define LEAF_NODE_CONTENT_START_SIZE    (uint32_t)(sizeof(uint16_t))
+#define LEAF_NODE_CONTENT_START_OFFSET  (uint32_t)(LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE)
+#define LEAF_NODE_FRAGMENTED_SIZE       (uint32_t)(sizeof(uint16_t))
+#define LEAF_NODE_FRAGMENTED_OFFSET     (uint32_t)(LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE)
+#define LEAF_NODE_HEADER_SIZE           (uint32_t)(LEAF_NODE_FRAGMENTED_OFFSET + LEAF_NODE_FRAGMENTED_SIZE)
+
+/*
+    Leaf node body layout (slotted page)
+    | header | slot 0 | slot 1 | ... -> free space <- ... | record 1 | record 0 | checksum |
+    Slots stay sorted by key and hold the key, so searching never touches records.
+    Records are variable length and packed from the checksum towards the
+    slots. Space given up inside the record area is counted as fragmented and
+    reclaimed by compacting the page when an insert needs it.
+*/
+#define LEAF_NODE_KEY_SIZE          (uint32_t)(sizeof(uint64_t))
+#define LEAF_NODE_KEY_OFFSET        (uint32_t)0
+#define LEAF_NODE_RECORD_OFFSET_SIZE    (uint32_t)(sizeof(uint16_t))
+#define LEAF_NODE_RECORD_OFFSET_OFFSET  (uint32_t)(LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE)
+#define LEAF_NODE_RECORD_LENGTH_SIZE    (uint32_t)(sizeof(uint16_t))
+#define LEAF_NODE_RECORD_LENGTH_OFFSET  (uint32_t)(LEAF_NODE_RECORD_OFFSET_OFFSET + LEAF_NODE_RECORD_OFFSET_SIZE)
+#define LEAF_NODE_SLOT_SIZE         (uint32_t)(LEAF_NODE_RECORD_LENGTH_OFFSET + LEAF_NODE_RECORD_LENGTH_SIZE)
+#define LEAF_NODE_SPACE_FOR_CELLS   (uint32_t)(PAGE_USABLE_SIZE - LEAF_NODE_HEADER_SIZE)
+#define LEAF_NODE_MIN_CELLS         (uint32_t)(LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_SLOT_SIZE + ROW_SIZE))
+#define LEAF_NODE_MIN_USED          (uint32_t)(LEAF_NODE_SPACE_FOR_CELLS / 3)   // below this a leaf is rebalanced
+
+/*
+    Internal node header layout
+*/
+#define INTERNAL_NODE_NUM_KEYS_SIZE         (uint32_t)(sizeof(uint32_t))
+#define INTERNAL_NODE_NUM_KEYS_OFFSET       COMMON_NODE_HEADER_SIZE
+#define INTERNAL_NODE_RIGHT_CHILD_SIZE      (uint32_t)(sizeof(uint32_t))
+#define INTERNAL_NODE_RIGHT_CHILD_OFFSET    (uint32_t)(INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_NUM_KEYS_OFFSET)
+#define INTERNAL_NODE_HEADER_SIZE           (uint32_t)(COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE)
+
+/*
+    Internal node body layout
+    | header | key 0 | key 1 | ... | child 0 | child 1 | ... | checksum |
+    A cell is a key and the child left of it, holding the keys up to it.
+    Keys are kept side by side, apart from the children, so a search reads
+    nothing but keys and a few cache lines of them.
+*/
+#define INTERNAL_NODE_KEY_SIZE      (uint32_t)(sizeof(uint64_t))
+#define INTERNAL_NODE_CHILD_SIZE    (uint32_t)(sizeof(uint32_t))
+#define INTERNAL_NODE_CELL_SIZE     (uint32_t)(INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE)
+#define INTERNAL_NODE_SPACE_FOR_CELLS   (uint32_t)(PAGE_USABLE_SIZE - INTERNAL_NODE_HEADER_SIZE)
+#define INTERNAL_NODE_CELL_MAX_SIZE (uint32_t)(INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE)
+#define INTERNAL_NODE_MIN_KEYS      (uint32_t)(INTERNAL_NODE_CELL_MAX_SIZE / 3)
+#define INTERNAL_NODE_KEYS_OFFSET       INTERNAL_NODE_HEADER_SIZE
+#define INTERNAL_NODE_CHILDREN_OFFSET   (uint32_t)(INTERNAL_NODE_KEYS_OFFSET + INTERNAL_NODE_CELL_MAX_SIZE * INTERNAL_NODE_KEY_SIZE)
+
+#define BTREE_MAX_DEPTH             32
+
+/*
+    Database header, kept in page 0. The table's root lives on its own page.
+    Free pages form a linked list through their first word, the header holds
+    the head of it. Each secondary index has a root slot of its own, 0 while
+    the index doesn't exist, and so do the catalog and each table made with
+    create table, table n in slot n - 1.
+*/
+#define DB_HEADER_PAGE_NUM              (uint32_t)0
+#define DB_HEADER_MAGIC                 0x34424454  // "TDB4", 64-bit keys and no parent pointers
+#define DB_HEADER_MAGIC_SIZE            (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_MAGIC_OFFSET          (uint32_t)0
+#define DB_HEADER_PAGE_SIZE_SIZE        (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_PAGE_SIZE_OFFSET      (uint32_t)(DB_HEADER_MAGIC_OFFSET + DB_HEADER_MAGIC_SIZE)
+#define DB_HEADER_ROOT_PAGE_SIZE        (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_ROOT_PAGE_OFFSET      (uint32_t)(DB_HEADER_PAGE_SIZE_OFFSET + DB_HEADER_PAGE_SIZE_SIZE)
+#define DB_HEADER_FREELIST_HEAD_SIZE    (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_FREELIST_HEAD_OFFSET  (uint32_t)(DB_HEADER_ROOT_PAGE_OFFSET + DB_HEADER_ROOT_PAGE_SIZE)
+#define DB_HEADER_FREELIST_COUNT_SIZE   (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_FREELIST_COUNT_OFFSET (uint32_t)(DB_HEADER_FREELIST_HEAD_OFFSET + DB_HEADER_FREELIST_HEAD_SIZE)
+#define DB_HEADER_INDEX_ROOT_SIZE       (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_INDEX_ROOTS_OFFSET    (uint32_t)(DB_HEADER_FREELIST_COUNT_OFFSET + DB_HEADER_FREELIST_COUNT_SIZE)
+#define DB_HEADER_CATALOG_ROOT_SIZE     (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_CATALOG_ROOT_OFFSET   (uint32_t)(DB_HEADER_INDEX_ROOTS_OFFSET + INDEX_COUNT * DB_HEADER_INDEX_ROOT_SIZE)
+#define DB_HEADER_TABLE_ROOT_SIZE       (uint32_t)(sizeof(uint32_t))
+#define DB_HEADER_TABLE_ROOTS_OFFSET    (uint32_t)(DB_HEADER_CATALOG_ROOT_OFFSET + DB_HEADER_CATALOG_ROOT_SIZE)
+#define FREE_PAGE_NEXT_OFFSET           (uint32_t)0
+
+
+typedef enum {
+    NODE_INTERNAL,
+    NODE_LEAF,
+} node_type;
+
+uint32_t* get_leaf_node_cells_num(void* node) {
+    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+void* get_leaf_node_slot(void* node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_SLOT_SIZE;
+}
+
+uint64_t* get_leaf_node_key(void* node, uint32_t cell_num) {
+    return get_leaf_node_slot(node, cell_num) + LEAF_NODE_KEY_OFFSET;
+}
+
+uint16_t* get_leaf_node_record_offset(void* node, uint32_t cell_num) {
+    return get_leaf_node_slot(node, cell_num) + LEAF_NODE_RECORD_OFFSET_OFFSET;
+}
+
+uint16_t* get_leaf_node_record_length(void* node, uint32_t cell_num) {
+    return get_leaf_node_slot(node, cell_num) + LEAF_NODE_RECORD_LENGTH_OFFSET;
+}
+
+void* get_leaf_node_value(void* node, uint32_t cell_num) {
+    return node + *get_leaf_node_record_offset(node, cell_num);
+}
+
+uint16_t* get_leaf_node_content_start(void* node) {
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+uint16_t* get_leaf_node_fragmented(void* node) {
+    return node + LEAF_NODE_FRAGMENTED_OFFSET;
+}
+
+uint32_t* get_leaf_node_next_leaf(void* node) {
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+node_type get_node_type(void* node) {
+    uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
+    return (node_type)value;
+}
+
+void set_node_type(void* node, node_type nt) {
+    uint8_t value = nt;
+    *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
+}
+
+int is_node_root(void* node) {
+    uint8_t value = *((uint8_t*)(node + IS_ROOT_OFFSET));
+    return (bool)value;
+}
+
+void set_node_root(void* node, bool is_root) {
+    uint8_t value = is_root;
+    *((uint8_t*)(node + IS_ROOT_OFFSET)) = value;
+}
+
+void init_leaf_node(void* node) {
+    set_node_root(node, false);
+    *get_leaf_node_cells_num(node) = 0;
+    *get_leaf_node_next_leaf(node) = 0;
+    *get_leaf_node_content_start(node) = PAGE_USABLE_SIZE;
+    *get_leaf_node_fragmented(node) = 0;
+    set_node_type(node, NODE_LEAF);
+}
+
+/*
+    A table's name and columns. The first column is the key, an int that
+    can't be negative. Ints are 32 bits, a text column holds up to size bytes.
+*/
+#define TABLE_MAX_COUNT     64
+#define TABLE_MAX_COLUMNS   TDB_MAX_COLUMNS
+#define TABLE_NAME_SIZE     32      // the longest table or column name
+#define COLUMN_TEXT_MAX_SIZE 255    // a text's length is stored in one byte
+
+typedef enum {
+    COLUMN_INT,
+    COLUMN_TEXT,
+} column_type;
+
+typedef struct {
+    char name[TABLE_NAME_SIZE + 1];
+    column_type type;
+    uint32_t size;
+} column_def;
+
+typedef struct {
+    char name[TABLE_NAME_SIZE + 1];
+    uint32_t column_count;
+    column_def columns[TABLE_MAX_COLUMNS];
+} schema;
+
+// The table every database starts with, its rows are tdb_rows
+schema USERS_SCHEMA = {
+    "users", 3, {
+        { "id", COLUMN_INT, 0 },
+        { "user_name", COLUMN_TEXT, COLUMN_USERNAME_SIZE },
+        { "email", COLUMN_TEXT, COLUMN_EMAIL_SIZE },
+    },
+};
+
+/*
+    Serialized row: id | user name length (1 byte) | user name | email length (1 byte) | email
+    Strings are stored without their terminator and without padding.
+*/
+uint32_t serialized_row_size(row* src) {
+    return ID_SIZE + 1 + strlen(src->user_name) + 1 + strlen(src->email);
+}
+
+uint32_t serialize_row(row* src, void* des) {
+    uint8_t* p = des;
+    uint8_t user_name_len = strlen(src->user_name);
+    uint8_t email_len = strlen(src->email);
+
+    memcpy(p, &(src->id), ID_SIZE);
+    p += ID_SIZE;
+    *p++ = user_name_len;
+    memcpy(p, src->user_name, user_name_len);
+    p += user_name_len;
+    *p++ = email_len;
+    memcpy(p, src->email, email_len);
+    p += email_len;
+
+    return p - (uint8_t*)des;
+}
+
+void deserialize_row(void* src, row* des) {
+    uint8_t* p = src;
+
+    memcpy(&(des->id), p, ID_SIZE);
+    p += ID_SIZE;
+    uint8_t user_name_len = *p++;
+    memcpy(des->user_name, p, user_name_len);
+    des->user_name[user_name_len] = '\0';
+    p += user_name_len;
+    uint8_t email_len = *p++;
+    memcpy(des->email, p, email_len);
+    des->email[email_len] = '\0';
+}
+
+/*
+    The rows of tables made with create table are serialized column by
+    column in the same way: an int as 4 bytes, a text as its length (1 byte)
+    and its bytes. For the users schema that is the layout above.
+*/
+typedef struct {
+    int64_t numbers[TABLE_MAX_COLUMNS];     // int columns
+    char* texts[TABLE_MAX_COLUMNS];         // text columns, each with room for its size and a terminator
+} row_values;
+
+/// @brief The longest record a row of the schema can have
+/// @param s 
+/// @return 
+uint32_t max_record_size(schema* s) {
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        size += s->columns[i].type == COLUMN_INT ? sizeof(uint32_t) : 1 + s->columns[i].size;
+    }
+    return size;
+}
+
+/// @brief Room for one row of the schema, in a single allocation released with free
+/// @param s 
+/// @return 
+row_values* alloc_row_values(schema* s) {
+    size_t text_size = 0;
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        if (s->columns[i].type == COLUMN_TEXT) {
+            text_size += s->columns[i].size + 1;
+        }
+    }
+
+    row_values* v = calloc(1, sizeof(row_values) + text_size);
+    char* text = (char*)(v + 1);
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        if (s->columns[i].type == COLUMN_TEXT) {
+            v->texts[i] = text;
+            text += s->columns[i].size + 1;
+        }
+    }
+    return v;
+}
+
+uint16_t serialize_row_values(schema* s, row_values* v, void* des) {
+    uint8_t* p = des;
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        if (s->columns[i].type == COLUMN_INT) {
+            uint32_t number = (uint32_t)v->numbers[i];
+            memcpy(p, &number, sizeof(number));
+            p += sizeof(number);
+        } else {
+            uint8_t length = strlen(v->texts[i]);
+            *p++ = length;
+            memcpy(p, v->texts[i], length);
+            p += length;
+        }
+    }
+    return p - (uint8_t*)des;
+}
+
+void deserialize_row_values(schema* s, void* src, row_values* v) {
+    uint8_t* p = src;
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        if (s->columns[i].type == COLUMN_INT) {
+            uint32_t number;
+            memcpy(&number, p, sizeof(number));
+            p += sizeof(number);
+            // The key is unsigned, the other ints are signed
+            v->numbers[i] = i == 0 ? (int64_t)number : (int64_t)(int32_t)number;
+        } else {
+            uint8_t length = *p++;
+            memcpy(v->texts[i], p, length);
+            v->texts[i][length] = '\0';
+            p += length;
+        }
+    }
+}
+
+/// @brief Free bytes between the slot directory and the records
+/// @param node 
+/// @return 
+uint32_t leaf_node_gap(void* node) {
+    return *get_leaf_node_content_start(node)
+         - (LEAF_NODE_HEADER_SIZE + *get_leaf_node_cells_num(node) * LEAF_NODE_SLOT_SIZE);
+}
+
+/// @brief Free bytes once the page is compacted
+/// @param node 
+/// @return 
+uint32_t leaf_node_free_space(void* node) {
+    return leaf_node_gap(node) + *get_leaf_node_fragmented(node);
+}
+
+uint32_t leaf_node_used_space(void* node) {
+    return LEAF_NODE_SPACE_FOR_CELLS - leaf_node_free_space(node);
+}
+
+/// @brief Repack the records against the end of the page, turning fragmented space back into gap
+/// @param node 
+void compact_leaf_node(void* node) {
+    uint8_t copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
+
+    uint16_t content_start = PAGE_USABLE_SIZE;
+    uint32_t num_cells = *get_leaf_node_cells_num(node);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        uint16_t length = *get_leaf_node_record_length(node, i);
+        content_start -= length;
+        memcpy(node + content_start, copy + *get_leaf_node_record_offset(node, i), length);
+        *get_leaf_node_record_offset(node, i) = content_start;
+    }
+
+    *get_leaf_node_content_start(node) = content_start;
+    *get_leaf_node_fragmented(node) = 0;
+}
+
+/// @brief Place a serialized record at cell_num, the caller makes sure it fits
+/// @param node 
+/// @param cell_num 
+/// @param key 
+/// @param record 
+/// @param length 
+void leaf_node_insert_record(void* node, uint32_t cell_num, uint64_t key, const void* record, uint16_t length) {
+    if (leaf_node_gap(node) < LEAF_NODE_SLOT_SIZE + length) {
+        compact_leaf_node(node);
+    }
+
+    uint32_t num_cells = *get_leaf_node_cells_num(node);
+    memmove(get_leaf_node_slot(node, cell_num + 1),
+            get_leaf_node_slot(node, cell_num),
+            (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+
+    uint16_t content_start = *get_leaf_node_content_start(node) - length;
+    memcpy(node + content_start, record, length);
+    *get_leaf_node_content_start(node) = content_start;
+
+    *get_leaf_node_key(node, cell_num) = key;
+    *get_leaf_node_record_offset(node, cell_num) = content_start;
+    *get_leaf_node_record_length(node, cell_num) = length;
+    *get_leaf_node_cells_num(node) = num_cells + 1;
+}
+
+void leaf_node_remove_record(void* node, uint32_t cell_num) {
+    uint16_t offset = *get_leaf_node_record_offset(node, cell_num);
+    uint16_t length = *get_leaf_node_record_length(node, cell_num);
+    if (offset == *get_leaf_node_content_start(node)) {
+        *get_leaf_node_content_start(node) += length;
+    } else {
+        *get_leaf_node_fragmented(node) += length;
+    }
+
+    uint32_t num_cells = *get_leaf_node_cells_num(node);
+    memmove(get_leaf_node_slot(node, cell_num),
+            get_leaf_node_slot(node, cell_num + 1),
+            (num_cells - cell_num - 1) * LEAF_NODE_SLOT_SIZE);
+    *get_leaf_node_cells_num(node) = num_cells - 1;
+}
+
+#define DEFAULT_POOL_FRAMES 1024
+#define DEFAULT_CHECKPOINT_PAGES 128
+#define MIN_POOL_FRAMES     32
+#define NO_FRAME            (-1)
+
+/*
+    mmap backend: the whole window is mapped once at open so page pointers never move,
+    the file underneath is grown in MMAP_GROW_PAGES extents (1MB)
+*/
+#define MMAP_GROW_PAGES     256
+#define MMAP_WINDOW_SIZE    (sizeof(void*) == 8 ? ((size_t)1 << 34) : ((size_t)1 << 30))
+
+/*
+    A frame is one PAGE_SIZE slot of the buffer pool.
+    Frames hashing to the same bucket are chained through hash_next.
+*/
+typedef struct {
+    uint32_t page_num;      // INVALID_PAGE_NUM while the frame is unused
+    uint32_t pin_count;     // frame can't be evicted while pinned, changed atomically
+    bool dirty;             // page differs from its copy in the db file
+    bool referenced;        // CLOCK second-chance bit
+    bool pending;           // modified by the uncommitted statement, not in the WAL yet
+    int32_t hash_next;
+    void* data;
+    pthread_rwlock_t latch; // guards the page contents, see latches below
+} frame;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t write_backs;
+    uint64_t read_aheads;   // pages scans asked for ahead of time that weren't in the pool
+    uint64_t reads;         // pages read from the db file, the mmap pager's come in by page faults
+    uint64_t writes;        // pages written to the db file
+    uint64_t background_writes; // of those, by background checkpoints
+} pool_stats;
+
+/*
+    Hot path statistics, printed by .stats and cleared by .stats reset.
+    They are updated with relaxed atomics, as selects on other threads
+    share them. A latency histogram is log-bucketed like HdrHistogram:
+    every power of two of nanoseconds is split into 1 << HISTOGRAM_SUB_BITS
+    buckets, so a bucket is never wider than a quarter of the latencies in
+    it. Building with TDB_NO_STATS compiles the STAT_ macros to nothing.
+*/
+#define HISTOGRAM_SUB_BITS  2
+#define HISTOGRAM_BUCKETS   (64 << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram;
+
+typedef struct {
+    uint64_t page_gets;         // get_page calls, whether the page was in memory or not
+    uint64_t cursor_steps;      // rows cursors moved on by
+    uint64_t leaf_hops;         // of those, the ones onto the next leaf
+    histogram page_reads;       // get_page misses that read the db file
+    histogram page_flushes;     // pages written to the db file
+    histogram descents;         // root to leaf, to write or to seek a snapshot
+    histogram leaf_splits;
+    histogram internal_splits;
+} op_stats;
+
+typedef enum {
+    ACCESS_NORMAL,
+    ACCESS_RANDOM,
+    ACCESS_SEQUENTIAL,
+} access_pattern;
+
+typedef struct {
+    uint8_t* bits;
+    uint32_t bytes;
+} page_bitmap;
+
+/*
+    Page checksums.
+    A page's last word is the CRC32C of the bytes before it. The writer
+    stamps it at commit, while the page is still latched, so the WAL frame
+    and every later write-back of the page carry it. It is checked the first
+    time the page is read back from the file. On x86-64 CPUs with SSE4.2 the
+    crc32 instruction takes 8 bytes at a time, elsewhere a table takes one.
+    The instruction has three times the latency of its throughput, so a page
+    goes through it as three independent stripes whose crcs are then joined.
+*/
+#define CRC32C_POLY 0x82F63B78     // Castagnoli polynomial, bit reversed
+#define CRC32C_STRIPE 1360         // bytes, a multiple of 8, three of them cover a page
+
+uint32_t crc32c_table[256];
+uint32_t crc32c_stripe_shift[4][256];   // by byte of a crc: the crc after CRC32C_STRIPE zero bytes
+bool crc32c_hardware;
+pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+void init_crc32c(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[i] = crc;
+    }
+
+    // Running zeros through a crc is linear, so it's the xor of what it does to each bit
+    uint32_t shifted_bits[32];
+    for (int bit = 0; bit < 32; bit++) {
+        uint32_t crc = (uint32_t)1 << bit;
+        for (int i = 0; i < CRC32C_STRIPE; i++) {
+            crc = crc32c_table[crc & 0xFF] ^ (crc >> 8);
+        }
+        shifted_bits[bit] = crc;
+    }
+    for (int byte = 0; byte < 4; byte++) {
+        for (int value = 0; value < 256; value++) {
+            uint32_t crc = 0;
+            for (int bit = 0; bit < 8; bit++) {
+                if (value & (1 << bit)) {
+                    crc ^= shifted_bits[byte * 8 + bit];
+                }
+            }
+            crc32c_stripe_shift[byte][value] = crc;
+        }
+    }
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+uint32_t crc32c_table_update(uint32_t crc, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_X86
+uint32_t crc32c_shift_stripe(uint32_t crc) {
+    return crc32c_stripe_shift[0][crc & 0xFF] ^ crc32c_stripe_shift[1][(crc >> 8) & 0xFF]
+         ^ crc32c_stripe_shift[2][(crc >> 16) & 0xFF] ^ crc32c_stripe_shift[3][crc >> 24];
+}
+
+uint64_t load_word(const uint8_t* data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware_update(uint32_t crc, const uint8_t* data, size_t len) {
+    for (; len >= 3 * CRC32C_STRIPE; data += 3 * CRC32C_STRIPE, len -= 3 * CRC32C_STRIPE) {
+        uint64_t a = crc, b = 0, c = 0;
+        for (size_t i = 0; i < CRC32C_STRIPE; i += sizeof(uint64_t)) {
+            a = _mm_crc32_u64(a, load_word(data + i));
+            b = _mm_crc32_u64(b, load_word(data + CRC32C_STRIPE + i));
+            c = _mm_crc32_u64(c, load_word(data + 2 * CRC32C_STRIPE + i));
+        }
+        crc = crc32c_shift_stripe(crc32c_shift_stripe((uint32_t)a) ^ (uint32_t)b) ^ (uint32_t)c;
+    }
+
+    uint64_t crc64 = crc;
+    for (; len >= sizeof(uint64_t); data += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+        crc64 = _mm_crc32_u64(crc64, load_word(data));
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; data++, len--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+/// @brief CRC32C of a buffer, the tables are set up by the first open_pager
+/// @param data 
+/// @param len 
+/// @return 
+uint32_t crc32c(const void* data, size_t len) {
+#ifdef CRC32C_X86
+    if (crc32c_hardware) {
+        return ~crc32c_hardware_update(~0u, data, len);
+    }
+#endif
+    return ~crc32c_table_update(~0u, data, len);
+}
+
+uint32_t* get_page_checksum(void* page) {
+    return page + PAGE_CHECKSUM_OFFSET;
+}
+
+void stamp_page_checksum(void* page) {
+    *get_page_checksum(page) = crc32c(page, PAGE_CHECKSUM_OFFSET);
+}
+
+/// @brief Whether a page read from the file is intact. A page of zeros was
+///        never written, the file was grown past it, and passes too.
+/// @param page 
+/// @return 
+bool page_checksum_ok(void* page) {
+    if (*get_page_checksum(page) == crc32c(page, PAGE_CHECKSUM_OFFSET)) {
+        return true;
+    }
+    const uint8_t* bytes = page;
+    for (uint32_t i = 0; i < PAGE_SIZE; i++) {
+        if (bytes[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void verify_page_checksum(void* page, uint32_t page_num) {
+    if (!page_checksum_ok(page)) {
+        printf("Page %d failed its checksum. Corrupt file, or written by an older version.\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int sync_file(int fd) {
+#ifdef _WIN32
+    return _commit(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+/// @brief Put from in the place of to, durably. A crash at any point leaves one of the two under to's name.
+/// @param from 
+/// @param to 
+/// @return false if the rename failed or couldn't be made durable, errno says why
+bool replace_file(const char* from, const char* to) {
+#ifdef _WIN32
+    if (!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        errno = GetLastError();
+        return false;
+    }
+    return true;
+#else
+    if (rename(from, to) == -1) {
+        return false;
+    }
+
+    // The new name lives in the directory, which has to reach the disk too
+    char* dir = strdup(to);
+    char* slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else if (slash == dir) {
+        dir[1] = '\0';
+    } else {
+        *slash = '\0';
+    }
+    int fd = open(dir, O_RDONLY);
+    free(dir);
+    if (fd == -1) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#endif
+}
+
+bool read_at(int fd, off_t offset, void* buf, size_t len) {
+    return lseek(fd, offset, SEEK_SET) != -1 && read(fd, buf, len) == (ssize_t)len;
+}
+
+bool write_at(int fd, off_t offset, const void* buf, size_t len) {
+    return lseek(fd, offset, SEEK_SET) != -1 && write(fd, buf, len) == (ssize_t)len;
+}
+
+/*
+    LZ4 block format, enough of it for pages: a sequence is a token (literal
+    count << 4 | match length - 4), the literal count past 15 in bytes of
+    255 and a last smaller one, the literals, the match offset (2 bytes),
+    and the match length past 15 the same way. The last sequence is only
+    literals, at least the last 5 bytes, and no match starts in the last 12.
+*/
+#define LZ4_MIN_MATCH       4
+#define LZ4_HASH_BITS       12
+#define LZ4_LAST_LITERALS   5
+#define LZ4_MATCH_LIMIT     12
+
+uint32_t lz4_hash(uint32_t word) {
+    return (word * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+uint32_t lz4_load(const uint8_t* p) {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+uint8_t* lz4_put_length(uint8_t* out, uint32_t len) {
+    for (; len >= 255; len -= 255) {
+        *out++ = 255;
+    }
+    *out++ = len;
+    return out;
+}
+
+/// @brief Add a sequence, unless it would go past end
+/// @return where the next one goes, NULL if it didn't fit
+uint8_t* lz4_put_sequence(uint8_t* out, uint8_t* end, const uint8_t* literals, uint32_t literal_count,
+                          uint32_t offset, uint32_t match_len) {
+    size_t worst = 1 + literal_count / 255 + 1 + literal_count + 2 + match_len / 255 + 1;
+    if ((size_t)(end - out) < worst) {
+        return NULL;
+    }
+    uint8_t* token = out++;
+    *token = (literal_count < 15 ? literal_count : 15) << 4;
+    if (literal_count >= 15) {
+        out = lz4_put_length(out, literal_count - 15);
+    }
+    memcpy(out, literals, literal_count);
+    out += literal_count;
+    if (match_len == 0) {
+        return out;
+    }
+
+    out[0] = offset & 0xFF;
+    out[1] = offset >> 8;
+    out += 2;
+    match_len -= LZ4_MIN_MATCH;
+    *token |= match_len < 15 ? match_len : 15;
+    if (match_len >= 15) {
+        out = lz4_put_length(out, match_len - 15);
+    }
+    return out;
+}
+
+/// @brief Compress a block of at most 64 KiB
+/// @param in 
+/// @param len 
+/// @param out 
+/// @param capacity 
+/// @return the compressed length, 0 if it takes more than capacity
+uint32_t lz4_compress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t capacity) {
+    uint16_t last_seen[1 << LZ4_HASH_BITS] = {0};    // hash of 4 bytes -> where they last were
+    uint8_t* op = out;
+    uint8_t* end = out + capacity;
+    uint32_t anchor = 0;    // start of the literals not written yet
+    uint32_t pos = 1;
+
+    while (pos + LZ4_MATCH_LIMIT <= len) {
+        uint32_t word = lz4_load(in + pos);
+        uint32_t h = lz4_hash(word);
+        uint32_t candidate = last_seen[h];
+        last_seen[h] = pos;
+        if (lz4_load(in + candidate) != word) {
+            // Step further the longer nothing matches, data that doesn't compress goes by quickly
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        uint32_t match_len = LZ4_MIN_MATCH;
+        while (pos + match_len < len - LZ4_LAST_LITERALS && in[candidate + match_len] == in[pos + match_len]) {
+            match_len++;
+        }
+        op = lz4_put_sequence(op, end, in + anchor, pos - anchor, pos - candidate, match_len);
+        if (op == NULL) {
+            return 0;
+        }
+        pos += match_len;
+        anchor = pos;
+    }
+
+    op = lz4_put_sequence(op, end, in + anchor, len - anchor, 0, 0);
+    return op == NULL ? 0 : op - out;
+}
+
+/// @brief Decompress a block, which may come from a damaged file
+/// @param in 
+/// @param len 
+/// @param out 
+/// @param out_len what it decompresses to
+/// @return false unless it is a well formed block of exactly out_len bytes
+bool lz4_decompress(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t out_len) {
+    const uint8_t* ip = in;
+    const uint8_t* in_end = in + len;
+    uint8_t* op = out;
+    uint8_t* out_end = out + out_len;
+
+    while (ip < in_end) {
+        uint32_t token = *ip++;
+        size_t literal_count = token >> 4;
+        if (literal_count == 15) {
+            uint8_t b;
+            do {
+                if (ip == in_end) {
+                    return false;
+                }
+                b = *ip++;
+                literal_count += b;
+            } while (b == 255);
+        }
+        if (literal_count > (size_t)(in_end - ip) || literal_count > (size_t)(out_end - op)) {
+            return false;
+        }
+        memcpy(op, ip, literal_count);
+        op += literal_count;
+        ip += literal_count;
+        if (ip == in_end) {
+            break;
+        }
+
+        if (in_end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15) {
+            uint8_t b;
+            do {
+                if (ip == in_end) {
+                    return false;
+                }
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || match_len > (size_t)(out_end - op)) {
+            return false;
+        }
+        // Byte by byte, a match may overlap the bytes it produces
+        const uint8_t* from = op - offset;
+        for (size_t i = 0; i < match_len; i++) {
+            op[i] = from[i];
+        }
+        op += match_len;
+    }
+    return op == out_end;
+}
+
+/*
+    Compressed db files, made when tdb_config.compress is set and the file
+    doesn't exist yet. Each page is stored LZ4 compressed in as many
+    STORE_UNIT byte units as it takes, wherever there is room, and a page
+    map says where:
+
+        superblock | superblock | page images and page maps, in any order
+
+    Superblock, STORE_SUPERBLOCK_SIZE bytes:
+        magic | version | sequence (8 bytes) | page count | map offset (units)
+        | map length (bytes) | map checksum | checksum
+    Page map, an entry per page:
+        offset (units, 0 for a page never written) | stored length (2 bytes) | flags (2 bytes)
+
+    Writing a page never overwrites the image the last superblock's map has
+    for it: the new one goes to free space and only the map in memory
+    changes. store_sync writes that map to free space too, syncs, writes a
+    superblock with the next sequence into the slot the last one isn't in,
+    and syncs again. Open goes by the valid superblock with the higher
+    sequence, so a crash leaves the file as of the last sync, which the WAL
+    replays from. The space of the images and the map that superblock
+    replaced is free from then on.
+
+    The buffer pool keeps pages decompressed, only misses and flushes go
+    through the codec. A file without the magic in front is plain, page n
+    at n * PAGE_SIZE, read and written in place.
+*/
+#define STORE_MAGIC             0x5A424454  // "TDBZ"
+#define STORE_VERSION           1
+#define STORE_UNIT              64
+#define STORE_SUPERBLOCK_SIZE   512
+#define STORE_DATA_START        (2 * STORE_SUPERBLOCK_SIZE / STORE_UNIT)    // first unit after the superblocks
+#define STORE_PAGE_RAW          1   // flag: stored as it is, it didn't compress
+#define STORE_RUN_PAGES         64  // pages store_write_run writes at most
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sequence;
+    uint32_t page_count;
+    uint32_t map_offset;
+    uint32_t map_length;
+    uint32_t map_checksum;
+    uint32_t checksum;      // of the fields before it
+} superblock;
+
+typedef struct {
+    uint32_t offset;        // in units, 0 for a page never written
+    uint16_t length;        // bytes
+    uint16_t flags;
+} page_extent;
+
+typedef struct {
+    uint32_t offset;        // in units
+    uint32_t units;
+} free_extent;
+
+typedef struct {
+    free_extent* items;
+    uint32_t count;
+    uint32_t capacity;
+} extent_list;
+
+typedef struct {
+    int fd;
+    bool compressed;
+    uint32_t page_count;
+    uint32_t map_capacity;
+    page_extent* map;           // where each page is now
+    page_extent* synced_map;    // where the last superblock has them, that space stays taken
+    uint32_t synced_count;
+    uint32_t synced_capacity;
+    uint32_t map_offset;        // of the last superblock's map
+    uint32_t map_units;
+    uint64_t sequence;          // of the last superblock
+    uint32_t end_unit;          // units the file takes up
+    extent_list free;           // by offset, neighbours merged
+    extent_list released;       // let go of since the last sync, free after the next one
+    bool changed;               // the map differs from the last superblock's
+    uint8_t* buffer;            // a page on its way to or from the codec
+} page_store;
+
+uint32_t units_of(uint32_t bytes) {
+    return (bytes + STORE_UNIT - 1) / STORE_UNIT;
+}
+
+void extent_list_insert(extent_list* list, uint32_t at, free_extent e) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        list->items = realloc(list->items, list->capacity * sizeof(free_extent));
+    }
+    memmove(&list->items[at + 1], &list->items[at], (list->count - at) * sizeof(free_extent));
+    list->items[at] = e;
+    list->count++;
+}
+
+void extent_list_remove(extent_list* list, uint32_t at) {
+    memmove(&list->items[at], &list->items[at + 1], (list->count - at - 1) * sizeof(free_extent));
+    list->count--;
+}
+
+/// @brief Give space back to the free list, merged with free space on either side
+/// @param store 
+/// @param offset 
+/// @param units 
+void store_free(page_store* store, uint32_t offset, uint32_t units) {
+    extent_list* list = &store->free;
+    uint32_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (list->items[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    bool joins_before = lo > 0 && list->items[lo - 1].offset + list->items[lo - 1].units == offset;
+    bool joins_after = lo < list->count && offset + units == list->items[lo].offset;
+    if (joins_before && joins_after) {
+        list->items[lo - 1].units += units + list->items[lo].units;
+        extent_list_remove(list, lo);
+    } else if (joins_before) {
+        list->items[lo - 1].units += units;
+    } else if (joins_after) {
+        list->items[lo].offset = offset;
+        list->items[lo].units += units;
+    } else {
+        extent_list_insert(list, lo, (free_extent){ offset, units });
+    }
+}
+
+/// @brief Take the first free space big enough, or grow the file
+/// @param store 
+/// @param units 
+/// @return the offset in units
+uint32_t store_allocate(page_store* store, uint32_t units) {
+    extent_list* list = &store->free;
+    for (uint32_t i = 0; i < list->count; i++) {
+        free_extent* e = &list->items[i];
+        if (e->units >= units) {
+            uint32_t offset = e->offset;
+            e->offset += units;
+            e->units -= units;
+            if (e->units == 0) {
+                extent_list_remove(list, i);
+            }
+            return offset;
+        }
+    }
+    uint32_t offset = store->end_unit;
+    store->end_unit += units;
+    return offset;
+}
+
+/// @brief Let go of a page's current image. Space the last superblock points
+///        to is only free once the next one is written.
+/// @param store 
+/// @param page_num 
+void store_forget_page(page_store* store, uint32_t page_num) {
+    if (page_num >= store->page_count || store->map[page_num].offset == 0) {
+        return;
+    }
+    page_extent* e = &store->map[page_num];
+    free_extent space = { e->offset, units_of(e->length) };
+    if (page_num < store->synced_count && store->synced_map[page_num].offset == e->offset) {
+        extent_list_insert(&store->released, store->released.count, space);
+    } else {
+        store_free(store, space.offset, space.units);
+    }
+    *e = (page_extent){0};
+    store->changed = true;
+}
+
+void store_set_page_count(page_store* store, uint32_t page_count) {
+    for (uint32_t i = page_count; i < store->page_count; i++) {
+        store_forget_page(store, i);
+    }
+    if (page_count > store->map_capacity) {
+        uint32_t capacity = store->map_capacity == 0 ? 64 : store->map_capacity;
+        while (capacity < page_count) {
+            capacity *= 2;
+        }
+        store->map = realloc(store->map, capacity * sizeof(page_extent));
+        store->map_capacity = capacity;
+    }
+    if (page_count > store->page_count) {
+        memset(&store->map[store->page_count], 0, (page_count - store->page_count) * sizeof(page_extent));
+    }
+    if (page_count != store->page_count) {
+        store->page_count = page_count;
+        store->changed = true;
+    }
+}
+
+/// @brief Note the map in memory as the one on disk
+/// @param store 
+void store_mark_synced(page_store* store) {
+    if (store->page_count > store->synced_capacity) {
+        store->synced_capacity = store->map_capacity;
+        store->synced_map = realloc(store->synced_map, store->synced_capacity * sizeof(page_extent));
+    }
+    if (store->page_count > 0) {
+        memcpy(store->synced_map, store->map, store->page_count * sizeof(page_extent));
+    }
+    store->synced_count = store->page_count;
+    store->changed = false;
+}
+
+int compare_free_extents(const void* a, const void* b) {
+    uint32_t x = ((const free_extent*)a)->offset;
+    uint32_t y = ((const free_extent*)b)->offset;
+    return (x > y) - (x < y);
+}
+
+/// @brief Rebuild the free list from the map: whatever no page or the map takes up
+/// @param store 
+void store_find_free_space(page_store* store) {
+    free_extent* taken = malloc((store->page_count + 1) * sizeof(free_extent));
+    uint32_t count = 0;
+    bool in_order = true;   // as a vacuum or an append only table leaves them
+    for (uint32_t i = 0; i < store->page_count; i++) {
+        if (store->map[i].offset != 0) {
+            in_order = in_order && (count == 0 || taken[count - 1].offset < store->map[i].offset);
+            taken[count++] = (free_extent){ store->map[i].offset, units_of(store->map[i].length) };
+        }
+    }
+    if (store->map_units > 0) {
+        in_order = in_order && (count == 0 || taken[count - 1].offset < store->map_offset);
+        taken[count++] = (free_extent){ store->map_offset, store->map_units };
+    }
+    if (!in_order) {
+        qsort(taken, count, sizeof(free_extent), compare_free_extents);
+    }
+
+    store->end_unit = STORE_DATA_START;
+    for (uint32_t i = 0; i < count; i++) {
+        if (taken[i].offset < store->end_unit) {
+            printf("Page map of the db file overlaps itself. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (taken[i].offset > store->end_unit) {
+            store_free(store, store->end_unit, taken[i].offset - store->end_unit);
+        }
+        store->end_unit = taken[i].offset + taken[i].units;
+    }
+    free(taken);
+}
+
+bool superblock_ok(const superblock* sb) {
+    return sb->magic == STORE_MAGIC
+        && sb->version == STORE_VERSION
+        && sb->checksum == crc32c(sb, offsetof(superblock, checksum));
+}
+
+/// @brief Load the map of a compressed file, from the superblock with the higher sequence
+/// @param store 
+/// @param slots the file's first two STORE_SUPERBLOCK_SIZE bytes
+void store_load(page_store* store, const uint8_t* slots) {
+    superblock sb[2];
+    memcpy(&sb[0], slots, sizeof(superblock));
+    memcpy(&sb[1], slots + STORE_SUPERBLOCK_SIZE, sizeof(superblock));
+    bool ok[2] = { superblock_ok(&sb[0]), superblock_ok(&sb[1]) };
+    if (!ok[0] && !ok[1]) {
+        printf("Db file has no valid superblock. Corrupt file, or written by a newer version.\n");
+        exit(EXIT_FAILURE);
+    }
+    const superblock* last = !ok[1] || (ok[0] && sb[0].sequence > sb[1].sequence) ? &sb[0] : &sb[1];
+
+    store_set_page_count(store, last->page_count);
+    if (last->map_length != last->page_count * sizeof(page_extent)
+        || !read_at(store->fd, (off_t)last->map_offset * STORE_UNIT, store->map, last->map_length)
+        || crc32c(store->map, last->map_length) != last->map_checksum) {
+        printf("Page map of the db file failed its checksum. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Reads go through a buffer of one page, a longer extent can't have been written by us
+    for (uint32_t i = 0; i < store->page_count; i++) {
+        if (store->map[i].length > PAGE_SIZE) {
+            printf("Page map of the db file has a page longer than %d bytes. Corrupt file.\n", PAGE_SIZE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    store->sequence = last->sequence;
+    store->map_offset = last->map_offset;
+    store->map_units = units_of(last->map_length);
+    store_find_free_space(store);
+    store_mark_synced(store);
+}
+
+bool store_sync(page_store* store);
+
+void store_open(page_store* store, int fd, bool compress_new_file) {
+    *store = (page_store){ .fd = fd };
+    store->buffer = malloc(PAGE_SIZE);
+
+    off_t file_len = lseek(fd, 0, SEEK_END);
+    uint8_t slots[2 * STORE_SUPERBLOCK_SIZE] = {0};
+    if (file_len == 0) {
+        store->compressed = compress_new_file;
+    } else if (read_at(fd, 0, slots, file_len < (off_t)sizeof(slots) ? (size_t)file_len : sizeof(slots))) {
+        uint32_t magic[2];
+        memcpy(&magic[0], slots, sizeof(uint32_t));
+        memcpy(&magic[1], slots + STORE_SUPERBLOCK_SIZE, sizeof(uint32_t));
+        store->compressed = magic[0] == STORE_MAGIC || magic[1] == STORE_MAGIC;
+    }
+
+    if (!store->compressed) {
+        return;
+    }
+    if (file_len == 0) {
+        // The superblock goes in first, a file without one would pass for a plain file
+        store->end_unit = STORE_DATA_START;
+        store->changed = true;
+        if (!store_sync(store)) {
+            printf("Error writing superblock: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        store_load(store, slots);
+    }
+}
+
+void free_store(page_store* store) {
+    free(store->map);
+    free(store->synced_map);
+    free(store->free.items);
+    free(store->released.items);
+    free(store->buffer);
+}
+
+/// @brief Bytes of pages the file holds, for a compressed file as many as it would take uncompressed
+/// @param store 
+/// @return 
+off_t store_length(page_store* store) {
+    if (!store->compressed) {
+        return lseek(store->fd, 0, SEEK_END);
+    }
+    return (off_t)store->page_count * PAGE_SIZE;
+}
+
+/// @brief Read a page from the file, a compressed one decompressed. A page
+///        that doesn't decompress comes back as zeros, which fail the checksum.
+/// @param store 
+/// @param page_num 
+/// @param buf PAGE_SIZE bytes
+/// @return false if the read failed
+bool store_read(page_store* store, uint32_t page_num, void* buf) {
+    if (!store->compressed) {
+        return lseek(store->fd, (off_t)page_num * PAGE_SIZE, SEEK_SET) != -1
+            && read(store->fd, buf, PAGE_SIZE) != -1;
+    }
+
+    page_extent e = page_num < store->page_count ? store->map[page_num] : (page_extent){0};
+    if (e.offset == 0) {
+        memset(buf, 0, PAGE_SIZE);
+        return true;
+    }
+    if (e.flags & STORE_PAGE_RAW) {
+        return read_at(store->fd, (off_t)e.offset * STORE_UNIT, buf, PAGE_SIZE);
+    }
+    if (!read_at(store->fd, (off_t)e.offset * STORE_UNIT, store->buffer, e.length)) {
+        return false;
+    }
+    if (!lz4_decompress(store->buffer, e.length, buf, PAGE_SIZE)) {
+        memset(buf, 0, PAGE_SIZE);
+    }
+    return true;
+}
+
+/// @brief Read pages one after another
+/// @param store 
+/// @param first 
+/// @param count 
+/// @param buf count * PAGE_SIZE bytes
+/// @return false if a read failed or came up short
+bool store_read_pages(page_store* store, uint32_t first, uint32_t count, void* buf) {
+    if (!store->compressed) {
+        return read_at(store->fd, (off_t)first * PAGE_SIZE, buf, (size_t)count * PAGE_SIZE);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!store_read(store, first + i, (uint8_t*)buf + (size_t)i * PAGE_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Write a page to the file. A compressed file takes it in a new place,
+///        which reaches its map on disk with the next store_sync.
+/// @param store 
+/// @param page_num 
+/// @param data PAGE_SIZE bytes
+/// @return false if the write failed
+bool store_write(page_store* store, uint32_t page_num, const void* data) {
+    if (!store->compressed) {
+        return write_at(store->fd, (off_t)page_num * PAGE_SIZE, data, PAGE_SIZE);
+    }
+
+    // Compressing has to save at least a unit, or the page is stored as it is
+    const void* bytes = store->buffer;
+    page_extent e = { 0, lz4_compress(data, PAGE_SIZE, store->buffer, PAGE_SIZE - STORE_UNIT), 0 };
+    if (e.length == 0) {
+        bytes = data;
+        e.length = PAGE_SIZE;
+        e.flags = STORE_PAGE_RAW;
+    }
+    e.offset = store_allocate(store, units_of(e.length));
+    if (!write_at(store->fd, (off_t)e.offset * STORE_UNIT, bytes, e.length)) {
+        return false;
+    }
+
+    store_forget_page(store, page_num);
+    if (page_num >= store->page_count) {
+        store_set_page_count(store, page_num + 1);
+    }
+    store->map[page_num] = e;
+    store->changed = true;
+    return true;
+}
+
+/// @brief Write pages that follow each other, a plain file's in a single call
+/// @param store 
+/// @param first 
+/// @param pages the images of pages first, first + 1, ..., PAGE_SIZE bytes each
+/// @param count at most STORE_RUN_PAGES
+/// @return false if a write failed
+bool store_write_run(page_store* store, uint32_t first, void** pages, uint32_t count) {
+#ifndef _WIN32
+    if (!store->compressed) {
+        struct iovec iov[STORE_RUN_PAGES];
+        for (uint32_t i = 0; i < count; i++) {
+            iov[i] = (struct iovec){ pages[i], PAGE_SIZE };
+        }
+        return pwritev(store->fd, iov, count, (off_t)first * PAGE_SIZE) == (ssize_t)count * PAGE_SIZE;
+    }
+#endif
+    for (uint32_t i = 0; i < count; i++) {
+        if (!store_write(store, first + i, pages[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Drop the pages from page_count on
+/// @param store 
+/// @param page_count 
+/// @return false if truncating the file failed
+bool store_truncate(page_store* store, uint32_t page_count) {
+    if (!store->compressed) {
+        return ftruncate(store->fd, (off_t)page_count * PAGE_SIZE) != -1;
+    }
+    store_set_page_count(store, page_count);
+    return true;
+}
+
+/// @brief Make everything written so far durable, for a compressed file by
+///        writing its map and switching superblocks
+/// @param store 
+/// @return false if a write or sync failed
+bool store_sync(page_store* store) {
+    if (!store->compressed || !store->changed) {
+        return sync_file(store->fd) != -1;
+    }
+
+    uint32_t map_length = store->page_count * sizeof(page_extent);
+    uint32_t map_units = units_of(map_length);
+    uint32_t map_offset = map_units > 0 ? store_allocate(store, map_units) : 0;
+    superblock sb = {
+        .magic = STORE_MAGIC,
+        .version = STORE_VERSION,
+        .sequence = store->sequence + 1,
+        .page_count = store->page_count,
+        .map_offset = map_offset,
+        .map_length = map_length,
+        .map_checksum = crc32c(store->map, map_length),
+    };
+    sb.checksum = crc32c(&sb, offsetof(superblock, checksum));
+    uint8_t slot[STORE_SUPERBLOCK_SIZE] = {0};
+    memcpy(slot, &sb, sizeof(sb));
+
+    // The pages and the map are on disk before the superblock that points to them
+    if (!write_at(store->fd, (off_t)map_offset * STORE_UNIT, store->map, map_length)
+        || sync_file(store->fd) == -1
+        || !write_at(store->fd, (off_t)(sb.sequence % 2) * STORE_SUPERBLOCK_SIZE, slot, sizeof(slot))
+        || sync_file(store->fd) == -1) {
+        return false;
+    }
+
+    // Nothing on disk points to the old map and the images replaced since the last sync now
+    if (store->map_units > 0) {
+        store_free(store, store->map_offset, store->map_units);
+    }
+    for (uint32_t i = 0; i < store->released.count; i++) {
+        store_free(store, store->released.items[i].offset, store->released.items[i].units);
+    }
+    store->released.count = 0;
+    store->map_offset = map_offset;
+    store->map_units = map_units;
+    store->sequence = sb.sequence;
+    store_mark_synced(store);
+
+    // Give free space at the end back to the file system
+    extent_list* list = &store->free;
+    if (list->count > 0 && list->items[list->count - 1].offset + list->items[list->count - 1].units == store->end_unit) {
+        store->end_unit = list->items[list->count - 1].offset;
+        list->count--;
+        if (ftruncate(store->fd, (off_t)store->end_unit * STORE_UNIT) == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Start reading a page into the OS cache, without waiting for it
+/// @param store 
+/// @param page_num 
+void store_prefetch(page_store* store, uint32_t page_num) {
+#ifndef _WIN32
+    if (!store->compressed) {
+        posix_fadvise(store->fd, (off_t)page_num * PAGE_SIZE, PAGE_SIZE, POSIX_FADV_WILLNEED);
+    } else if (page_num < store->page_count && store->map[page_num].offset != 0) {
+        page_extent e = store->map[page_num];
+        posix_fadvise(store->fd, (off_t)e.offset * STORE_UNIT, e.length, POSIX_FADV_WILLNEED);
+    }
+#endif
+}
+
+/*
+    Write-ahead log, kept next to the db file as "<db>-wal".
+    Header: magic | page size | salt | checksum
+    Frame:  page num | db size in pages (commit frames only, 0 otherwise) | salt | checksum
+            followed by the page image.
+    Frame checksums chain from the previous one, so recovery stops at the first
+    torn or stale frame and only replays up to the last commit frame before it.
+*/
+#define WAL_MAGIC                   0x4C415754
+#define WAL_HEADER_SIZE             16
+#define WAL_FRAME_HEADER_SIZE       16
+#define WAL_FRAME_SIZE              (WAL_FRAME_HEADER_SIZE + PAGE_SIZE)
+#define WAL_WRITE_BATCH_FRAMES      32
+#define WAL_AUTOCHECKPOINT_FRAMES   1000
+
+typedef struct {
+    uint64_t commits;
+    uint64_t frames;
+    uint64_t syncs;
+    uint64_t checkpoints;
+} wal_stats;
+
+typedef struct {
+    int fd;
+    char* file_name;
+    uint32_t salt;
+    uint32_t checksum;          // running checksum, seeds the next frame
+    uint32_t frame_count;
+    uint32_t sync_window_ms;    // group commit: commits inside the window share one fsync
+    uint64_t last_sync_ms;
+    bool unsynced;              // commits written but not fsynced yet
+    void* batch;                // staging buffer for WAL_WRITE_BATCH_FRAMES frames
+    wal_stats stats;
+} wal;
+
+/// @brief Fletcher style checksum over 32-bit words, len must be a multiple of 8
+/// @param seed checksum of whatever precedes the data
+/// @param data 
+/// @param len 
+/// @return 
+uint32_t checksum_words(uint32_t seed, const void* data, uint32_t len) {
+    const uint32_t* words = data;
+    uint32_t s1 = seed;
+    uint32_t s2 = ~seed;
+    for (uint32_t i = 0; i < len / sizeof(uint32_t); i += 2) {
+        s1 += words[i] + s2;
+        s2 += words[i + 1] + s1;
+    }
+    return s1 ^ (s2 << 1);
+}
+
+uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint32_t histogram_bucket(uint64_t ns) {
+    if (ns < (1 << HISTOGRAM_SUB_BITS)) {
+        return ns;
+    }
+    // The top bit picks the power of two, the bits below it the bucket within it
+    uint32_t top = 63 - __builtin_clzll(ns);
+    uint32_t sub = (ns >> (top - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return ((top - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) | sub;
+}
+
+/// @brief The largest latency a bucket holds
+/// @param bucket 
+/// @return 
+uint64_t histogram_bucket_max(uint32_t bucket) {
+    if (bucket < (1 << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+    uint32_t top = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    uint64_t width = (uint64_t)1 << (top - HISTOGRAM_SUB_BITS);
+    return ((uint64_t)1 << top) + (sub + 1) * width - 1;
+}
+
+void histogram_add(histogram* h, uint64_t ns) {
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[histogram_bucket(ns)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+#ifndef TDB_NO_STATS
+#define STAT_COUNT(pg, counter)         __atomic_fetch_add(&(pg)->ops.counter, 1, __ATOMIC_RELAXED)
+#define STAT_START(started)             uint64_t started = now_ns()
+#define STAT_RECORD(pg, hist, started)  histogram_add(&(pg)->ops.hist, now_ns() - (started))
+#else
+#define STAT_COUNT(pg, counter)         ((void)0)
+#define STAT_START(started)             ((void)0)
+#define STAT_RECORD(pg, hist, started)  ((void)0)
+#endif
+
+void wal_sync(wal* w) {
+    if (sync_file(w->fd) == -1) {
+        printf("Error syncing WAL: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    w->unsynced = false;
+    w->last_sync_ms = now_ms();
+    w->stats.syncs++;
+}
+
+/// @brief Start an empty log with a new salt, frames of the old one no longer validate
+/// @param w 
+void wal_reset(wal* w) {
+    uint32_t header[4] = { WAL_MAGIC, PAGE_SIZE, w->salt + 1, 0 };
+    header[3] = checksum_words(header[2], header, 8);
+
+    if (ftruncate(w->fd, 0) == -1
+        || lseek(w->fd, 0, SEEK_SET) == -1
+        || write(w->fd, header, WAL_HEADER_SIZE) != WAL_HEADER_SIZE) {
+        printf("Error resetting WAL: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    w->salt = header[2];
+    w->checksum = header[3];
+    w->frame_count = 0;
+}
+
+/// @brief Copy every committed frame of a log left by a crash back into the db file.
+///        Later frames of a page overwrite earlier ones, frames after the last
+///        commit belong to a statement that never finished and are dropped.
+/// @param w 
+/// @param store the db file
+void wal_recover(wal* w, page_store* store) {
+    uint32_t header[4];
+    off_t wal_len = lseek(w->fd, 0, SEEK_END);
+    lseek(w->fd, 0, SEEK_SET);
+    if (wal_len < WAL_HEADER_SIZE
+        || read(w->fd, header, WAL_HEADER_SIZE) != WAL_HEADER_SIZE
+        || header[0] != WAL_MAGIC
+        || header[1] != PAGE_SIZE
+        || header[3] != checksum_words(header[2], header, 8)) {
+        return;
+    }
+    w->salt = header[2];
+
+    void* page = malloc(PAGE_SIZE);
+    uint32_t frame_header[4];
+    uint32_t checksum = header[3];
+    uint32_t valid_frames = 0;
+    uint32_t committed_frames = 0;
+    uint32_t committed_pages = 0;
+
+    while (read(w->fd, frame_header, WAL_FRAME_HEADER_SIZE) == WAL_FRAME_HEADER_SIZE
+           && read(w->fd, page, PAGE_SIZE) == PAGE_SIZE) {
+        uint32_t expected = checksum_words(checksum_words(checksum, frame_header, 8), page, PAGE_SIZE);
+        if (frame_header[2] != w->salt || frame_header[3] != expected) {
+            break;
+        }
+        checksum = expected;
+        valid_frames++;
+        if (frame_header[1] != 0) {
+            committed_frames = valid_frames;
+            committed_pages = frame_header[1];
+        }
+    }
+
+    lseek(w->fd, WAL_HEADER_SIZE, SEEK_SET);
+    for (uint32_t i = 0; i < committed_frames; i++) {
+        read(w->fd, frame_header, WAL_FRAME_HEADER_SIZE);
+        read(w->fd, page, PAGE_SIZE);
+        if (!store_write(store, frame_header[0], page)) {
+            printf("Error replaying WAL: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(page);
+
+    if (committed_frames > 0) {
+        if (!store_truncate(store, committed_pages) || !store_sync(store)) {
+            printf("Error replaying WAL: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+wal* wal_open(const char* db_file_name, page_store* store, uint32_t sync_window_ms) {
+    wal* w = malloc(sizeof(wal));
+    w->file_name = malloc(strlen(db_file_name) + sizeof("-wal"));
+    sprintf(w->file_name, "%s-wal", db_file_name);
+
+    w->fd = open(w->file_name, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (w->fd == -1) {
+        printf("Unable to open WAL file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    w->salt = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    wal_recover(w, store);
+    wal_reset(w);
+
+    w->sync_window_ms = sync_window_ms;
+    w->last_sync_ms = 0;
+    w->unsynced = false;
+    w->batch = malloc(WAL_WRITE_BATCH_FRAMES * WAL_FRAME_SIZE);
+    w->stats = (wal_stats){0};
+    return w;
+}
+
+/// @brief Close the log after a checkpoint, nothing in it is needed any more
+/// @param w 
+void wal_close(wal* w) {
+    close(w->fd);
+    unlink(w->file_name);
+    free(w->file_name);
+    free(w->batch);
+    free(w);
+}
+
+/*
+    Page versions.
+    Before the writer first changes a page in a statement, mark_page_dirty
+    saves the committed image, tagged with the commit that is going to
+    replace it. A select reads through a snapshot, the number of commits
+    when it started. Of the versions of a page replaced after its snapshot
+    it reads the oldest, and the live page when there is none, so a scan
+    sees the table as it was when it began however long it runs, and the
+    writer never waits for it. A version goes once no open snapshot reads it.
+*/
+#define VERSION_BUCKETS 1024
+#define VERSION_SPARES_MAX 256
+#define SNAPSHOT_LIVE UINT64_MAX    // reads the live pages, changes of the open transaction included
+
+typedef struct page_version {
+    uint32_t page_num;
+    uint64_t replaced_by;           // the commit that replaced this image, the next one while pending
+    struct page_version* older;     // the version this one's page had before
+    struct page_version* next;      // newest version of the next page in the bucket
+    uint8_t data[PAGE_SIZE];
+} page_version;
+
+typedef struct {
+    int fd; //file descriptor
+    page_store store;       // how pages sit in the file
+    char* file_name;
+    tdb_config config;
+    uint32_t file_length;
+    uint32_t num_pages;
+    uint32_t frame_count;
+    uint32_t frames_used;
+    uint32_t clock_hand;
+    frame* frames;
+    int32_t* buckets;       // page num -> first frame in the bucket
+    uint32_t bucket_mask;
+    pool_stats stats;
+    op_stats ops;
+
+    /*
+        Shared to look up and pin a resident page, exclusive to load, evict
+        or flag one. Committing holds it shared, which keeps evictions and
+        their WAL syncs out while the log is written.
+    */
+    pthread_rwlock_t pool_lock;
+
+    tdb_pager_mode mode;
+    access_pattern access_hint;
+    void* map;
+    size_t map_size;
+    uint32_t mapped_pages;  // pages currently backed by the file
+    page_bitmap dirty_map;  // mmap backend dirty bits
+    pthread_rwlock_t* latch_stripes;    // mmap backend page latches, shared by pages a stripe apart
+    bool* stripes_held;                 // stripes the writer holds until it commits
+    uint8_t* verified_bits;             // mmap backend: pages from the file whose checksum was checked
+    uint32_t verified_pages;            // pages the file had at open, later ones never came from it
+    pthread_mutex_t verify_lock;
+
+    /*
+        Pages modified by the statement in flight. They go to the WAL on commit
+        and can't be written to the db file before that (no-steal).
+    */
+    wal* wal;
+    uint32_t* pending_pages;
+    uint32_t pending_count;
+    uint32_t pending_capacity;
+    page_bitmap pending_map; // mmap backend pending bits
+    bool in_transaction;        // pending pages wait for an explicit commit or rollback
+    uint32_t committed_pages;   // num_pages as of the last commit
+    uint32_t write_back_next;   // where the next background checkpoint picks up
+
+    /*
+        Saved page images and open snapshots. commit_seq counts the commits,
+        it moves on once a commit has let go of its pages.
+    */
+    pthread_mutex_t versions_lock;
+    page_version* version_buckets[VERSION_BUCKETS];
+    page_version* spare_versions;
+    uint32_t spare_count;
+    uint32_t version_count;
+    uint64_t commit_seq;
+    uint64_t* snapshots;        // open snapshots, oldest first
+    uint32_t snapshot_count;
+    uint32_t snapshot_capacity;
+} pager;
+
+typedef enum {
+    INDEX_USER_NAME,
+    INDEX_EMAIL,
+    INDEX_COUNT,
+} index_column;
+
+/*
+    A B-tree: a table, keyed by its first column, one of the users table's
+    secondary indexes, or the catalog. root_offset is where the header keeps
+    root_page_num.
+*/
+typedef struct table {
+    uint32_t root_page_num;
+    uint32_t root_offset;
+    pager* pager;
+    schema* schema;                         // NULL in an index or the catalog
+    struct table* indexes[INDEX_COUNT];     // the users table's indexes, root_page_num 0 if not created; NULL in others
+    struct catalog* catalog;                // kept by the users table, NULL in others
+} table;
+
+/*
+    The tables made with create table, table n under key n in the catalog's
+    tree. Tables are never dropped: a new one is filled in at tables[count]
+    and then published by raising count.
+*/
+typedef struct catalog {
+    table tree;
+    table* tables[TABLE_MAX_COUNT];
+    uint32_t count;
+} catalog;
+
+bool is_users_table(table* tbl) {
+    return tbl->schema == &USERS_SCHEMA;
+}
+
+/*
+    A cursor keeps its current leaf pinned until it moves off it or is closed.
+    A select's cursor reads through a snapshot instead, into a copy of its
+    leaf, and holds no page at all. One that scans has the leaves after its
+    own read ahead of time, see read_ahead_leaves.
+*/
+typedef struct {
+    table* table;
+    uint32_t page_num;
+    uint32_t cell_num;
+    bool end_of_table;
+    uint8_t* leaf;          // snapshot cursor: its copy of the leaf, NULL for the writer's cursors
+    uint64_t snapshot;
+    bool read_ahead;        // snapshot cursor: set before seeking by a scan
+    uint32_t ahead_count;   // leaves past the current one already asked for
+    uint32_t parent_page_num;   // snapshot cursor: parent of a leaf it descended to or read ahead from
+} cursor;
+
+void page_flush(pager* pager, uint32_t page_num);
+
+uint32_t hash_page_num(pager* pg, uint32_t page_num) {
+    return (page_num * 2654435761u) & pg->bucket_mask;
+}
+
+int32_t pool_lookup(pager* pg, uint32_t page_num) {
+    int32_t idx = pg->buckets[hash_page_num(pg, page_num)];
+    while (idx != NO_FRAME && pg->frames[idx].page_num != page_num) {
+        idx = pg->frames[idx].hash_next;
+    }
+    return idx;
+}
+
+void pool_hash_insert(pager* pg, int32_t frame_idx) {
+    uint32_t bucket = hash_page_num(pg, pg->frames[frame_idx].page_num);
+    pg->frames[frame_idx].hash_next = pg->buckets[bucket];
+    pg->buckets[bucket] = frame_idx;
+}
+
+void pool_hash_remove(pager* pg, int32_t frame_idx) {
+    int32_t* link = &pg->buckets[hash_page_num(pg, pg->frames[frame_idx].page_num)];
+    while (*link != frame_idx) {
+        link = &pg->frames[*link].hash_next;
+    }
+    *link = pg->frames[frame_idx].hash_next;
+}
+
+/// @brief Pick a frame for a new page: an unused one if any is left, otherwise a CLOCK victim.
+///        A dirty victim is written back before its frame is reused.
+/// @param pg 
+/// @return index of a frame that is out of the hash map
+int32_t pool_grab_frame(pager* pg) {
+    if (pg->frames_used < pg->frame_count) {
+        return pg->frames_used++;
+    }
+
+    /*
+        Two sweeps are enough: the first one clears every reference bit,
+        the second one must then find an unpinned frame if there is one.
+    */
+    for (uint32_t scanned = 0; scanned < 2 * pg->frame_count; scanned++) {
+        int32_t idx = pg->clock_hand;
+        frame* victim = &pg->frames[idx];
+        pg->clock_hand = (pg->clock_hand + 1) % pg->frame_count;
+
+        if (victim->pin_count > 0 || victim->pending) {
+            continue;
+        }
+        if (victim->page_num == INVALID_PAGE_NUM) {
+            // Emptied by a rollback
+            return idx;
+        }
+        if (victim->referenced) {
+            victim->referenced = false;
+            continue;
+        }
+
+        if (victim->dirty) {
+            page_flush(pg, victim->page_num);
+            pg->stats.write_backs++;
+        }
+        pool_hash_remove(pg, idx);
+        victim->page_num = INVALID_PAGE_NUM;
+        pg->stats.evictions++;
+        return idx;
+    }
+
+    printf("Buffer pool exhausted: all %d frames are pinned or hold uncommitted changes.\n", pg->frame_count);
+    exit(EXIT_FAILURE);
+}
+
+bool bitmap_test(page_bitmap* bm, uint32_t page_num) {
+    uint32_t byte = page_num / 8;
+    return byte < bm->bytes && (bm->bits[byte] & (1 << (page_num % 8)));
+}
+
+void bitmap_set(page_bitmap* bm, uint32_t page_num, bool value) {
+    uint32_t byte = page_num / 8;
+    if (byte >= bm->bytes) {
+        uint32_t new_bytes = bm->bytes ? bm->bytes : 64;
+        while (new_bytes <= byte) {
+            new_bytes *= 2;
+        }
+        bm->bits = realloc(bm->bits, new_bytes);
+        memset(bm->bits + bm->bytes, 0, new_bytes - bm->bytes);
+        bm->bytes = new_bytes;
+    }
+
+    if (value) {
+        bm->bits[byte] |= 1 << (page_num % 8);
+    } else {
+        bm->bits[byte] &= ~(1 << (page_num % 8));
+    }
+}
+
+/*
+    Latches.
+    Readers run beside a single writer. The writer doesn't latch to read, it
+    write latches a page in mark_page_dirty before its first change and
+    keeps the latch until the statement commits. A reader read latches a
+    live page only while it copies it, and never waits for a latch while it
+    holds another one.
+*/
+#define MMAP_LATCH_STRIPES 256
+
+void init_latch(pthread_rwlock_t* latch) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    // Keep a stream of readers from starving the writer, they back off instead
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(latch, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+/// @brief The latch of a pinned page
+/// @param pg 
+/// @param page as returned by get_page
+/// @return 
+pthread_rwlock_t* page_latch(pager* pg, void* page) {
+    if (pg->mode == TDB_PAGER_MMAP) {
+        size_t page_num = ((uint8_t*)page - (uint8_t*)pg->map) / PAGE_SIZE;
+        return &pg->latch_stripes[page_num % MMAP_LATCH_STRIPES];
+    }
+    size_t frame_idx = ((uint8_t*)page - (uint8_t*)pg->frames[0].data) / PAGE_SIZE;
+    return &pg->frames[frame_idx].latch;
+}
+
+void mark_page_dirty(pager* pg, uint32_t page_num);
+
+/// @brief mmap backend: a page is just an offset into the mapping, no read and no copy.
+///        Pages past the end of the file are made valid by growing the file first.
+/// @param pg 
+/// @param page_num 
+/// @return pointer into the mapping
+void* mmap_get_page(pager* pg, uint32_t page_num) {
+    if ((size_t)(page_num + 1) * PAGE_SIZE > pg->map_size) {
+        printf("Page %d is outside of the mmap window.\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the writer grows the file, readers ask for pages it already has
+    if (page_num >= __atomic_load_n(&pg->mapped_pages, __ATOMIC_ACQUIRE)) {
+        uint32_t target_pages = (page_num / MMAP_GROW_PAGES + 1) * MMAP_GROW_PAGES;
+        if (ftruncate(pg->fd, (off_t)target_pages * PAGE_SIZE) == -1) {
+            printf("Error growing db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        __atomic_store_n(&pg->mapped_pages, target_pages, __ATOMIC_RELEASE);
+        pg->file_length = target_pages * PAGE_SIZE;
+    }
+
+    if (page_num >= __atomic_load_n(&pg->num_pages, __ATOMIC_ACQUIRE)) {
+        // Brand new page, ftruncate already zero-filled it
+        __atomic_store_n(&pg->num_pages, page_num + 1, __ATOMIC_RELEASE);
+        mark_page_dirty(pg, page_num);
+    }
+
+    void* page = pg->map + (size_t)page_num * PAGE_SIZE;
+    if (page_num < pg->verified_pages) {
+        /*
+            The first get_page of a page checks it. Nothing changes a page
+            before getting it, so holding the lock until the bit is set keeps
+            the writer from changing it mid check.
+        */
+        uint8_t* byte = &pg->verified_bits[page_num / 8];
+        uint8_t bit = 1 << (page_num % 8);
+        if (!(__atomic_load_n(byte, __ATOMIC_ACQUIRE) & bit)) {
+            pthread_mutex_lock(&pg->verify_lock);
+            if (!(*byte & bit)) {
+                verify_page_checksum(page, page_num);
+                __atomic_fetch_or(byte, bit, __ATOMIC_RELEASE);
+            }
+            pthread_mutex_unlock(&pg->verify_lock);
+        }
+    }
+    return page;
+}
+
+/// @brief Pin a resident frame, the pool lock is held at least shared
+/// @param pg 
+/// @param idx 
+/// @return 
+void* pin_frame(pager* pg, int32_t idx) {
+    frame* fr = &pg->frames[idx];
+    __atomic_fetch_add(&fr->pin_count, 1, __ATOMIC_RELAXED);
+    if (!__atomic_load_n(&fr->referenced, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&fr->referenced, true, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&pg->stats.hits, 1, __ATOMIC_RELAXED);
+    return fr->data;
+}
+
+/// @brief Pin a page in the buffer pool, loading it from the file on a miss.
+///        Every call must be balanced by unpin_page.
+/// @param pager 
+/// @param page_num 
+/// @return pointer to the page data, valid until the page is unpinned
+void* get_page(pager* pager, uint32_t page_num) {
+    if (page_num == INVALID_PAGE_NUM) {
+        printf("Attempted to fetch an invalid page number.\n");
+        exit(EXIT_FAILURE);
+    }
+    STAT_COUNT(pager, page_gets);
+
+    if (pager->mode == TDB_PAGER_MMAP) {
+        return mmap_get_page(pager, page_num);
+    }
+
+    pthread_rwlock_rdlock(&pager->pool_lock);
+    int32_t idx = pool_lookup(pager, page_num);
+    if (idx != NO_FRAME) {
+        void* data = pin_frame(pager, idx);
+        pthread_rwlock_unlock(&pager->pool_lock);
+        return data;
+    }
+    pthread_rwlock_unlock(&pager->pool_lock);
+
+    // Cache miss. Another thread may load the page before we get the pool to ourselves
+    pthread_rwlock_wrlock(&pager->pool_lock);
+    idx = pool_lookup(pager, page_num);
+    if (idx != NO_FRAME) {
+        void* data = pin_frame(pager, idx);
+        pthread_rwlock_unlock(&pager->pool_lock);
+        return data;
+    }
+
+    // Take a frame and load from file
+    pager->stats.misses++;
+    idx = pool_grab_frame(pager);
+    frame* fr = &pager->frames[idx];
+    uint32_t pages_on_disk = pager->file_length / PAGE_SIZE;
+
+    fr->dirty = false;
+    fr->pending = false;
+    bool fresh = page_num >= pages_on_disk;
+    if (!fresh) {
+        STAT_START(started);
+        if (!store_read(&pager->store, page_num, fr->data)) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->stats.reads++;
+        verify_page_checksum(fr->data, page_num);
+        STAT_RECORD(pager, page_reads, started);
+    } else {
+        memset(fr->data, 0, PAGE_SIZE);
+    }
+
+    fr->page_num = page_num;
+    fr->pin_count = 1;
+    fr->referenced = true;
+    pool_hash_insert(pager, idx);
+
+    if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+    }
+    pthread_rwlock_unlock(&pager->pool_lock);
+
+    if (fresh) {
+        // Brand new page, it has to reach the file even if nobody writes to it
+        mark_page_dirty(pager, page_num);
+    }
+
+    return fr->data;
+}
+
+void unpin_page(pager* pg, uint32_t page_num) {
+    if (pg->mode == TDB_PAGER_MMAP) {
+        return;
+    }
+
+    pthread_rwlock_rdlock(&pg->pool_lock);
+    int32_t idx = pool_lookup(pg, page_num);
+    if (idx == NO_FRAME || __atomic_fetch_sub(&pg->frames[idx].pin_count, 1, __ATOMIC_RELAXED) == 0) {
+        printf("Attempted to unpin page %d which is not pinned.\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+    pthread_rwlock_unlock(&pg->pool_lock);
+}
+
+void add_pending_page(pager* pg, uint32_t page_num) {
+    if (pg->pending_count == pg->pending_capacity) {
+        pg->pending_capacity = pg->pending_capacity ? pg->pending_capacity * 2 : 16;
+        pg->pending_pages = realloc(pg->pending_pages, pg->pending_capacity * sizeof(uint32_t));
+    }
+    pg->pending_pages[pg->pending_count++] = page_num;
+}
+
+page_version** version_chain(pager* pg, uint32_t page_num) {
+    page_version** link = &pg->version_buckets[(page_num * 2654435761u) % VERSION_BUCKETS];
+    while (*link != NULL && (*link)->page_num != page_num) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/// @brief Keep the committed image of a page the writer is about to change
+/// @param pg 
+/// @param page_num 
+/// @param page 
+void save_page_version(pager* pg, uint32_t page_num, void* page) {
+    pthread_mutex_lock(&pg->versions_lock);
+    page_version* v = pg->spare_versions;
+    if (v != NULL) {
+        pg->spare_versions = v->next;
+        pg->spare_count--;
+    }
+    pthread_mutex_unlock(&pg->versions_lock);
+
+    if (v == NULL) {
+        v = malloc(sizeof(page_version));
+    }
+    memcpy(v->data, page, PAGE_SIZE);
+    v->page_num = page_num;
+
+    pthread_mutex_lock(&pg->versions_lock);
+    v->replaced_by = pg->commit_seq + 1;
+    page_version** link = version_chain(pg, page_num);
+    v->older = *link;
+    v->next = *link == NULL ? NULL : (*link)->next;
+    *link = v;
+    pg->version_count++;
+    pthread_mutex_unlock(&pg->versions_lock);
+}
+
+/// @brief Flag a pinned page as modified by the current statement and write
+///        latch it until the commit, once its committed image is saved for
+///        the snapshots. It is logged on commit and written back before its
+///        frame is reused.
+/// @param pg 
+/// @param page_num 
+void mark_page_dirty(pager* pg, uint32_t page_num) {
+    if (pg->mode == TDB_PAGER_MMAP) {
+        bitmap_set(&pg->dirty_map, page_num, true);
+        if (!bitmap_test(&pg->pending_map, page_num)) {
+            save_page_version(pg, page_num, pg->map + (size_t)page_num * PAGE_SIZE);
+            bitmap_set(&pg->pending_map, page_num, true);
+            add_pending_page(pg, page_num);
+            uint32_t stripe = page_num % MMAP_LATCH_STRIPES;
+            if (!pg->stripes_held[stripe]) {
+                pthread_rwlock_wrlock(&pg->latch_stripes[stripe]);
+                pg->stripes_held[stripe] = true;
+            }
+        }
+        return;
+    }
+
+    pthread_rwlock_rdlock(&pg->pool_lock);
+    int32_t idx = pool_lookup(pg, page_num);
+    pthread_rwlock_unlock(&pg->pool_lock);
+    if (idx == NO_FRAME) {
+        printf("Attempted to dirty page %d which is not resident.\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the writer sets pending, and a pinned frame stays put
+    frame* fr = &pg->frames[idx];
+    if (!fr->pending) {
+        save_page_version(pg, page_num, fr->data);
+        pthread_rwlock_wrlock(&pg->pool_lock);
+        fr->dirty = true;
+        fr->pending = true;
+        pthread_rwlock_unlock(&pg->pool_lock);
+        add_pending_page(pg, page_num);
+        pthread_rwlock_wrlock(&fr->latch);
+    }
+}
+
+/// @brief Tell the kernel how the next pages will be read: point lookups
+///        shouldn't trigger read-ahead, full scans should get as much as possible.
+/// @param pg 
+/// @param hint 
+void pager_set_access_hint(pager* pg, access_pattern hint) {
+    if (__atomic_load_n(&pg->access_hint, __ATOMIC_RELAXED) == hint) {
+        return;
+    }
+    pthread_rwlock_wrlock(&pg->pool_lock);
+    __atomic_store_n(&pg->access_hint, hint, __ATOMIC_RELAXED);
+
+#ifndef _WIN32
+    if (pg->mode == TDB_PAGER_MMAP) {
+        int advice = hint == ACCESS_RANDOM ? MADV_RANDOM
+                   : hint == ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL
+                   : MADV_NORMAL;
+        madvise(pg->map, (size_t)__atomic_load_n(&pg->mapped_pages, __ATOMIC_ACQUIRE) * PAGE_SIZE, advice);
+    } else {
+        int advice = hint == ACCESS_RANDOM ? POSIX_FADV_RANDOM
+                   : hint == ACCESS_SEQUENTIAL ? POSIX_FADV_SEQUENTIAL
+                   : POSIX_FADV_NORMAL;
+        posix_fadvise(pg->fd, 0, 0, advice);
+    }
+#endif
+    pthread_rwlock_unlock(&pg->pool_lock);
+}
+
+/// @brief The image of a page a snapshot reads, versions_lock is held
+/// @param pg 
+/// @param page_num 
+/// @param snapshot 
+/// @return NULL when the snapshot reads the live page
+page_version* find_page_version(pager* pg, uint32_t page_num, uint64_t snapshot) {
+    page_version* found = NULL;
+    for (page_version* v = *version_chain(pg, page_num); v != NULL && v->replaced_by > snapshot; v = v->older) {
+        found = v;
+    }
+    return found;
+}
+
+void drop_page_version(pager* pg, page_version* v) {
+    pg->version_count--;
+    if (pg->spare_count < VERSION_SPARES_MAX) {
+        v->next = pg->spare_versions;
+        pg->spare_versions = v;
+        pg->spare_count++;
+    } else {
+        free(v);
+    }
+}
+
+/// @brief Whether a snapshot in [from, to) is open
+/// @param pg 
+/// @param from 
+/// @param to 
+/// @return 
+bool snapshot_open_between(pager* pg, uint64_t from, uint64_t to) {
+    uint32_t lo = 0;
+    uint32_t hi = pg->snapshot_count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (pg->snapshots[mid] < from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < pg->snapshot_count && pg->snapshots[lo] < to;
+}
+
+/// @brief Drop the versions of one page that no open snapshot reads, versions_lock is held
+/// @param pg 
+/// @param link the bucket link to the page's newest version
+/// @return true if some are left, *link then still points at the page's newest version
+bool collect_page_versions(pager* pg, page_version** link) {
+    page_version* bucket_next = (*link)->next;
+    page_version* kept = NULL;
+    page_version** tail = &kept;
+    for (page_version* v = *link; v != NULL;) {
+        page_version* older = v->older;
+        // Snapshots from when the older version was replaced up to this one read this one
+        uint64_t from = older == NULL ? 0 : older->replaced_by;
+        if (v->replaced_by > pg->commit_seq || snapshot_open_between(pg, from, v->replaced_by)) {
+            *tail = v;
+            tail = &v->older;
+        } else {
+            drop_page_version(pg, v);
+        }
+        v = older;
+    }
+    *tail = NULL;
+
+    if (kept == NULL) {
+        *link = bucket_next;
+        return false;
+    }
+    kept->next = bucket_next;
+    *link = kept;
+    return true;
+}
+
+/// @brief Count a commit and drop the versions of its pages that no snapshot reads.
+///        Called once the committed pages are unlatched.
+/// @param pg 
+void commit_page_versions(pager* pg) {
+    pthread_mutex_lock(&pg->versions_lock);
+    pg->commit_seq++;
+    for (uint32_t i = 0; i < pg->pending_count; i++) {
+        page_version** link = version_chain(pg, pg->pending_pages[i]);
+        if (*link != NULL) {
+            collect_page_versions(pg, link);
+        }
+    }
+    pthread_mutex_unlock(&pg->versions_lock);
+}
+
+uint64_t open_snapshot(pager* pg) {
+    pthread_mutex_lock(&pg->versions_lock);
+    if (pg->snapshot_count == pg->snapshot_capacity) {
+        pg->snapshot_capacity = pg->snapshot_capacity ? pg->snapshot_capacity * 2 : 16;
+        pg->snapshots = realloc(pg->snapshots, pg->snapshot_capacity * sizeof(uint64_t));
+    }
+    // Never older than the snapshots already open, the list stays sorted
+    uint64_t snapshot = pg->commit_seq;
+    pg->snapshots[pg->snapshot_count++] = snapshot;
+    pthread_mutex_unlock(&pg->versions_lock);
+    return snapshot;
+}
+
+void close_snapshot(pager* pg, uint64_t snapshot) {
+    pthread_mutex_lock(&pg->versions_lock);
+    uint32_t idx = pg->snapshot_count - 1;
+    while (pg->snapshots[idx] != snapshot) {
+        idx--;
+    }
+    memmove(&pg->snapshots[idx], &pg->snapshots[idx + 1], (pg->snapshot_count - idx - 1) * sizeof(uint64_t));
+    pg->snapshot_count--;
+
+    // Versions replaced while it was open may have been kept for it alone
+    if (snapshot < pg->commit_seq && pg->version_count > 0) {
+        for (uint32_t i = 0; i < VERSION_BUCKETS; i++) {
+            page_version** link = &pg->version_buckets[i];
+            while (*link != NULL) {
+                if (collect_page_versions(pg, link)) {
+                    link = &(*link)->next;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&pg->versions_lock);
+}
+
+/// @brief Copy a page as a snapshot sees it
+/// @param pg 
+/// @param page_num 
+/// @param snapshot 
+/// @param buf PAGE_SIZE bytes
+void read_page_at(pager* pg, uint32_t page_num, uint64_t snapshot, void* buf) {
+    if (snapshot == SNAPSHOT_LIVE) {
+        memcpy(buf, get_page(pg, page_num), PAGE_SIZE);
+        unpin_page(pg, page_num);
+        return;
+    }
+
+    pthread_mutex_lock(&pg->versions_lock);
+    page_version* v = find_page_version(pg, page_num, snapshot);
+    pthread_mutex_unlock(&pg->versions_lock);
+    if (v != NULL) {
+        // It stays while the snapshot is open
+        memcpy(buf, v->data, PAGE_SIZE);
+        return;
+    }
+
+    void* page = get_page(pg, page_num);
+    pthread_rwlock_t* latch = page_latch(pg, page);
+    bool latched = pthread_rwlock_tryrdlock(latch) == 0;
+
+    // Look again: the writer saves the committed image before it takes the latch
+    pthread_mutex_lock(&pg->versions_lock);
+    v = find_page_version(pg, page_num, snapshot);
+    pthread_mutex_unlock(&pg->versions_lock);
+    if (v == NULL && !latched) {
+        // Only with mmap: the writer holds the stripe for another page, wait for its commit
+        pthread_rwlock_rdlock(latch);
+        latched = true;
+        pthread_mutex_lock(&pg->versions_lock);
+        v = find_page_version(pg, page_num, snapshot);
+        pthread_mutex_unlock(&pg->versions_lock);
+    }
+    memcpy(buf, v != NULL ? v->data : page, PAGE_SIZE);
+
+    if (latched) {
+        pthread_rwlock_unlock(latch);
+    }
+    unpin_page(pg, page_num);
+}
+
+/*
+    In-node search. Leaves keep their keys in the slot directory and internal
+    nodes in an array of their own, so a search reads keys and never records
+    or children. It halves the range without branching, the next half picked
+    by a conditional move instead of a jump the CPU would mispredict half the
+    time. Both keys the step after may probe are prefetched, so a cold node
+    costs overlapping misses rather than one after another. The last few keys
+    are counted in a loop the compiler turns into vector compares.
+*/
+#define SEARCH_SCAN_KEYS 8
+
+/// @brief Lower bound over keys laid out at a fixed stride
+/// @param keys the first key
+/// @param stride bytes from one key to the next
+/// @param count 
+/// @param key 
+/// @return the first key not below key, count if there is none
+uint32_t search_keys(const uint8_t* keys, uint32_t stride, uint32_t count, uint64_t key) {
+    uint32_t base = 0;
+    while (count > SEARCH_SCAN_KEYS) {
+        uint32_t half = count / 2;
+        __builtin_prefetch(keys + (base + (count - half) / 2 - 1) * stride);
+        __builtin_prefetch(keys + (base + half + (count - half) / 2 - 1) * stride);
+        uint64_t probe = *(const uint64_t*)(keys + (base + half - 1) * stride);
+        base = probe < key ? base + half : base;
+        count -= half;
+    }
+
+    uint32_t below = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        below += *(const uint64_t*)(keys + (base + i) * stride) < key;
+    }
+    return base + below;
+}
+
+/// @brief Search a leaf
+/// @param node 
+/// @param key 
+/// @return the cell holding key, or the one it would be inserted at
+uint32_t leaf_node_find_cell(void* node, uint64_t key) {
+    return search_keys((uint8_t*)get_leaf_node_key(node, 0), LEAF_NODE_SLOT_SIZE, *get_leaf_node_cells_num(node), key);
+}
+
+void find_leaf_node(table* tbl, uint32_t page_num, uint64_t key, cursor* cur) {
+    void* node = get_page(tbl->pager, page_num); // pin is handed over to the cursor
+
+    cur->table = tbl;
+    cur->page_num = page_num;
+    cur->end_of_table = false;
+    cur->leaf = NULL;
+    cur->cell_num = leaf_node_find_cell(node, key);
+}
+
+/// @brief  Get page, get row and calculate row byte offset in page
+/// @param cur 
+/// @return row pointer base on page and offset
+void* get_cursor_value(cursor* cur) {
+    if (cur->leaf != NULL) {
+        return get_leaf_node_value(cur->leaf, cur->cell_num);
+    }
+
+    uint32_t page_num = cur->page_num;  // calculate page num
+    void* page = get_page(cur->table->pager, page_num);// get page pointer
+    unpin_page(cur->table->pager, page_num); // still pinned by the cursor itself
+    return get_leaf_node_value(page, cur->cell_num);
+}
+
+void read_ahead_leaves(cursor* cur);
+
+/// @brief Move a snapshot cursor off the end of its leaf, onto the next leaf with rows
+/// @param cur 
+void skip_snapshot_leaves(cursor* cur) {
+    while (cur->cell_num >= *get_leaf_node_cells_num(cur->leaf)) {
+        uint32_t next_page_num = *get_leaf_node_next_leaf(cur->leaf);
+        if (next_page_num == 0) {
+            cur->end_of_table = true;
+            return;
+        }
+        read_page_at(cur->table->pager, next_page_num, cur->snapshot, cur->leaf);
+        STAT_COUNT(cur->table->pager, leaf_hops);
+        cur->page_num = next_page_num;
+        cur->cell_num = 0;
+        if (cur->read_ahead && *get_leaf_node_cells_num(cur->leaf) > 0) {
+            cur->ahead_count -= cur->ahead_count > 0;
+            read_ahead_leaves(cur);
+        }
+    }
+}
+
+void move_cursor_forward(cursor* cur) {
+    STAT_COUNT(cur->table->pager, cursor_steps);
+    if (cur->leaf != NULL) {
+        cur->cell_num += 1;
+        skip_snapshot_leaves(cur);
+        return;
+    }
+
+    pager* pg = cur->table->pager;
+    uint32_t page_num = cur->page_num;
+    void* node = get_page(pg, page_num);
+
+    cur->cell_num += 1;
+    if (cur->cell_num >= (*get_leaf_node_cells_num(node))) {
+        uint32_t next_page_num = *get_leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            cur->end_of_table = true;
+        } else {
+            // Hand the cursor's pin over to the next leaf
+            get_page(pg, next_page_num);
+            unpin_page(pg, page_num);
+            STAT_COUNT(pg, leaf_hops);
+            cur->page_num = next_page_num;
+            cur->cell_num = 0;
+        }
+    }
+    unpin_page(pg, page_num);
+}
+
+void close_cursor(cursor* cur) {
+    if (cur->leaf != NULL) {
+        if (cur->snapshot != SNAPSHOT_LIVE) {
+            close_snapshot(cur->table->pager, cur->snapshot);
+        }
+        return;
+    }
+    unpin_page(cur->table->pager, cur->page_num);
+}
+
+uint32_t* get_header_magic(void* header) {
+    return header + DB_HEADER_MAGIC_OFFSET;
+}
+
+uint32_t* get_header_page_size(void* header) {
+    return header + DB_HEADER_PAGE_SIZE_OFFSET;
+}
+
+uint32_t* get_header_root_page(void* header) {
+    return header + DB_HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t* get_header_root_slot(void* header, table* tbl) {
+    return header + tbl->root_offset;
+}
+
+uint32_t* get_header_freelist_head(void* header) {
+    return header + DB_HEADER_FREELIST_HEAD_OFFSET;
+}
+
+uint32_t* get_header_freelist_count(void* header) {
+    return header + DB_HEADER_FREELIST_COUNT_OFFSET;
+}
+
+uint32_t* get_free_page_next(void* page) {
+    return page + FREE_PAGE_NEXT_OFFSET;
+}
+
+/// @brief Reuse the most recently freed page, or append one to the end of the database file
+/// @param pg 
+/// @return 
+uint32_t get_unused_page_num(pager* pg) {
+    void* header = get_page(pg, DB_HEADER_PAGE_NUM);
+    uint32_t page_num = *get_header_freelist_head(header);
+    if (page_num == 0) {
+        unpin_page(pg, DB_HEADER_PAGE_NUM);
+        return pg->num_pages;
+    }
+
+    void* page = get_page(pg, page_num);
+    mark_page_dirty(pg, DB_HEADER_PAGE_NUM);
+    *get_header_freelist_head(header) = *get_free_page_next(page);
+    (*get_header_freelist_count(header))--;
+    unpin_page(pg, page_num);
+    unpin_page(pg, DB_HEADER_PAGE_NUM);
+    return page_num;
+}
+
+/// @brief Put a page that is no longer referenced by the tree on the freelist
+/// @param pg 
+/// @param page_num 
+void free_page(pager* pg, uint32_t page_num) {
+    void* header = get_page(pg, DB_HEADER_PAGE_NUM);
+    void* page = get_page(pg, page_num);
+    mark_page_dirty(pg, DB_HEADER_PAGE_NUM);
+    mark_page_dirty(pg, page_num);
+
+    memset(page, 0, PAGE_SIZE);
+    *get_free_page_next(page) = *get_header_freelist_head(header);
+    *get_header_freelist_head(header) = page_num;
+    (*get_header_freelist_count(header))++;
+
+    unpin_page(pg, page_num);
+    unpin_page(pg, DB_HEADER_PAGE_NUM);
+}
+
+void set_root_page_num(table* tbl, uint32_t page_num) {
+    pager* pg = tbl->pager;
+    void* header = get_page(pg, DB_HEADER_PAGE_NUM);
+    mark_page_dirty(pg, DB_HEADER_PAGE_NUM);
+    *get_header_root_slot(header, tbl) = page_num;
+    unpin_page(pg, DB_HEADER_PAGE_NUM);
+    tbl->root_page_num = page_num;
+}
+
+uint32_t* get_internal_node_keys_count(void* node) {
+    return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+uint32_t* get_internal_node_right_child(void* node) {
+    return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+void init_internal_node(void* node) {
+    set_node_root(node, false);
+    set_node_type(node, NODE_INTERNAL);
+    *get_internal_node_keys_count(node) = 0;
+    *get_internal_node_right_child(node) = INVALID_PAGE_NUM;
+}
+
+/// @brief The child of a cell, left of its key
+/// @param node 
+/// @param cell_num 
+/// @return 
+uint32_t* get_internal_node_cell(void* node, uint32_t cell_num) {
+    return node + INTERNAL_NODE_CHILDREN_OFFSET + cell_num * INTERNAL_NODE_CHILD_SIZE;
+}
+
+uint32_t* get_internal_node_child(void* node, uint32_t child_num) {
+    uint32_t num_keys = *get_internal_node_keys_count(node);
+    if (child_num > num_keys) {
+        printf("Tried to access child num %d > num keys %d\n", child_num, num_keys);
+        exit(EXIT_FAILURE);
+    } else if (child_num == num_keys) {
+        uint32_t* right_child = get_internal_node_right_child(node);
+        if (*right_child == INVALID_PAGE_NUM) {
+            printf("Tired to access right child of node which is an invalid page.\n");
+            exit(EXIT_FAILURE);
+        }
+        return right_child;
+    } else {
+        uint32_t* child = get_internal_node_cell(node, child_num);
+        if (*child == INVALID_PAGE_NUM) {
+            printf("Tired to access child %d of node which is an invalid page.\n", child_num);
+            exit(EXIT_FAILURE);
+        }
+        return child;
+    }
+}
+
+uint64_t* get_internal_node_key(void* node, uint32_t key_num) {
+    return node + INTERNAL_NODE_KEYS_OFFSET + key_num * INTERNAL_NODE_KEY_SIZE;
+}
+
+/// @brief Copy cells, keys and children alike, between internal nodes or within one
+/// @param dest 
+/// @param dest_num 
+/// @param src 
+/// @param src_num 
+/// @param count 
+void move_internal_node_cells(void* dest, uint32_t dest_num, void* src, uint32_t src_num, uint32_t count) {
+    memmove(get_internal_node_key(dest, dest_num), get_internal_node_key(src, src_num), count * INTERNAL_NODE_KEY_SIZE);
+    memmove(get_internal_node_cell(dest, dest_num), get_internal_node_cell(src, src_num), count * INTERNAL_NODE_CHILD_SIZE);
+}
+
+uint64_t get_node_max_key(pager* pg, void* node) {                                          
+    switch (get_node_type(node)) {
+        case NODE_INTERNAL:
+        {
+            uint32_t right_child_page_num = *get_internal_node_right_child(node);
+            void* right_child = get_page(pg, right_child_page_num);
+            uint64_t max_key = get_node_max_key(pg, right_child);
+            unpin_page(pg, right_child_page_num);
+            return max_key;
+        }
+        case NODE_LEAF:
+        default:
+            return *get_leaf_node_key(node, *get_leaf_node_cells_num(node) - 1);
+    }
+}
+
+uint32_t find_internal_node_child(void* node, uint64_t key) {
+    return search_keys((uint8_t*)get_internal_node_key(node, 0), INTERNAL_NODE_KEY_SIZE, *get_internal_node_keys_count(node), key);
+}
+
+void update_internal_node_key(void* node, uint64_t old_key, uint64_t new_key) {
+    uint32_t old_child_index = find_internal_node_child(node, old_key);
+    // The right child has no key of its own, and in a full node there is no cell past the last one
+    if (old_child_index < *get_internal_node_keys_count(node)) {
+        *get_internal_node_key(node, old_child_index) = new_key;
+    }
+}
+
+/*
+    The way down to a leaf, which the nodes themselves don't record. Splits
+    find their parent on it, deletes the siblings they merge with.
+*/
+typedef struct {
+    uint32_t pages[BTREE_MAX_DEPTH];        // root first, leaf last
+    uint32_t child_idx[BTREE_MAX_DEPTH];    // which child of pages[i] pages[i + 1] is
+    uint32_t depth;
+} btree_path;
+
+void find_path(table* tbl, uint64_t key, btree_path* path) {
+    pager* pg = tbl->pager;
+    uint32_t page_num = tbl->root_page_num;
+    path->depth = 0;
+
+    for (;;) {
+        path->pages[path->depth] = page_num;
+        void* node = get_page(pg, page_num);
+        if (get_node_type(node) == NODE_LEAF) {
+            unpin_page(pg, page_num);
+            path->depth++;
+            return;
+        }
+
+        uint32_t child_idx = find_internal_node_child(node, key);
+        path->child_idx[path->depth] = child_idx;
+        uint32_t child_page_num = *get_internal_node_child(node, child_idx);
+        unpin_page(pg, page_num);
+        page_num = child_page_num;
+        path->depth++;
+    }
+}
+
+void create_new_root(table* tbl, uint32_t right_child_page_num) {
+    /*
+        Splitting the root.
+        Old root copied to new page and became the left child.
+        Address of right child passed in.
+        Re-initialize root page to contain the new root.
+        New root points two children
+    */
+
+    pager* pg = tbl->pager;
+    void* root = get_page(pg, tbl->root_page_num);
+    void* right_child = get_page(pg, right_child_page_num);
+    uint32_t left_child_page_num = get_unused_page_num(pg);
+    void* left_child = get_page(pg, left_child_page_num);
+    mark_page_dirty(pg, tbl->root_page_num);
+    mark_page_dirty(pg, right_child_page_num);
+    mark_page_dirty(pg, left_child_page_num);
+
+    if (get_node_type(root) == NODE_INTERNAL) {
+        init_internal_node(right_child);
+        init_internal_node(left_child);
+    }
+
+    /*
+        Left child holds the data copied from old root
+    */
+    memcpy(left_child, root, PAGE_SIZE);
+    set_node_root(left_child, false);
+
+    /*
+        New root is an internal node with 1 key and 2 children
+    */
+    init_internal_node(root);
+    set_node_root(root, true);
+
+    *get_internal_node_keys_count(root) = 1;
+    *get_internal_node_child(root, 0) = left_child_page_num;
+    uint64_t left_child_max_key = get_node_max_key(pg, left_child);
+    *get_internal_node_key(root, 0) = left_child_max_key;
+    *get_internal_node_right_child(root) = right_child_page_num;       
+
+    unpin_page(pg, left_child_page_num);
+    unpin_page(pg, right_child_page_num);
+    unpin_page(pg, tbl->root_page_num);
+}
+/// @brief Add a child to an internal node that has room for it
+/// @param pg 
+/// @param parent_page_num 
+/// @param child_page_num 
+void add_internal_node_child(pager* pg, uint32_t parent_page_num, uint32_t child_page_num) {
+    void* child = get_page(pg, child_page_num);
+    uint64_t child_max_key = get_node_max_key(pg, child);
+    unpin_page(pg, child_page_num);
+
+    void* parent = get_page(pg, parent_page_num);
+    uint32_t index = find_internal_node_child(parent, child_max_key);
+
+    uint32_t origin_num_keys = *get_internal_node_keys_count(parent);
+
+    mark_page_dirty(pg, parent_page_num);
+    uint32_t right_child_page_num = *get_internal_node_right_child(parent);
+    if (right_child_page_num == INVALID_PAGE_NUM) {
+        *get_internal_node_right_child(parent) = child_page_num;
+        unpin_page(pg, parent_page_num);
+        return;
+    }
+
+    void* right_child = get_page(pg, right_child_page_num);
+    uint64_t right_child_max_key = get_node_max_key(pg, right_child);
+    unpin_page(pg, right_child_page_num);
+
+    *get_internal_node_keys_count(parent) = origin_num_keys + 1;
+
+    if (child_max_key > right_child_max_key) {
+        *get_internal_node_child(parent, origin_num_keys) = right_child_page_num;
+        *get_internal_node_key(parent, origin_num_keys) = right_child_max_key;
+        *get_internal_node_right_child(parent) = child_page_num;
+    } else {
+        move_internal_node_cells(parent, index + 1, parent, index, origin_num_keys - index);
+
+        *get_internal_node_child(parent, index) = child_page_num;
+        *get_internal_node_key(parent, index) = child_max_key;
+    }
+
+    unpin_page(pg, parent_page_num);
+}
+
+void insert_and_split_internal_node(table* tbl, btree_path* path, uint32_t level, uint32_t child_page_num);
+
+/// @brief Add a child to the node at level of path, splitting it and the nodes above when full
+/// @param tbl 
+/// @param path a descent through the node, the levels above it are where its splits go
+/// @param level 
+/// @param child_page_num 
+void insert_internal_node(table* tbl, btree_path* path, uint32_t level, uint32_t child_page_num) {
+    pager* pg = tbl->pager;
+    uint32_t parent_page_num = path->pages[level];
+    void* parent = get_page(pg, parent_page_num);
+    bool full = *get_internal_node_keys_count(parent) >= INTERNAL_NODE_CELL_MAX_SIZE;
+    unpin_page(pg, parent_page_num);
+
+    if (full) {
+        insert_and_split_internal_node(tbl, path, level, child_page_num);
+        return;
+    }
+    add_internal_node_child(pg, parent_page_num, child_page_num);
+}
+
+void insert_and_split_internal_node(table* tbl, btree_path* path, uint32_t level, uint32_t child_page_num)  {
+    /*
+        The upper half of the cells moves to a new node in one copy: the old
+        node keeps the children left of the middle key, with the child under
+        that key as its right child, and the new node takes the rest along
+        with the old right child. The pending child then goes to whichever
+        half covers its keys. Only the two halves and the node above them
+        change, the children keep no pointer back to their parent.
+    */
+    STAT_START(started);
+    pager* pg = tbl->pager;
+    uint32_t old_page_num = path->pages[level];
+    void* old_node = get_page(pg, old_page_num);
+    uint64_t old_max = get_node_max_key(pg, old_node);
+
+    void* child = get_page(pg, child_page_num);
+    uint64_t child_max = get_node_max_key(pg, child);
+
+    uint32_t new_page_num = get_unused_page_num(pg);
+
+    uint32_t splitting_root = is_node_root(old_node);
+
+    uint32_t upper_page_num;
+    void* parent;
+    void* new_node;
+
+    if (splitting_root) {
+        unpin_page(pg, old_page_num);
+        create_new_root(tbl, new_page_num);
+        upper_page_num = tbl->root_page_num;
+        parent = get_page(pg, upper_page_num);
+
+        old_page_num = *get_internal_node_child(parent, 0);
+        old_node = get_page(pg, old_page_num);
+    } else {
+        upper_page_num = path->pages[level - 1];
+        parent = get_page(pg, upper_page_num);
+    }
+    new_node = get_page(pg, new_page_num);
+    // Before any change, marking saves the image a rollback puts back
+    mark_page_dirty(pg, old_page_num);
+    mark_page_dirty(pg, upper_page_num);
+    mark_page_dirty(pg, new_page_num);
+    if (!splitting_root) {
+        init_internal_node(new_node);
+    }
+
+    uint32_t num_keys = *get_internal_node_keys_count(old_node);
+    uint32_t split_idx = num_keys / 2;
+    uint32_t moved_keys = num_keys - split_idx - 1;
+    move_internal_node_cells(new_node, 0, old_node, split_idx + 1, moved_keys);
+    *get_internal_node_keys_count(new_node) = moved_keys;
+    *get_internal_node_right_child(new_node) = *get_internal_node_right_child(old_node);
+
+    uint64_t split_key = *get_internal_node_key(old_node, split_idx);
+    *get_internal_node_right_child(old_node) = *get_internal_node_child(old_node, split_idx);
+    *get_internal_node_keys_count(old_node) = split_idx;
+
+    uint32_t dest_page_num = child_max <= split_key ? old_page_num : new_page_num;
+    add_internal_node_child(pg, dest_page_num, child_page_num);
+
+    uint64_t max_after_split = get_node_max_key(pg, old_node);
+    if (splitting_root) {
+        *get_internal_node_key(parent, 0) = max_after_split;
+    } else {
+        update_internal_node_key(parent, old_max, max_after_split);
+        insert_internal_node(tbl, path, level - 1, new_page_num);
+    }
+
+    unpin_page(pg, new_page_num);
+    unpin_page(pg, upper_page_num);
+    unpin_page(pg, child_page_num);
+    unpin_page(pg, old_page_num);
+    STAT_RECORD(pg, internal_splits, started);
+}
+
+/// @brief Descend to the leaf for key
+/// @param tbl 
+/// @param key 
+/// @param cur 
+/// @param fence set to the largest key that still routes to the same leaf
+void find_table_fence(table* tbl, uint64_t key, cursor* cur, uint64_t* fence) {
+    // One get_page per internal level on the way down
+    STAT_START(started);
+    uint32_t page_num = tbl->root_page_num;
+    *fence = UINT64_MAX;
+    for (;;) {
+        void* node = get_page(tbl->pager, page_num);
+        if (get_node_type(node) == NODE_LEAF) {
+            find_leaf_node(tbl, page_num, key, cur);
+            unpin_page(tbl->pager, page_num);
+            STAT_RECORD(tbl->pager, descents, started);
+            return;
+        }
+
+        // Keys up to the separator on the right of the child taken go down the same way
+        uint32_t child_idx = find_internal_node_child(node, key);
+        if (child_idx < *get_internal_node_keys_count(node)) {
+            uint64_t separator = *get_internal_node_key(node, child_idx);
+            if (separator < *fence) {
+                *fence = separator;
+            }
+        }
+        uint32_t child_num = *get_internal_node_child(node, child_idx);
+        unpin_page(tbl->pager, page_num);
+        page_num = child_num;
+    }
+}
+
+void find_table(table* tbl, uint64_t key, cursor* cur) {
+    uint64_t fence;
+    find_table_fence(tbl, key, cur, &fence);
+}
+
+/// @brief Position a cursor on the first row whose id is >= key
+/// @param tbl 
+/// @param key 
+/// @param curs 
+void seek_table(table* tbl, uint64_t key, cursor* curs) {
+    find_table(tbl, key, curs);
+    pager* pg = tbl->pager;
+    uint32_t page_num = curs->page_num;
+    void* node = get_page(pg, page_num);
+
+    if (curs->cell_num >= *get_leaf_node_cells_num(node)) {
+        // Every key in this leaf is smaller, the row we want starts the next leaf
+        uint32_t next_page_num = *get_leaf_node_next_leaf(node);
+        if (next_page_num == 0) {
+            curs->end_of_table = true;
+        } else {
+            get_page(pg, next_page_num);
+            unpin_page(pg, page_num);
+            curs->page_num = next_page_num;
+            curs->cell_num = 0;
+        }
+    }
+    unpin_page(pg, page_num);
+}
+
+void begin_table(table* tbl, cursor* cur) {
+    seek_table(tbl, 0, cur);
+}
+
+/*
+    Read-ahead. Leaves are chained in key order but may lie anywhere in the
+    file, so the kernel's own read-ahead rarely guesses the next one. A scan
+    knows better: the siblings of its leaf in their parent are the leaves it
+    reads next. Whenever fewer than half of READ_AHEAD_LEAVES are on their
+    way, the parent is read as the snapshot sees it and the kernel is asked
+    for the next READ_AHEAD_LEAVES siblings not already in the pool. The
+    reads go on in the background while the scan decodes rows, and the
+    read of each leaf then finds it in the page cache. It starts once a scan
+    moves past its first leaf, short ranges never get that far.
+*/
+#define READ_AHEAD_LEAVES 16
+
+/// @brief Start reading a page that will be wanted soon, without waiting for it
+/// @param pg 
+/// @param page_num 
+void pager_prefetch(pager* pg, uint32_t page_num) {
+#ifndef _WIN32
+    if (pg->mode == TDB_PAGER_MMAP) {
+        if (page_num < __atomic_load_n(&pg->mapped_pages, __ATOMIC_ACQUIRE)) {
+            madvise(pg->map + (size_t)page_num * PAGE_SIZE, PAGE_SIZE, MADV_WILLNEED);
+        }
+        return;
+    }
+
+    // The lock also keeps a compressed file's map still while the page is looked up in it
+    pthread_rwlock_rdlock(&pg->pool_lock);
+    bool resident = pool_lookup(pg, page_num) != NO_FRAME;
+    if (!resident && page_num < pg->file_length / PAGE_SIZE) {
+        store_prefetch(&pg->store, page_num);
+        __atomic_fetch_add(&pg->stats.read_aheads, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&pg->pool_lock);
+#endif
+}
+
+/// @brief Descend the cursor's snapshot to the parent of its leaf
+/// @param cur 
+/// @param key a key in the leaf
+/// @param parent PAGE_SIZE bytes, left holding the parent
+/// @return its page number, INVALID_PAGE_NUM if the way down misses the leaf
+uint32_t find_snapshot_parent(cursor* cur, uint64_t key, uint8_t* parent) {
+    pager* pg = cur->table->pager;
+    read_page_at(pg, DB_HEADER_PAGE_NUM, cur->snapshot, parent);
+    uint32_t page_num = *get_header_root_slot(parent, cur->table);
+    for (uint32_t depth = 0; depth < BTREE_MAX_DEPTH; depth++) {
+        read_page_at(pg, page_num, cur->snapshot, parent);
+        if (get_node_type(parent) != NODE_INTERNAL) {
+            break;
+        }
+        uint32_t child_page_num = *get_internal_node_child(parent, find_internal_node_child(parent, key));
+        if (child_page_num == cur->page_num) {
+            return page_num;
+        }
+        page_num = child_page_num;
+    }
+    return INVALID_PAGE_NUM;
+}
+
+/// @brief Ask for the leaves after the cursor's, from its siblings in the parent
+/// @param cur a snapshot cursor on a leaf with rows
+void read_ahead_leaves(cursor* cur) {
+    if (cur->ahead_count > READ_AHEAD_LEAVES / 2 || is_node_root(cur->leaf)) {
+        return;
+    }
+
+    pager* pg = cur->table->pager;
+    uint64_t key = *get_leaf_node_key(cur->leaf, 0);
+    uint8_t parent[PAGE_SIZE];
+    if (cur->parent_page_num != INVALID_PAGE_NUM) {
+        read_page_at(pg, cur->parent_page_num, cur->snapshot, parent);
+    }
+    if (cur->parent_page_num == INVALID_PAGE_NUM
+        || *get_internal_node_child(parent, find_internal_node_child(parent, key)) != cur->page_num) {
+        // The leaf chain went on into the next parent, which the way down finds
+        cur->parent_page_num = find_snapshot_parent(cur, key, parent);
+        if (cur->parent_page_num == INVALID_PAGE_NUM) {
+            return;
+        }
+    }
+    uint32_t child_num = find_internal_node_child(parent, key);
+    uint32_t num_keys = *get_internal_node_keys_count(parent);
+
+    // Siblings up to ahead_count were asked for already. The last child's
+    // leaves come from the next parent, once the cursor gets there.
+    while (cur->ahead_count < READ_AHEAD_LEAVES && child_num + 1 + cur->ahead_count <= num_keys) {
+        pager_prefetch(pg, *get_internal_node_child(parent, child_num + 1 + cur->ahead_count));
+        cur->ahead_count++;
+    }
+}
+
+/// @brief Descend to the leaf for key as of the cursor's snapshot, into the cursor's copy of it
+/// @param tbl 
+/// @param key 
+/// @param cur its leaf and snapshot already set
+void descend_snapshot(table* tbl, uint64_t key, cursor* cur) {
+    pager* pg = tbl->pager;
+    STAT_START(started);
+    uint8_t* leaf = cur->leaf;
+    cur->table = tbl;
+    cur->end_of_table = false;
+    cur->parent_page_num = INVALID_PAGE_NUM;
+
+    // The root the snapshot sees, the writer may have moved it since
+    read_page_at(pg, DB_HEADER_PAGE_NUM, cur->snapshot, leaf);
+    uint32_t page_num = *get_header_root_slot(leaf, tbl);
+    if (page_num == 0) {
+        // A table created after the snapshot, which sees it empty
+        init_leaf_node(leaf);
+        cur->page_num = 0;
+        cur->cell_num = 0;
+        return;
+    }
+    read_page_at(pg, page_num, cur->snapshot, leaf);
+    while (get_node_type(leaf) == NODE_INTERNAL) {
+        cur->parent_page_num = page_num;
+        page_num = *get_internal_node_child(leaf, find_internal_node_child(leaf, key));
+        read_page_at(pg, page_num, cur->snapshot, leaf);
+    }
+
+    cur->page_num = page_num;
+    cur->cell_num = leaf_node_find_cell(leaf, key);
+    STAT_RECORD(pg, descents, started);
+}
+
+/// @brief Position a cursor on the first row whose id is >= key, as of a new snapshot
+///        that it keeps until closed
+/// @param tbl 
+/// @param key 
+/// @param cur 
+/// @param leaf PAGE_SIZE bytes for the cursor's copy of its leaf
+/// @param live read the live pages instead of a snapshot, the caller keeps writers out
+void seek_snapshot(table* tbl, uint64_t key, cursor* cur, uint8_t* leaf, bool live) {
+    cur->leaf = leaf;
+    cur->snapshot = live ? SNAPSHOT_LIVE : open_snapshot(tbl->pager);
+    cur->ahead_count = 0;
+    descend_snapshot(tbl, key, cur);
+    skip_snapshot_leaves(cur);
+}
+
+uint64_t get_cursor_key(cursor* cur) {
+    if (cur->leaf != NULL) {
+        return *get_leaf_node_key(cur->leaf, cur->cell_num);
+    }
+    void* page = get_page(cur->table->pager, cur->page_num);
+    unpin_page(cur->table->pager, cur->page_num); // still pinned by the cursor itself
+    return *get_leaf_node_key(page, cur->cell_num);
+}
+
+void insert_and_split_leaf_node(cursor* cur, uint64_t key, const void* record, uint16_t record_length) {
+    /*
+        Create a new node and move half the cells over.
+        Insert the new value in one of the two nodes.
+        Update parent or create a new parent.
+    */
+    pager* pg = cur->table->pager;
+    STAT_START(started);
+    void* old_node = get_page(pg, cur->page_num);
+    uint64_t old_max = get_node_max_key(pg, old_node);
+    uint32_t new_page_num = get_unused_page_num(pg);
+    void* new_node = get_page(pg, new_page_num);
+    mark_page_dirty(pg, cur->page_num);
+    mark_page_dirty(pg, new_page_num);
+    init_leaf_node(new_node);
+    *get_leaf_node_next_leaf(new_node) = *get_leaf_node_next_leaf(old_node);
+    *get_leaf_node_next_leaf(old_node) = new_page_num;
+
+    /*
+        All existing cells plus the new one are divided between the old (left)
+        and new (right) nodes so that each side gets about half of the bytes.
+        The old node is rebuilt from a copy.
+    */
+    uint8_t copy[PAGE_SIZE];
+    memcpy(copy, old_node, PAGE_SIZE);
+
+    uint32_t old_num_cells = *get_leaf_node_cells_num(copy);
+    uint32_t total_cells = old_num_cells + 1;
+    uint32_t total_bytes = record_length + LEAF_NODE_SLOT_SIZE;
+    for (uint32_t i = 0; i < old_num_cells; i++) {
+        total_bytes += *get_leaf_node_record_length(copy, i) + LEAF_NODE_SLOT_SIZE;
+    }
+
+    *get_leaf_node_cells_num(old_node) = 0;
+    *get_leaf_node_content_start(old_node) = PAGE_USABLE_SIZE;
+    *get_leaf_node_fragmented(old_node) = 0;
+
+    uint32_t left_bytes = 0;
+    uint32_t left_cells = 0;
+    for (uint32_t i = 0; i < total_cells; i++) {
+        uint64_t cell_key;
+        const void* cell_record;
+        uint16_t cell_length;
+        if (i == cur->cell_num) {
+            cell_key = key;
+            cell_record = record;
+            cell_length = record_length;
+        } else {
+            uint32_t src = i < cur->cell_num ? i : i - 1;
+            cell_key = *get_leaf_node_key(copy, src);
+            cell_record = get_leaf_node_value(copy, src);
+            cell_length = *get_leaf_node_record_length(copy, src);
+        }
+
+        // Both sides keep at least one cell
+        bool to_left = left_cells == 0
+                    || (i < total_cells - 1 && left_bytes + cell_length + LEAF_NODE_SLOT_SIZE <= total_bytes / 2);
+        if (to_left && left_cells == i) {
+            leaf_node_insert_record(old_node, left_cells++, cell_key, cell_record, cell_length);
+            left_bytes += cell_length + LEAF_NODE_SLOT_SIZE;
+        } else {
+            leaf_node_insert_record(new_node, i - left_cells, cell_key, cell_record, cell_length);
+        }
+    }
+
+    if (is_node_root(old_node)) {
+        create_new_root(cur->table, new_page_num);
+    } else {
+        // The old key still routes to the old leaf, and the way there to its parent
+        btree_path path;
+        find_path(cur->table, old_max, &path);
+        uint32_t parent_page_num = path.pages[path.depth - 2];
+        uint64_t new_max = get_node_max_key(pg, old_node);
+        void* parent = get_page(pg, parent_page_num);
+        mark_page_dirty(pg, parent_page_num);
+
+        update_internal_node_key(parent, old_max, new_max);
+        unpin_page(pg, parent_page_num);
+        insert_internal_node(cur->table, &path, path.depth - 2, new_page_num);
+    }
+
+    unpin_page(pg, new_page_num);
+    unpin_page(pg, cur->page_num);
+    STAT_RECORD(pg, leaf_splits, started);
+}
+
+/// @brief Insert a serialized record at the cursor, splitting the leaf if it doesn't fit
+/// @param cur 
+/// @param key 
+/// @param record 
+/// @param record_length 
+void insert_leaf_record(cursor* cur, uint64_t key, const void* record, uint16_t record_length) {
+    void* node = get_page(cur->table->pager, cur->page_num);
+    if (leaf_node_free_space(node) < LEAF_NODE_SLOT_SIZE + record_length) {
+        unpin_page(cur->table->pager, cur->page_num);
+        insert_and_split_leaf_node(cur, key, record, record_length);
+        return;
+    }
+
+    mark_page_dirty(cur->table->pager, cur->page_num);
+    leaf_node_insert_record(node, cur->cell_num, key, record, record_length);
+    unpin_page(cur->table->pager, cur->page_num);
+}
+
+void insert_leaf_node(cursor* cur, uint64_t key, row* value) {
+    uint8_t record[ROW_SIZE];
+    uint16_t record_length = serialize_row(value, record);
+    insert_leaf_record(cur, key, record, record_length);
+}
+
+/*
+    Deleting.
+    Rows are removed from their leaf in place and sparse leaves are merged
+    into a sibling (see rebalancing below). A leaf that runs empty without a
+    sibling under its parent is taken out of the leaf chain and its parent,
+    and its page goes on the freelist; internal nodes left without children
+    follow it up the tree, and a root left with a single child is replaced
+    by that child.
+*/
+/// @brief The leaf just before the one at the end of the path, 0 if that one is the leftmost
+/// @param tbl 
+/// @param path 
+/// @return 
+uint32_t find_left_leaf(table* tbl, btree_path* path) {
+    pager* pg = tbl->pager;
+    for (int32_t level = path->depth - 2; level >= 0; level--) {
+        if (path->child_idx[level] == 0) {
+            continue;
+        }
+
+        void* node = get_page(pg, path->pages[level]);
+        uint32_t page_num = *get_internal_node_child(node, path->child_idx[level] - 1);
+        unpin_page(pg, path->pages[level]);
+
+        // Rightmost leaf of the left subtree
+        for (;;) {
+            node = get_page(pg, page_num);
+            if (get_node_type(node) == NODE_LEAF) {
+                unpin_page(pg, page_num);
+                return page_num;
+            }
+            uint32_t child_page_num = *get_internal_node_right_child(node);
+            unpin_page(pg, page_num);
+            page_num = child_page_num;
+        }
+    }
+    return 0;
+}
+
+void remove_internal_node_child(void* node, uint32_t child_idx) {
+    uint32_t num_keys = *get_internal_node_keys_count(node);
+    if (child_idx < num_keys) {
+        move_internal_node_cells(node, child_idx, node, child_idx + 1, num_keys - child_idx - 1);
+        *get_internal_node_keys_count(node) = num_keys - 1;
+    } else if (num_keys > 0) {
+        *get_internal_node_right_child(node) = *get_internal_node_cell(node, num_keys - 1);
+        *get_internal_node_keys_count(node) = num_keys - 1;
+    } else {
+        *get_internal_node_right_child(node) = INVALID_PAGE_NUM;
+    }
+}
+
+/// @brief While the root is an internal node with a single child, that child becomes the root
+/// @param tbl 
+void collapse_root(table* tbl) {
+    pager* pg = tbl->pager;
+    for (;;) {
+        uint32_t root_page_num = tbl->root_page_num;
+        void* root = get_page(pg, root_page_num);
+        bool single_child = get_node_type(root) == NODE_INTERNAL && *get_internal_node_keys_count(root) == 0;
+        uint32_t child_page_num = *get_internal_node_right_child(root);
+        unpin_page(pg, root_page_num);
+        if (!single_child) {
+            return;
+        }
+
+        void* child = get_page(pg, child_page_num);
+        mark_page_dirty(pg, child_page_num);
+        set_node_root(child, true);
+        unpin_page(pg, child_page_num);
+
+        set_root_page_num(tbl, child_page_num);
+        free_page(pg, root_page_num);
+    }
+}
+
+/// @brief Take an empty leaf out of the tree, key is any key that used to route to it
+/// @param tbl 
+/// @param key 
+void remove_empty_leaf(table* tbl, uint64_t key) {
+    pager* pg = tbl->pager;
+    btree_path path;
+    find_path(tbl, key, &path);
+
+    uint32_t leaf_page_num = path.pages[path.depth - 1];
+    uint32_t left_page_num = find_left_leaf(tbl, &path);
+    if (left_page_num != 0) {
+        void* leaf = get_page(pg, leaf_page_num);
+        void* left = get_page(pg, left_page_num);
+        mark_page_dirty(pg, left_page_num);
+        *get_leaf_node_next_leaf(left) = *get_leaf_node_next_leaf(leaf);
+        unpin_page(pg, left_page_num);
+        unpin_page(pg, leaf_page_num);
+    }
+
+    for (uint32_t level = path.depth - 1; level > 0; level--) {
+        uint32_t parent_page_num = path.pages[level - 1];
+        free_page(pg, path.pages[level]);
+
+        void* parent = get_page(pg, parent_page_num);
+        mark_page_dirty(pg, parent_page_num);
+        remove_internal_node_child(parent, path.child_idx[level - 1]);
+        bool parent_empty = *get_internal_node_right_child(parent) == INVALID_PAGE_NUM;
+        if (parent_empty && level == 1) {
+            // Every leaf is gone, the root starts over as an empty leaf
+            init_leaf_node(parent);
+            set_node_root(parent, true);
+        }
+        unpin_page(pg, parent_page_num);
+
+        if (!parent_empty) {
+            break;
+        }
+    }
+
+    collapse_root(tbl);
+}
+
+/// @brief Remove the row under the cursor
+/// @param cur 
+/// @return true if that left a non-root leaf under LEAF_NODE_MIN_USED
+bool delete_cursor_row(cursor* cur) {
+    pager* pg = cur->table->pager;
+    void* node = get_page(pg, cur->page_num);
+    mark_page_dirty(pg, cur->page_num);
+    leaf_node_remove_record(node, cur->cell_num);
+    bool underflow = leaf_node_used_space(node) < LEAF_NODE_MIN_USED && !is_node_root(node);
+    unpin_page(pg, cur->page_num);
+    return underflow;
+}
+
+/// @brief Overwrite the record under the cursor, in place when the new one fits in its leaf
+/// @param cur 
+/// @param record 
+/// @param length 
+void update_cursor_record(cursor* cur, const void* record, uint16_t length) {
+    pager* pg = cur->table->pager;
+    void* node = get_page(pg, cur->page_num);
+    mark_page_dirty(pg, cur->page_num);
+    uint64_t key = *get_leaf_node_key(node, cur->cell_num);
+    uint16_t old_length = *get_leaf_node_record_length(node, cur->cell_num);
+
+    if (length <= old_length) {
+        // Same spot, the tail the record no longer needs is fragmented space
+        memcpy(get_leaf_node_value(node, cur->cell_num), record, length);
+        *get_leaf_node_record_length(node, cur->cell_num) = length;
+        *get_leaf_node_fragmented(node) += old_length - length;
+        unpin_page(pg, cur->page_num);
+        return;
+    }
+
+    bool fits = leaf_node_free_space(node) + old_length >= length;
+    leaf_node_remove_record(node, cur->cell_num);
+    if (fits) {
+        leaf_node_insert_record(node, cur->cell_num, key, record, length);
+        unpin_page(pg, cur->page_num);
+        return;
+    }
+
+    // Grown past what the leaf has free, go through the insert path and split
+    unpin_page(pg, cur->page_num);
+    insert_leaf_record(cur, key, record, length);
+}
+
+void update_cursor_row(cursor* cur, row* value) {
+    uint8_t record[ROW_SIZE];
+    uint16_t length = serialize_row(value, record);
+    update_cursor_record(cur, record, length);
+}
+
+/*
+    Rebalancing after deletes.
+    A leaf using less than LEAF_NODE_MIN_USED bytes is merged with a sibling
+    under the same parent when both fit in one page, otherwise the two share
+    their cells evenly. Merges take an entry out of the parent, which is
+    rebalanced the same way by key count.
+*/
+/// @brief Make child s + 1 of node the survivor of a merge of children s and s + 1
+/// @param node 
+/// @param left_idx 
+/// @param left_page_num 
+void replace_internal_node_pair(void* node, uint32_t left_idx, uint32_t left_page_num) {
+    *get_internal_node_child(node, left_idx + 1) = left_page_num;
+    remove_internal_node_child(node, left_idx);
+}
+
+/// @brief Move every cell of right into left and drop right
+/// @param pg 
+/// @param parent 
+/// @param left_idx 
+void merge_leaf_nodes(pager* pg, void* parent, uint32_t left_idx) {
+    uint32_t left_page_num = *get_internal_node_child(parent, left_idx);
+    uint32_t right_page_num = *get_internal_node_child(parent, left_idx + 1);
+    void* left = get_page(pg, left_page_num);
+    void* right = get_page(pg, right_page_num);
+    mark_page_dirty(pg, left_page_num);
+
+    uint32_t right_cells = *get_leaf_node_cells_num(right);
+    for (uint32_t i = 0; i < right_cells; i++) {
+        leaf_node_insert_record(left, *get_leaf_node_cells_num(left), *get_leaf_node_key(right, i),
+                                get_leaf_node_value(right, i), *get_leaf_node_record_length(right, i));
+    }
+    *get_leaf_node_next_leaf(left) = *get_leaf_node_next_leaf(right);
+
+    unpin_page(pg, right_page_num);
+    unpin_page(pg, left_page_num);
+    replace_internal_node_pair(parent, left_idx, left_page_num);
+    free_page(pg, right_page_num);
+}
+
+/// @brief Spread the cells of two neighbouring leaves so each holds about half of the bytes
+/// @param pg 
+/// @param parent 
+/// @param left_idx 
+void redistribute_leaf_nodes(pager* pg, void* parent, uint32_t left_idx) {
+    uint32_t left_page_num = *get_internal_node_child(parent, left_idx);
+    uint32_t right_page_num = *get_internal_node_child(parent, left_idx + 1);
+    void* left = get_page(pg, left_page_num);
+    void* right = get_page(pg, right_page_num);
+    mark_page_dirty(pg, left_page_num);
+    mark_page_dirty(pg, right_page_num);
+    uint64_t old_left_max = get_node_max_key(pg, left);
+
+    uint32_t total_bytes = leaf_node_used_space(left) + leaf_node_used_space(right);
+    while (leaf_node_used_space(left) < total_bytes / 2) {
+        // Pull the first cell of the right leaf over, unless that overshoots the middle
+        uint32_t cell_bytes = *get_leaf_node_record_length(right, 0) + LEAF_NODE_SLOT_SIZE;
+        if (leaf_node_used_space(left) + cell_bytes > total_bytes / 2 + cell_bytes / 2
+            || *get_leaf_node_cells_num(right) == 1) {
+            break;
+        }
+        leaf_node_insert_record(left, *get_leaf_node_cells_num(left), *get_leaf_node_key(right, 0),
+                                get_leaf_node_value(right, 0), *get_leaf_node_record_length(right, 0));
+        leaf_node_remove_record(right, 0);
+    }
+    while (leaf_node_used_space(right) < total_bytes / 2) {
+        uint32_t last = *get_leaf_node_cells_num(left) - 1;
+        uint32_t cell_bytes = *get_leaf_node_record_length(left, last) + LEAF_NODE_SLOT_SIZE;
+        if (leaf_node_used_space(right) + cell_bytes > total_bytes / 2 + cell_bytes / 2 || last == 0) {
+            break;
+        }
+        leaf_node_insert_record(right, 0, *get_leaf_node_key(left, last),
+                                get_leaf_node_value(left, last), *get_leaf_node_record_length(left, last));
+        leaf_node_remove_record(left, last);
+    }
+
+    update_internal_node_key(parent, old_left_max, get_node_max_key(pg, left));
+    unpin_page(pg, right_page_num);
+    unpin_page(pg, left_page_num);
+}
+
+/// @brief Fix up the internal node at path level after it lost a child
+/// @param tbl 
+/// @param path 
+/// @param level 
+void rebalance_internal_node(table* tbl, btree_path* path, uint32_t level) {
+    pager* pg = tbl->pager;
+    if (level == 0) {
+        collapse_root(tbl);
+        return;
+    }
+
+    uint32_t page_num = path->pages[level];
+    void* node = get_page(pg, page_num);
+    uint32_t num_keys = *get_internal_node_keys_count(node);
+    unpin_page(pg, page_num);
+    if (num_keys >= INTERNAL_NODE_MIN_KEYS) {
+        return;
+    }
+
+    uint32_t parent_page_num = path->pages[level - 1];
+    void* parent = get_page(pg, parent_page_num);
+    uint32_t parent_keys = *get_internal_node_keys_count(parent);
+    if (parent_keys == 0) {
+        // No sibling to work with under this parent, fix the parent first
+        unpin_page(pg, parent_page_num);
+        rebalance_internal_node(tbl, path, level - 1);
+        return;
+    }
+
+    mark_page_dirty(pg, parent_page_num);
+    uint32_t idx = path->child_idx[level - 1];
+    uint32_t left_idx = idx < parent_keys ? idx : idx - 1;
+    uint32_t left_page_num = *get_internal_node_child(parent, left_idx);
+    uint32_t right_page_num = *get_internal_node_child(parent, left_idx + 1);
+    uint64_t* separator = get_internal_node_key(parent, left_idx);
+    void* left = get_page(pg, left_page_num);
+    void* right = get_page(pg, right_page_num);
+    mark_page_dirty(pg, left_page_num);
+    mark_page_dirty(pg, right_page_num);
+    uint32_t left_keys = *get_internal_node_keys_count(left);
+    uint32_t right_keys = *get_internal_node_keys_count(right);
+
+    bool merged = false;
+    if (left_keys + right_keys + 1 <= INTERNAL_NODE_CELL_MAX_SIZE) {
+        // Left takes its old right child under the separator, then all of right
+        *get_internal_node_cell(left, left_keys) = *get_internal_node_right_child(left);
+        *get_internal_node_key(left, left_keys) = *separator;
+        move_internal_node_cells(left, left_keys + 1, right, 0, right_keys);
+        *get_internal_node_keys_count(left) = left_keys + 1 + right_keys;
+        *get_internal_node_right_child(left) = *get_internal_node_right_child(right);
+
+        replace_internal_node_pair(parent, left_idx, left_page_num);
+        merged = true;
+    } else if (left_keys < right_keys) {
+        // Rotate the first child of right through the separator into left
+        uint32_t moved_page_num = *get_internal_node_child(right, 0);
+        *get_internal_node_cell(left, left_keys) = *get_internal_node_right_child(left);
+        *get_internal_node_key(left, left_keys) = *separator;
+        *get_internal_node_keys_count(left) = left_keys + 1;
+        *get_internal_node_right_child(left) = moved_page_num;
+        *separator = *get_internal_node_key(right, 0);
+        remove_internal_node_child(right, 0);
+    } else {
+        // Rotate the last child of left through the separator into right
+        move_internal_node_cells(right, 1, right, 0, right_keys);
+        *get_internal_node_cell(right, 0) = *get_internal_node_right_child(left);
+        *get_internal_node_key(right, 0) = *separator;
+        *get_internal_node_keys_count(right) = right_keys + 1;
+        *separator = *get_internal_node_key(left, left_keys - 1);
+        *get_internal_node_right_child(left) = *get_internal_node_cell(left, left_keys - 1);
+        *get_internal_node_keys_count(left) = left_keys - 1;
+    }
+
+    unpin_page(pg, right_page_num);
+    unpin_page(pg, left_page_num);
+    unpin_page(pg, parent_page_num);
+
+    if (merged) {
+        free_page(pg, right_page_num);
+        rebalance_internal_node(tbl, path, level - 1);
+    }
+}
+
+/// @brief Merge or redistribute the leaf holding key if it dropped under LEAF_NODE_MIN_USED
+/// @param tbl 
+/// @param key any key that routes to the leaf
+void rebalance_leaf_node(table* tbl, uint64_t key) {
+    pager* pg = tbl->pager;
+    btree_path path;
+    find_path(tbl, key, &path);
+    if (path.depth < 2) {
+        return;
+    }
+
+    uint32_t leaf_page_num = path.pages[path.depth - 1];
+    void* leaf = get_page(pg, leaf_page_num);
+    uint32_t used = leaf_node_used_space(leaf);
+    unpin_page(pg, leaf_page_num);
+    if (used >= LEAF_NODE_MIN_USED) {
+        return;
+    }
+
+    uint32_t parent_page_num = path.pages[path.depth - 2];
+    void* parent = get_page(pg, parent_page_num);
+    uint32_t parent_keys = *get_internal_node_keys_count(parent);
+    if (parent_keys == 0) {
+        // Only child of its parent, nothing to merge with
+        unpin_page(pg, parent_page_num);
+        if (used == 0) {
+            remove_empty_leaf(tbl, key);
+        }
+        return;
+    }
+
+    mark_page_dirty(pg, parent_page_num);
+    uint32_t idx = path.child_idx[path.depth - 2];
+    uint32_t left_idx = idx < parent_keys ? idx : idx - 1;
+    void* left = get_page(pg, *get_internal_node_child(parent, left_idx));
+    void* right = get_page(pg, *get_internal_node_child(parent, left_idx + 1));
+    bool fits = leaf_node_used_space(left) + leaf_node_used_space(right) <= LEAF_NODE_SPACE_FOR_CELLS;
+    unpin_page(pg, *get_internal_node_child(parent, left_idx + 1));
+    unpin_page(pg, *get_internal_node_child(parent, left_idx));
+
+    if (fits) {
+        merge_leaf_nodes(pg, parent, left_idx);
+    } else {
+        redistribute_leaf_nodes(pg, parent, left_idx);
+    }
+    unpin_page(pg, parent_page_num);
+
+    if (fits) {
+        rebalance_internal_node(tbl, &path, path.depth - 2);
+    }
+}
+
+void indent(uint32_t level) {
+    for (uint32_t i = 0; i < level; ++i) {
+        printf("  ");
+    }
+}
+
+void print_tree(pager* pg, uint32_t page_num, uint32_t indent_level) {
+    void* node = get_page(pg, page_num);
+    uint32_t num_keys, child;
+
+    switch (get_node_type(node)) {
+        case NODE_LEAF:
+            num_keys = *get_leaf_node_cells_num(node);
+            indent(indent_level);
+            printf("- leaf (size %d)\n", num_keys);
+            for (uint32_t i = 0; i < num_keys; i++) {
+                indent(indent_level + 1);
+                printf("- %llu\n", (unsigned long long)*get_leaf_node_key(node, i));
+            }
+            break;
+        case NODE_INTERNAL:
+            num_keys = *get_internal_node_keys_count(node);
+            indent(indent_level);
+            printf("- internal (size %d)\n", num_keys);
+            for (uint32_t i = 0; i < num_keys; i++) {
+                child = *get_internal_node_child(node, i);
+                print_tree(pg, child, indent_level + 1);
+
+                indent(indent_level + 1);
+                printf("- key %llu\n", (unsigned long long)*get_internal_node_key(node, i));
+            }
+
+            child = *get_internal_node_right_child(node);
+            if (child != INVALID_PAGE_NUM) {
+                print_tree(pg, child, indent_level + 1);
+            }
+            break;
+    }
+    unpin_page(pg, page_num);
+}
+
+
+typedef enum {
+    EXECUTE_SUCCESS,
+    EXECUTE_TATBLE_FULL,
+    EXECUTE_DUPICATE_KEY,
+    EXECUTE_TRANSACTION_OPEN,
+    EXECUTE_NO_TRANSACTION,
+    EXECUTE_TRANSACTION_FULL,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_TABLE_EXISTS,
+} execute_result;
+
+
+typedef enum {
+    PREPARE_SUCCESS,
+    PREPARE_FAIL,
+    PREPARE_SYNTAX_ERROR,
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_NEGATIVE_ID,
+    PREPARE_NO_SUCH_TABLE,
+    PREPARE_ROW_TOO_LARGE,
+} prepare_result;
+
+typedef enum {
+    STATEMENT_INSERT,
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_UPDATE,
+    STATEMENT_BEGIN,
+    STATEMENT_COMMIT,
+    STATEMENT_ROLLBACK,
+    STATEMENT_CREATE_INDEX,
+    STATEMENT_CREATE_TABLE,
+} statement_type;
+
+#define SELECT_NO_LIMIT UINT32_MAX
+
+/*
+    A '?' in a statement is a parameter. The parser records which field of
+    the statement each one fills, in order, and binding writes the value
+    straight into that field.
+*/
+typedef enum {
+    PARAM_ID,               // insert id
+    PARAM_USER_NAME,
+    PARAM_EMAIL,
+    PARAM_LOWER_ID,
+    PARAM_UPPER_ID,
+    PARAM_EQUAL_ID,         // where id = ?, both bounds
+    PARAM_VALUE,            // where user_name = ? or email = ?
+    PARAM_LIMIT,
+    PARAM_COLUMN,           // PARAM_COLUMN + i: column i of a row of a table made with create table
+} param_target;
+
+#define STATEMENT_MAX_PARAMS TABLE_MAX_COLUMNS
+
+typedef struct {
+    statement_type type;
+    row row_to_insert;
+    uint32_t lower_id;      // select, update or delete only rows with lower_id <= id <= upper_id
+    uint32_t upper_id;
+    uint32_t limit;
+    bool set_user_name;     // update: columns taken from row_to_insert
+    bool set_email;
+    uint32_t param_count;
+    param_target params[STATEMENT_MAX_PARAMS];
+    row* batch;             // insert (...), (...): the rows, NULL for a single row insert
+    uint32_t batch_count;
+    index_column column;    // create index on it, or select rows whose value in it is value; INDEX_COUNT if neither
+    char value[COLUMN_EMAIL_SIZE + 1];
+    table* table;           // the table named after into, from or update, users if none is
+    row_values* values;     // a table made with create table: the row to insert, or the columns an update sets
+    row_values* current;    // the same tables: the row being updated, or the one a select handed out
+    uint32_t set_columns;   // update on the same tables: bit i if it sets column i
+    uint8_t* records;       // insert (...), (...) on the same tables: length (2 bytes) and record of each row
+    schema* new_schema;     // create table
+} statement;
+
+pager* open_pager(const char* file_name, const tdb_config* cfg) {
+    pthread_once(&crc32c_once, init_crc32c);
+
+    int fd = open(file_name,
+                  O_RDWR | O_CREAT,     // Read/write mode | Create if not exist
+                  S_IWUSR | S_IRUSR    // User write permission | User read permission
+                 );
+    if (fd == -1) {
+        printf("Unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pager* pg = malloc(sizeof(pager));
+    store_open(&pg->store, fd, cfg->compress);
+
+    // Replays whatever a crash left in the log before the file is sized up
+    pg->wal = wal_open(file_name, &pg->store, cfg->wal_sync_window_ms);
+
+    off_t file_len = store_length(&pg->store);
+    pg->fd = fd;
+    pg->file_name = strdup(file_name);
+    pg->config = *cfg;
+    pg->config.compress = pg->store.compressed;    // a vacuum keeps the file's format
+    pg->file_length = file_len;
+    pg->num_pages = (file_len / PAGE_SIZE);
+
+    if (file_len % PAGE_SIZE != 0) {
+        printf("Db file is not a whole number of pages. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pg->mode = cfg->mode;
+    if (pg->mode == TDB_PAGER_MMAP && pg->store.compressed) {
+        printf("Compressed db files can't be mapped, using the buffer pool.\n");
+        pg->mode = TDB_PAGER_BUFFERED;
+    }
+    pg->access_hint = ACCESS_NORMAL;
+    pg->map = NULL;
+    pg->map_size = 0;
+    pg->mapped_pages = pg->num_pages;
+    pg->dirty_map = (page_bitmap){0};
+    pg->pending_map = (page_bitmap){0};
+    pg->latch_stripes = NULL;
+    pg->stripes_held = NULL;
+    pg->verified_bits = NULL;
+    pg->verified_pages = 0;
+    pthread_mutex_init(&pg->verify_lock, NULL);
+    pg->pending_pages = NULL;
+    pg->pending_count = 0;
+    pg->pending_capacity = 0;
+    pg->in_transaction = false;
+    pg->write_back_next = 0;
+
+    pthread_mutex_init(&pg->versions_lock, NULL);
+    memset(pg->version_buckets, 0, sizeof(pg->version_buckets));
+    pg->spare_versions = NULL;
+    pg->spare_count = 0;
+    pg->version_count = 0;
+    pg->commit_seq = 0;
+    pg->snapshots = NULL;
+    pg->snapshot_count = 0;
+    pg->snapshot_capacity = 0;
+
+    if (pg->mode == TDB_PAGER_MMAP) {
+#ifdef _WIN32
+        printf("mmap pager is not available on this platform, using the buffer pool.\n");
+        pg->mode = TDB_PAGER_BUFFERED;
+#else
+        /*
+            MAP_PRIVATE: modified pages stay in this process until page_flush
+            writes them out, so the file changes at the same points as with
+            the buffer pool.
+        */
+        pg->map_size = MMAP_WINDOW_SIZE;
+        pg->map = mmap(NULL, pg->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+        if (pg->map == MAP_FAILED) {
+            printf("Unable to map db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        pg->latch_stripes = malloc(MMAP_LATCH_STRIPES * sizeof(pthread_rwlock_t));
+        pg->stripes_held = calloc(MMAP_LATCH_STRIPES, sizeof(bool));
+        for (uint32_t i = 0; i < MMAP_LATCH_STRIPES; i++) {
+            init_latch(&pg->latch_stripes[i]);
+        }
+        pg->verified_pages = pg->num_pages;
+        pg->verified_bits = calloc(pg->num_pages / 8 + 1, 1);
+#endif
+    }
+
+    pg->frame_count = cfg->pool_frames < MIN_POOL_FRAMES ? MIN_POOL_FRAMES : cfg->pool_frames;
+    if (pg->mode == TDB_PAGER_MMAP) {
+        // Nothing is cached in frames, the kernel page cache does that job
+        pg->frame_count = 1;
+    }
+    pg->frames_used = 0;
+    pg->clock_hand = 0;
+    pg->frames = malloc(pg->frame_count * sizeof(frame));
+    void* pool_memory = malloc((size_t)pg->frame_count * PAGE_SIZE);
+    for (uint32_t i = 0; i < pg->frame_count; i++) {
+        pg->frames[i].page_num = INVALID_PAGE_NUM;
+        pg->frames[i].pin_count = 0;
+        pg->frames[i].dirty = false;
+        pg->frames[i].pending = false;
+        pg->frames[i].referenced = false;
+        pg->frames[i].hash_next = NO_FRAME;
+        pg->frames[i].data = pool_memory + (size_t)i * PAGE_SIZE;
+        init_latch(&pg->frames[i].latch);
+    }
+    pthread_rwlock_init(&pg->pool_lock, NULL);
+
+    // Keep buckets at least twice the frame count so chains stay short
+    uint32_t bucket_count = 1;
+    while (bucket_count < 2 * pg->frame_count) {
+        bucket_count <<= 1;
+    }
+    pg->bucket_mask = bucket_count - 1;
+    pg->buckets = malloc(bucket_count * sizeof(int32_t));
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        pg->buckets[i] = NO_FRAME;
+    }
+
+    pg->stats = (pool_stats){0};
+    pg->ops = (op_stats){0};
+    pg->committed_pages = pg->num_pages;
+    
+    return pg;
+}
+
+void page_flush(pager* pager, uint32_t page_num) {
+    STAT_START(started);
+    // Write-ahead: the log has to be on disk before any page it covers
+    if (pager->wal->unsynced) {
+        wal_sync(pager->wal);
+    }
+
+    void* data;
+    int32_t idx = NO_FRAME;
+    if (pager->mode == TDB_PAGER_MMAP) {
+        data = pager->map + (size_t)page_num * PAGE_SIZE;
+    } else {
+        idx = pool_lookup(pager, page_num);
+        if (idx == NO_FRAME) {
+            printf("Attempted to flush page %d which is not resident\n", page_num);
+            exit(EXIT_FAILURE);
+        }
+        data = pager->frames[idx].data;
+    }
+
+    if (!store_write(&pager->store, page_num, data)) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    pager->stats.writes++;
+
+    if (pager->mode == TDB_PAGER_MMAP) {
+        bitmap_set(&pager->dirty_map, page_num, false);
+        STAT_RECORD(pager, page_flushes, started);
+        return;
+    }
+
+    pager->frames[idx].dirty = false;
+    if ((page_num + 1) * PAGE_SIZE > pager->file_length) {
+        pager->file_length = (page_num + 1) * PAGE_SIZE;
+    }
+    STAT_RECORD(pager, page_flushes, started);
+}
+
+void free_pager(pager* pg) {
+#ifndef _WIN32
+    if (pg->map != NULL) {
+        munmap(pg->map, pg->map_size);
+    }
+#endif
+    if (pg->latch_stripes != NULL) {
+        for (uint32_t i = 0; i < MMAP_LATCH_STRIPES; i++) {
+            pthread_rwlock_destroy(&pg->latch_stripes[i]);
+        }
+    }
+    for (uint32_t i = 0; i < pg->frame_count; i++) {
+        pthread_rwlock_destroy(&pg->frames[i].latch);
+    }
+    pthread_rwlock_destroy(&pg->pool_lock);
+
+    for (uint32_t i = 0; i < VERSION_BUCKETS; i++) {
+        for (page_version* head = pg->version_buckets[i]; head != NULL;) {
+            page_version* next = head->next;
+            for (page_version* v = head; v != NULL;) {
+                page_version* older = v->older;
+                free(v);
+                v = older;
+            }
+            head = next;
+        }
+    }
+    while (pg->spare_versions != NULL) {
+        page_version* next = pg->spare_versions->next;
+        free(pg->spare_versions);
+        pg->spare_versions = next;
+    }
+    pthread_mutex_destroy(&pg->versions_lock);
+    free(pg->snapshots);
+    free(pg->latch_stripes);
+    free(pg->stripes_held);
+    free(pg->verified_bits);
+    pthread_mutex_destroy(&pg->verify_lock);
+    free(pg->dirty_map.bits);
+    free(pg->pending_map.bits);
+    free(pg->pending_pages);
+    free(pg->frames[0].data); // start of the pool memory block
+    free(pg->frames);
+    free(pg->buckets);
+    free(pg->file_name);
+    free_store(&pg->store);
+    free(pg);
+}
+
+void* get_resident_page(pager* pg, uint32_t page_num) {
+    if (pg->mode == TDB_PAGER_MMAP) {
+        return pg->map + (size_t)page_num * PAGE_SIZE;
+    }
+    return pg->frames[pool_lookup(pg, page_num)].data;
+}
+
+void write_wal_batch(wal* w, uint32_t frames) {
+    off_t offset = WAL_HEADER_SIZE + (off_t)w->frame_count * WAL_FRAME_SIZE;
+    size_t len = (size_t)frames * WAL_FRAME_SIZE;
+    if (lseek(w->fd, offset, SEEK_SET) == -1 || write(w->fd, w->batch, len) != (ssize_t)len) {
+        printf("Error writing WAL: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    w->frame_count += frames;
+    w->stats.frames += frames;
+}
+
+void pager_checkpoint(pager* pg);
+
+/// @brief Pages a long write may leave uncommitted before it commits part of its work.
+///        Uncommitted pages can't be evicted, so this stays well under the pool.
+/// @param pg 
+/// @return 
+uint32_t pager_commit_threshold(pager* pg) {
+    return pg->mode == TDB_PAGER_MMAP ? MMAP_GROW_PAGES : pg->frame_count / 2;
+}
+
+/// @brief Whether an open transaction has changed as many pages as the buffer pool
+///        can keep, it takes no more changes until it is committed or rolled back
+/// @param pg 
+/// @return 
+bool pager_transaction_full(pager* pg) {
+    return pg->in_transaction && pg->mode == TDB_PAGER_BUFFERED && pg->pending_count >= pager_commit_threshold(pg);
+}
+
+/// @brief Make the pages of a committed statement evictable and hand them back to readers
+/// @param pg 
+void release_pending_pages(pager* pg) {
+    if (pg->mode == TDB_PAGER_MMAP) {
+        for (uint32_t i = 0; i < pg->pending_count; i++) {
+            bitmap_set(&pg->pending_map, pg->pending_pages[i], false);
+        }
+        for (uint32_t i = 0; i < MMAP_LATCH_STRIPES; i++) {
+            if (pg->stripes_held[i]) {
+                pthread_rwlock_unlock(&pg->latch_stripes[i]);
+                pg->stripes_held[i] = false;
+            }
+        }
+    } else {
+        pthread_rwlock_wrlock(&pg->pool_lock);
+        for (uint32_t i = 0; i < pg->pending_count; i++) {
+            frame* fr = &pg->frames[pool_lookup(pg, pg->pending_pages[i])];
+            fr->pending = false;
+            pthread_rwlock_unlock(&fr->latch);
+        }
+        pthread_rwlock_unlock(&pg->pool_lock);
+    }
+}
+
+/// @brief Append the page images modified by the current statement to the WAL.
+///        The last frame carries the db size and marks the commit. fsync is
+///        skipped while the previous one is younger than the group commit window.
+/// @param pg 
+void pager_commit(pager* pg) {
+    if (pg->pending_count == 0) {
+        return;
+    }
+
+    wal* w = pg->wal;
+    uint32_t batched = 0;
+    pthread_rwlock_rdlock(&pg->pool_lock);
+    for (uint32_t i = 0; i < pg->pending_count; i++) {
+        uint32_t page_num = pg->pending_pages[i];
+        uint8_t* slot = (uint8_t*)w->batch + (size_t)batched * WAL_FRAME_SIZE;
+        uint32_t* frame_header = (uint32_t*)slot;
+        void* image = slot + WAL_FRAME_HEADER_SIZE;
+
+        // Still write latched, readers use the saved version
+        void* page = get_resident_page(pg, page_num);
+        stamp_page_checksum(page);
+        memcpy(image, page, PAGE_SIZE);
+        frame_header[0] = page_num;
+        frame_header[1] = i == pg->pending_count - 1 ? pg->num_pages : 0;
+        frame_header[2] = w->salt;
+        w->checksum = checksum_words(checksum_words(w->checksum, frame_header, 8), image, PAGE_SIZE);
+        frame_header[3] = w->checksum;
+
+        if (++batched == WAL_WRITE_BATCH_FRAMES) {
+            write_wal_batch(w, batched);
+            batched = 0;
+        }
+    }
+    if (batched > 0) {
+        write_wal_batch(w, batched);
+    }
+
+    w->unsynced = true;
+    w->stats.commits++;
+
+    if (now_ms() - w->last_sync_ms >= w->sync_window_ms) {
+        wal_sync(w);
+    }
+    pthread_rwlock_unlock(&pg->pool_lock);
+
+    release_pending_pages(pg);
+    commit_page_versions(pg);
+    pg->pending_count = 0;
+    pg->committed_pages = pg->num_pages;
+
+    if (w->frame_count >= WAL_AUTOCHECKPOINT_FRAMES) {
+        pager_checkpoint(pg);
+    }
+}
+
+/// @brief Undo every change since the last commit. None of them reached the WAL
+///        or the db file, the images saved for the snapshots are put back.
+/// @param pg 
+void pager_rollback(pager* pg) {
+    pthread_rwlock_rdlock(&pg->pool_lock);
+    pthread_mutex_lock(&pg->versions_lock);
+    for (uint32_t i = 0; i < pg->pending_count; i++) {
+        uint32_t page_num = pg->pending_pages[i];
+        page_version** link = version_chain(pg, page_num);
+        page_version* v = *link;    // saved on the page's first change, it is still latched
+
+        memcpy(get_resident_page(pg, page_num), v->data, PAGE_SIZE);
+        if (v->older != NULL) {
+            v->older->next = v->next;
+            *link = v->older;
+        } else {
+            *link = v->next;
+        }
+        drop_page_version(pg, v);
+    }
+    pthread_mutex_unlock(&pg->versions_lock);
+    pthread_rwlock_unlock(&pg->pool_lock);
+
+    release_pending_pages(pg);
+
+    // Pages the changes added past the end of the file are unused again
+    if (pg->mode == TDB_PAGER_MMAP) {
+        for (uint32_t page_num = pg->committed_pages; page_num < pg->num_pages; page_num++) {
+            bitmap_set(&pg->dirty_map, page_num, false);
+        }
+    } else {
+        pthread_rwlock_wrlock(&pg->pool_lock);
+        for (uint32_t i = 0; i < pg->pending_count; i++) {
+            if (pg->pending_pages[i] < pg->committed_pages) {
+                continue;
+            }
+            int32_t idx = pool_lookup(pg, pg->pending_pages[i]);
+            pool_hash_remove(pg, idx);
+            pg->frames[idx].page_num = INVALID_PAGE_NUM;
+            pg->frames[idx].dirty = false;
+        }
+        pthread_rwlock_unlock(&pg->pool_lock);
+    }
+    pg->num_pages = pg->committed_pages;
+    pg->pending_count = 0;
+}
+
+/// @brief Sync the db file and start a new log, once the file has every committed page
+/// @param pg 
+void finish_checkpoint(pager* pg) {
+    if (!store_sync(&pg->store)) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    wal_reset(pg->wal);
+    pg->wal->stats.checkpoints++;
+}
+
+/// @brief Copy the committed dirty pages into the db file and start a new log.
+///        Clean pages are never rewritten.
+/// @param pg 
+void pager_checkpoint(pager* pg) {
+    pthread_rwlock_wrlock(&pg->pool_lock);
+    if (pg->mode == TDB_PAGER_MMAP) {
+        for (uint32_t i = 0; i < pg->num_pages; i++) {
+            if (bitmap_test(&pg->dirty_map, i)) {
+                page_flush(pg, i);
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < pg->frames_used; i++) {
+            frame* fr = &pg->frames[i];
+            if (fr->page_num == INVALID_PAGE_NUM || !fr->dirty) {
+                continue;
+            }
+            page_flush(pg, fr->page_num);
+        }
+    }
+
+    finish_checkpoint(pg);
+    pthread_rwlock_unlock(&pg->pool_lock);
+}
+
+/*
+    Background checkpoints.
+    With tdb_config.checkpoint_interval_ms set, a thread of the connection
+    wakes up that often and writes back up to checkpoint_pages committed
+    dirty pages. It sweeps the file in page number order, picking up where
+    the last run stopped and starting over past the end, and pages that
+    follow each other go out in one write. Once no committed page is left
+    dirty and no transaction has pages pending, it syncs the file and
+    starts a new log, as a checkpoint would. The db file then gets its
+    writes a few at a time rather than all at once at an autocheckpoint or
+    at close, and a crash leaves a short log to replay.
+*/
+int compare_page_nums(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/// @brief Write back committed dirty pages, the next ones of the sweep
+/// @param pg the writer's lock is held, so pages only change in a transaction's pending pages
+/// @param max_pages 
+/// @return the pages written
+uint32_t pager_write_back(pager* pg, uint32_t max_pages) {
+    pthread_rwlock_wrlock(&pg->pool_lock);
+    uint32_t count = 0;
+    uint32_t* pages;
+    if (pg->mode == TDB_PAGER_MMAP) {
+        pages = malloc((pg->num_pages + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < pg->num_pages; i++) {
+            if (bitmap_test(&pg->dirty_map, i) && !bitmap_test(&pg->pending_map, i)) {
+                pages[count++] = i;
+            }
+        }
+    } else {
+        pages = malloc(pg->frame_count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < pg->frames_used; i++) {
+            frame* fr = &pg->frames[i];
+            if (fr->page_num != INVALID_PAGE_NUM && fr->dirty && !fr->pending) {
+                pages[count++] = fr->page_num;
+            }
+        }
+        qsort(pages, count, sizeof(uint32_t), compare_page_nums);
+    }
+
+    uint32_t start = 0;
+    while (start < count && pages[start] < pg->write_back_next) {
+        start++;
+    }
+    if (start == count) {
+        start = 0;
+    }
+    uint32_t end = count - start < max_pages ? count : start + max_pages;
+
+    // Write-ahead: the log has to be on disk before any page it covers
+    if (start < end && pg->wal->unsynced) {
+        wal_sync(pg->wal);
+    }
+    for (uint32_t i = start; i < end;) {
+        void* run[STORE_RUN_PAGES];
+        uint32_t first = pages[i];
+        uint32_t run_count = 0;
+        while (i < end && run_count < STORE_RUN_PAGES && pages[i] == first + run_count) {
+            run[run_count++] = get_resident_page(pg, pages[i++]);
+        }
+        if (!store_write_run(&pg->store, first, run, run_count)) {
+            printf("Error writing: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        for (uint32_t j = 0; j < run_count; j++) {
+            if (pg->mode == TDB_PAGER_MMAP) {
+                bitmap_set(&pg->dirty_map, first + j, false);
+            } else {
+                pg->frames[pool_lookup(pg, first + j)].dirty = false;
+            }
+        }
+        if (pg->mode == TDB_PAGER_BUFFERED && (first + run_count) * PAGE_SIZE > pg->file_length) {
+            pg->file_length = (first + run_count) * PAGE_SIZE;
+        }
+    }
+
+    uint32_t written = end - start;
+    pg->stats.writes += written;
+    pg->stats.background_writes += written;
+    if (written > 0) {
+        pg->write_back_next = pages[end - 1] + 1;
+    }
+    // A pending page's committed image may be in the log only
+    if (written == count && pg->pending_count == 0 && pg->wal->frame_count > 0) {
+        finish_checkpoint(pg);
+    }
+    pthread_rwlock_unlock(&pg->pool_lock);
+    free(pages);
+    return written;
+}
+
+
+/*
+    Catalog.
+    `create table pets (id int, name text(20), age int)` adds a table beside
+    users. The catalog is a B-tree of the schemas of these tables, keyed by
+    table number from 1, and like the indexes, the catalog and each table
+    have a root slot in the header. All of them share the pager, and with it
+    the buffer pool and the WAL. A catalog record holds:
+
+        name length (1 byte) | name | column count (1 byte), then per column
+        type (1 byte) | size (1 byte) | name length (1 byte) | name
+*/
+#define CATALOG_RECORD_MAX_SIZE (uint32_t)(2 + TABLE_NAME_SIZE + TABLE_MAX_COLUMNS * (3 + TABLE_NAME_SIZE))
+
+uint8_t* serialize_name(const char* name, uint8_t* des) {
+    uint8_t length = strlen(name);
+    *des++ = length;
+    memcpy(des, name, length);
+    return des + length;
+}
+
+uint8_t* deserialize_name(uint8_t* src, char* name) {
+    uint8_t length = *src++;
+    memcpy(name, src, length);
+    name[length] = '\0';
+    return src + length;
+}
+
+uint16_t serialize_schema(schema* s, void* des) {
+    uint8_t* p = serialize_name(s->name, des);
+    *p++ = s->column_count;
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        *p++ = s->columns[i].type;
+        *p++ = s->columns[i].size;
+        p = serialize_name(s->columns[i].name, p);
+    }
+    return p - (uint8_t*)des;
+}
+
+void deserialize_schema(void* src, schema* s) {
+    uint8_t* p = deserialize_name(src, s->name);
+    s->column_count = *p++;
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        s->columns[i].type = *p++;
+        s->columns[i].size = *p++;
+        p = deserialize_name(p, s->columns[i].name);
+    }
+}
+
+/// @brief An empty leaf to root a new tree
+/// @param pg 
+/// @return its page number
+uint32_t create_root_leaf(pager* pg) {
+    uint32_t page_num = get_unused_page_num(pg);
+    void* root = get_page(pg, page_num);
+    mark_page_dirty(pg, page_num);
+    init_leaf_node(root);
+    set_node_root(root, true);
+    unpin_page(pg, page_num);
+    return page_num;
+}
+
+table* new_table(pager* pg, uint32_t number, schema* s) {
+    table* tbl = calloc(1, sizeof(table));
+    tbl->pager = pg;
+    tbl->root_offset = DB_HEADER_TABLE_ROOTS_OFFSET + (number - 1) * DB_HEADER_TABLE_ROOT_SIZE;
+    tbl->schema = malloc(sizeof(schema));
+    *tbl->schema = *s;
+    return tbl;
+}
+
+/// @brief The users table or a table made with create table, by name
+/// @param users 
+/// @param name 
+/// @return NULL if there is none
+table* find_table_by_name(table* users, const char* name) {
+    if (strcmp(name, USERS_SCHEMA.name) == 0) {
+        return users;
+    }
+    catalog* cat = users->catalog;
+    uint32_t count = __atomic_load_n(&cat->count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(cat->tables[i]->schema->name, name) == 0) {
+            return cat->tables[i];
+        }
+    }
+    return NULL;
+}
+
+/// @brief Make the tables of the catalog known. Tables already known keep their
+///        structs, so statements prepared on them stay valid across a vacuum.
+/// @param users 
+/// @param header 
+void load_catalog(table* users, void* header) {
+    catalog* cat = users->catalog;
+    for (uint32_t i = 0; i < cat->count; i++) {
+        cat->tables[i]->pager = users->pager;
+    }
+    if (cat->tree.root_page_num == 0) {
+        return;
+    }
+
+    cursor cur;
+    begin_table(&cat->tree, &cur);
+    while (!cur.end_of_table) {
+        uint32_t number = get_cursor_key(&cur);
+        if (number > cat->count) {
+            schema s;
+            deserialize_schema(get_cursor_value(&cur), &s);
+            table* tbl = new_table(users->pager, number, &s);
+            tbl->root_page_num = *get_header_root_slot(header, tbl);
+            cat->tables[number - 1] = tbl;
+            __atomic_store_n(&cat->count, number, __ATOMIC_RELEASE);
+        }
+        move_cursor_forward(&cur);
+    }
+    close_cursor(&cur);
+}
+
+/// @brief Add a table to the catalog with an empty tree
+/// @param users 
+/// @param s 
+/// @return 
+execute_result create_table(table* users, schema* s) {
+    catalog* cat = users->catalog;
+    pager* pg = users->pager;
+    if (pg->in_transaction) {
+        // A rollback would take back a table statements may already be prepared on
+        return EXECUTE_TRANSACTION_OPEN;
+    }
+    if (find_table_by_name(users, s->name) != NULL) {
+        return EXECUTE_TABLE_EXISTS;
+    }
+    if (cat->count == TABLE_MAX_COUNT) {
+        return EXECUTE_TATBLE_FULL;
+    }
+
+    if (cat->tree.root_page_num == 0) {
+        set_root_page_num(&cat->tree, create_root_leaf(pg));
+    }
+    uint32_t number = cat->count + 1;
+    uint8_t record[CATALOG_RECORD_MAX_SIZE];
+    uint16_t length = serialize_schema(s, record);
+    cursor cur;
+    find_table(&cat->tree, number, &cur);
+    insert_leaf_record(&cur, number, record, length);
+    close_cursor(&cur);
+
+    // Selects whose snapshot is older see a root slot of 0 and an empty table
+    table* tbl = new_table(pg, number, s);
+    set_root_page_num(tbl, create_root_leaf(pg));
+    cat->tables[number - 1] = tbl;
+    __atomic_store_n(&cat->count, number, __ATOMIC_RELEASE);
+    return EXECUTE_SUCCESS;
+}
+
+/// @brief Take the roots of every tree from the header
+/// @param tbl the users table
+/// @param header 
+void load_root_page_nums(table* tbl, void* header) {
+    tbl->root_page_num = *get_header_root_slot(header, tbl);
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        tbl->indexes[i]->root_page_num = *get_header_root_slot(header, tbl->indexes[i]);
+    }
+    catalog* cat = tbl->catalog;
+    cat->tree.root_page_num = *get_header_root_slot(header, &cat->tree);
+    for (uint32_t i = 0; i < cat->count; i++) {
+        cat->tables[i]->root_page_num = *get_header_root_slot(header, cat->tables[i]);
+    }
+}
+
+/// @brief Read the header of a freshly opened pager, writing one first if the file is new
+/// @param tbl 
+/// @param pager 
+void load_table(table* tbl, pager* pager) {
+    tbl->pager = pager;
+
+    if (pager->num_pages == 0) {
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        *get_header_magic(header) = DB_HEADER_MAGIC;
+        *get_header_page_size(header) = PAGE_SIZE;
+        *get_header_freelist_head(header) = 0;
+        *get_header_freelist_count(header) = 0;
+
+        *get_header_root_page(header) = create_root_leaf(pager);
+        unpin_page(pager, DB_HEADER_PAGE_NUM);
+        pager_commit(pager);
+    }
+
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    if (*get_header_magic(header) != DB_HEADER_MAGIC || *get_header_page_size(header) != PAGE_SIZE) {
+        printf("Not a database file, or written by an older version.\n");
+        exit(EXIT_FAILURE);
+    }
+    tbl->root_offset = DB_HEADER_ROOT_PAGE_OFFSET;
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        tbl->indexes[i]->pager = pager;
+        tbl->indexes[i]->root_offset = DB_HEADER_INDEX_ROOTS_OFFSET + i * DB_HEADER_INDEX_ROOT_SIZE;
+    }
+    tbl->catalog->tree.pager = pager;
+    tbl->catalog->tree.root_offset = DB_HEADER_CATALOG_ROOT_OFFSET;
+    load_root_page_nums(tbl, header);
+    load_catalog(tbl, header);
+    unpin_page(pager, DB_HEADER_PAGE_NUM);
+}
+
+table* open_db(const char* file_name, const tdb_config* cfg) {
+    table* tbl = calloc(1, sizeof(table));
+    tbl->schema = &USERS_SCHEMA;
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        tbl->indexes[i] = calloc(1, sizeof(table));
+    }
+    tbl->catalog = calloc(1, sizeof(catalog));
+    load_table(tbl, open_pager(file_name, cfg));
+    return tbl;
+}
+
+/// @brief Commit and checkpoint everything, then release the files and the pager
+/// @param pager 
+void close_pager(pager* pager) {
+    pager_commit(pager);
+    pager_checkpoint(pager);
+
+    if (pager->mode == TDB_PAGER_MMAP) {
+        // Give back the unused part of the last growth extent
+        if (ftruncate(pager->fd, (off_t)pager->num_pages * PAGE_SIZE) == -1) {
+            printf("Error truncating db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    wal_close(pager->wal);
+
+    int result = close(pager->fd);
+    if (result == -1) {
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free_pager(pager);
+}
+
+/// @brief Free the users table's struct with those of its indexes and the other tables
+/// @param tbl 
+void free_tables(table* tbl) {
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        free(tbl->indexes[i]);
+    }
+    catalog* cat = tbl->catalog;
+    for (uint32_t i = 0; i < cat->count; i++) {
+        free(cat->tables[i]->schema);
+        free(cat->tables[i]);
+    }
+    free(cat);
+    free(tbl);
+}
+
+void close_db(table* tbl) {
+    close_pager(tbl->pager);
+    free_tables(tbl);
+}
+
+void free_table(table* tbl) {
+    free_pager(tbl->pager);
+    free_tables(tbl);
+}
+
+/*
+    Secondary indexes.
+    `create index on user_name` (or email) builds a B-tree mapping the
+    column's values to ids, which every insert, update and delete then keeps
+    in step with the table. A key is a hash of the value in the high half and
+    the row's id in the low half, so the entries of a value sit side by side
+    in id order, as many as there are rows, and each one is reached in a
+    single descent. An entry's record holds the value itself, a lookup walks
+    the hash's range of keys and passes over values that merely hash alike.
+    Only equality is served.
+
+    The index gets its header slot once it is complete, a build that commits
+    part way leaves nothing half built behind for readers or after a crash,
+    though pages from a crashed build stay unused until a vacuum.
+*/
+const char* INDEX_COLUMN_NAMES[INDEX_COUNT] = { "user_name", "email" };
+
+const char* get_indexed_value(row* r, index_column column) {
+    return column == INDEX_USER_NAME ? r->user_name : r->email;
+}
+
+/// @brief Key of the entry for a row's value, id 0 gives the first key of the value's range
+/// @param value 
+/// @param id 
+/// @return 
+uint64_t index_key(const char* value, uint32_t id) {
+    return (uint64_t)crc32c(value, strlen(value)) << 32 | id;
+}
+
+bool table_has_indexes(table* tbl) {
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        if (tbl->indexes[i] != NULL && tbl->indexes[i]->root_page_num != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Index entry record: value length (1 byte) | value
+*/
+uint16_t serialize_index_entry(const char* value, uint8_t* des) {
+    uint8_t length = strlen(value);
+    des[0] = length;
+    memcpy(des + 1, value, length);
+    return 1 + length;
+}
+
+/// @brief Whether an entry is one for value, and not for another value with the same hash
+/// @param record 
+/// @param value 
+/// @return 
+bool index_entry_matches(void* record, const char* value) {
+    uint8_t* p = record;
+    return strlen(value) == p[0] && memcmp(p + 1, value, p[0]) == 0;
+}
+
+void insert_index_entry(table* idx, uint32_t id, const char* value) {
+    uint8_t record[ROW_SIZE];
+    uint16_t length = serialize_index_entry(value, record);
+    uint64_t key = index_key(value, id);
+    cursor cur;
+    find_table(idx, key, &cur);
+    insert_leaf_record(&cur, key, record, length);
+    close_cursor(&cur);
+}
+
+bool cursor_finds_key(cursor* cur, uint64_t key);
+
+/// @brief Remove the entry for id and value
+/// @param idx 
+/// @param id 
+/// @param value 
+void delete_index_entry(table* idx, uint32_t id, const char* value) {
+    uint64_t key = index_key(value, id);
+    cursor cur;
+    find_table(idx, key, &cur);
+    bool underflow = cursor_finds_key(&cur, key) && delete_cursor_row(&cur);
+    close_cursor(&cur);
+    if (underflow) {
+        rebalance_leaf_node(idx, key);
+    }
+}
+
+/// @brief Bring the indexes in line with a row that was inserted, updated or deleted.
+///        The pages it dirties count toward the row's share of the pool, statements
+///        that write many rows check pager_transaction_full or commit between rows.
+/// @param tbl 
+/// @param old the row as it was, NULL for an insert
+/// @param r the row as it is now, NULL for a delete
+void update_index_entries(table* tbl, row* old, row* r) {
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        table* idx = tbl->indexes[i];
+        if (idx->root_page_num == 0) {
+            continue;
+        }
+        if (old != NULL && r != NULL && strcmp(get_indexed_value(old, i), get_indexed_value(r, i)) == 0) {
+            continue;
+        }
+        if (old != NULL) {
+            delete_index_entry(idx, old->id, get_indexed_value(old, i));
+        }
+        if (r != NULL) {
+            insert_index_entry(idx, r->id, get_indexed_value(r, i));
+        }
+    }
+}
+
+/// @brief Add an entry for every row of the table to an empty index.
+///        A long fill commits part way, unless a transaction is open.
+/// @param tbl 
+/// @param column 
+/// @return EXECUTE_SUCCESS, or EXECUTE_TRANSACTION_FULL if it stopped short
+execute_result fill_index(table* tbl, index_column column) {
+    table* idx = tbl->indexes[column];
+    pager* pg = tbl->pager;
+    pager_set_access_hint(pg, ACCESS_NORMAL);
+
+    execute_result result = EXECUTE_SUCCESS;
+    cursor cur;
+    begin_table(tbl, &cur);
+    while (!cur.end_of_table) {
+        if (pager_transaction_full(pg)) {
+            result = EXECUTE_TRANSACTION_FULL;
+            break;
+        }
+        row r;
+        deserialize_row(get_cursor_value(&cur), &r);
+        insert_index_entry(idx, r.id, get_indexed_value(&r, column));
+        move_cursor_forward(&cur);
+
+        if (!pg->in_transaction && pg->pending_count >= pager_commit_threshold(pg) / 2) {
+            pager_commit(pg);
+        }
+    }
+    close_cursor(&cur);
+    return result;
+}
+
+/// @brief Give back every page of a tree
+/// @param pg 
+/// @param page_num its root
+void free_tree(pager* pg, uint32_t page_num) {
+    void* node = get_page(pg, page_num);
+    if (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t num_keys = *get_internal_node_keys_count(node);
+        for (uint32_t i = 0; i <= num_keys; i++) {
+            free_tree(pg, *get_internal_node_child(node, i));
+        }
+    }
+    unpin_page(pg, page_num);
+    free_page(pg, page_num);
+}
+
+/// @brief Build an index on column from the rows of the table
+/// @param tbl 
+/// @param column 
+/// @return 
+execute_result create_index(table* tbl, index_column column) {
+    table* idx = tbl->indexes[column];
+    if (idx->root_page_num != 0) {
+        return EXECUTE_INDEX_EXISTS;
+    }
+
+    pager* pg = tbl->pager;
+    uint32_t root_page_num = create_root_leaf(pg);
+
+    // Inserts never move a root, the header slot is only written once the index is whole
+    idx->root_page_num = root_page_num;
+    execute_result result = fill_index(tbl, column);
+    if (result != EXECUTE_SUCCESS) {
+        free_tree(pg, root_page_num);
+        idx->root_page_num = 0;
+        return result;
+    }
+    set_root_page_num(idx, root_page_num);
+    return EXECUTE_SUCCESS;
+}
+
+/*
+    Bulk loading.
+    `.import` sorts the input by id (spilling sorted runs to temp files when it
+    doesn't fit in IMPORT_SORT_MEMORY and merging them back), then writes the
+    tree bottom-up: leaves are packed to the fill factor and appended in key
+    order, and every level keeps one open node on its right edge that receives
+    the nodes finished below it.
+*/
+#define IMPORT_SORT_MEMORY      ((size_t)64 * 1024 * 1024)
+#define IMPORT_SORT_RUN_ROWS    (uint32_t)(IMPORT_SORT_MEMORY / sizeof(row))
+#define IMPORT_LINE_SIZE        2048
+
+typedef enum {
+    IMPORT_CSV,
+    IMPORT_BINARY,
+} import_format;
+
+typedef struct {
+    FILE* file;
+    row head;
+} sort_run;
+
+typedef struct {
+    row* rows;              // last run, kept in memory
+    uint32_t num_rows;
+    uint32_t next_row;
+    sort_run* runs;         // runs spilled to temp files
+    uint32_t num_runs;
+    uint32_t* heap;         // min-heap of run indexes by head id, the in-memory run is index num_runs
+    uint32_t heap_size;
+} sorted_rows;
+
+typedef struct {
+    uint32_t page_num;      // open node on the right edge, INVALID_PAGE_NUM if none
+    uint64_t max_key;
+    uint32_t nodes;         // nodes started on this level so far
+} build_level;
+
+typedef struct {
+    table* tbl;
+    uint32_t leaf_budget;       // bytes of a leaf filled before the next one is started
+    uint32_t spare_page_num;    // the empty root, reused as the first leaf
+    uint32_t commit_pages;
+    build_level levels[BTREE_MAX_DEPTH];
+    uint32_t num_levels;
+    uint64_t rows;
+    uint64_t duplicates;
+} tree_builder;
+
+int compare_row_ids(const void* a, const void* b) {
+    uint32_t id_a = ((const row*)a)->id;
+    uint32_t id_b = ((const row*)b)->id;
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+/// @brief Read the next row of the import file
+/// @param file 
+/// @param format 
+/// @param line_num number of the line or binary row read last
+/// @param des 
+/// @return 1 on success, 0 at end of file, -1 if the line was malformed
+int read_import_row(FILE* file, import_format format, uint32_t* line_num, row* des) {
+    if (format == IMPORT_BINARY) {
+        // Rows are stored as serialize_row writes them, one after another
+        uint8_t raw[ID_SIZE + 2 + 2 * UINT8_MAX];
+        uint8_t* p = raw;
+        if (fread(p, ID_SIZE + 1, 1, file) != 1) {
+            return 0;
+        }
+        p += ID_SIZE + 1;
+        uint8_t user_name_len = p[-1];
+        if (fread(p, user_name_len + 1, 1, file) != 1) {
+            return 0;
+        }
+        p += user_name_len + 1;
+        uint8_t email_len = p[-1];
+        if (email_len > 0 && fread(p, email_len, 1, file) != 1) {
+            return 0;
+        }
+
+        (*line_num)++;
+        if (user_name_len > COLUMN_USERNAME_SIZE) {
+            printf("Row %d: String is too long.\n", *line_num);
+            return -1;
+        }
+        deserialize_row(raw, des);
+        return 1;
+    }
+
+    char line[IMPORT_LINE_SIZE];
+    if (fgets(line, sizeof(line), file) == NULL) {
+        return 0;
+    }
+    (*line_num)++;
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char* id_str = strtok(line, ",");
+    char* user_name = strtok(NULL, ",");
+    char* email = strtok(NULL, ",");
+    if (id_str == NULL || user_name == NULL || email == NULL || strtok(NULL, ",") != NULL) {
+        printf("Line %d: expected id,user_name,email.\n", *line_num);
+        return -1;
+    }
+
+    char* end;
+    long id = strtol(id_str, &end, 10);
+    if (*end != '\0' || id < 0 || id > UINT32_MAX) {
+        printf("Line %d: ID must be a positive integer.\n", *line_num);
+        return -1;
+    }
+    if (strlen(user_name) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) {
+        printf("Line %d: String is too long.\n", *line_num);
+        return -1;
+    }
+
+    des->id = id;
+    strcpy(des->user_name, user_name);
+    strcpy(des->email, email);
+    return 1;
+}
+
+void spill_sort_run(sorted_rows* sorted) {
+    FILE* file = tmpfile();
+    if (file == NULL || fwrite(sorted->rows, sizeof(row), sorted->num_rows, file) != sorted->num_rows) {
+        printf("Error writing sort run: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    rewind(file);
+
+    sorted->runs = realloc(sorted->runs, (sorted->num_runs + 1) * sizeof(sort_run));
+    sort_run* run = &sorted->runs[sorted->num_runs++];
+    run->file = file;
+    fread(&run->head, sizeof(row), 1, file);
+    sorted->num_rows = 0;
+}
+
+row* sorted_run_head(sorted_rows* sorted, uint32_t run) {
+    if (run == sorted->num_runs) {
+        return &sorted->rows[sorted->next_row];
+    }
+    return &sorted->runs[run].head;
+}
+
+void sift_down_runs(sorted_rows* sorted, uint32_t idx) {
+    uint32_t* heap = sorted->heap;
+    for (;;) {
+        uint32_t smallest = idx;
+        uint32_t left = 2 * idx + 1;
+        uint32_t right = left + 1;
+        if (left < sorted->heap_size
+            && sorted_run_head(sorted, heap[left])->id < sorted_run_head(sorted, heap[smallest])->id) {
+            smallest = left;
+        }
+        if (right < sorted->heap_size
+            && sorted_run_head(sorted, heap[right])->id < sorted_run_head(sorted, heap[smallest])->id) {
+            smallest = right;
+        }
+        if (smallest == idx) {
+            return;
+        }
+        uint32_t tmp = heap[idx];
+        heap[idx] = heap[smallest];
+        heap[smallest] = tmp;
+        idx = smallest;
+    }
+}
+
+/// @brief Read the whole import file into sorted runs, returns the number of malformed lines
+/// @param file 
+/// @param format 
+/// @param sorted 
+/// @return 
+uint32_t sort_import_rows(FILE* file, import_format format, sorted_rows* sorted) {
+    uint32_t capacity = 1024;
+    uint32_t line_num = 0;
+    uint32_t malformed = 0;
+    *sorted = (sorted_rows){0};
+    sorted->rows = malloc(capacity * sizeof(row));
+
+    int status;
+    row r;
+    while ((status = read_import_row(file, format, &line_num, &r)) != 0) {
+        if (status < 0) {
+            malformed++;
+            continue;
+        }
+        if (sorted->num_rows == capacity) {
+            if (capacity < IMPORT_SORT_RUN_ROWS) {
+                capacity = capacity * 2 < IMPORT_SORT_RUN_ROWS ? capacity * 2 : IMPORT_SORT_RUN_ROWS;
+                sorted->rows = realloc(sorted->rows, capacity * sizeof(row));
+            } else {
+                qsort(sorted->rows, sorted->num_rows, sizeof(row), compare_row_ids);
+                spill_sort_run(sorted);
+            }
+        }
+        sorted->rows[sorted->num_rows++] = r;
+    }
+    qsort(sorted->rows, sorted->num_rows, sizeof(row), compare_row_ids);
+
+    sorted->heap = malloc((sorted->num_runs + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < sorted->num_runs; i++) {
+        sorted->heap[sorted->heap_size++] = i;
+    }
+    if (sorted->num_rows > 0) {
+        sorted->heap[sorted->heap_size++] = sorted->num_runs;
+    }
+    for (uint32_t i = sorted->heap_size / 2; i-- > 0;) {
+        sift_down_runs(sorted, i);
+    }
+    return malformed;
+}
+
+/// @brief Pop the row with the smallest id across all runs
+/// @param sorted 
+/// @param des 
+/// @return false once every run is drained
+bool next_sorted_row(sorted_rows* sorted, row* des) {
+    if (sorted->heap_size == 0) {
+        return false;
+    }
+
+    uint32_t run = sorted->heap[0];
+    *des = *sorted_run_head(sorted, run);
+
+    bool drained;
+    if (run == sorted->num_runs) {
+        drained = ++sorted->next_row == sorted->num_rows;
+    } else {
+        drained = fread(&sorted->runs[run].head, sizeof(row), 1, sorted->runs[run].file) != 1;
+    }
+    if (drained) {
+        sorted->heap[0] = sorted->heap[--sorted->heap_size];
+    }
+    sift_down_runs(sorted, 0);
+    return true;
+}
+
+void free_sorted_rows(sorted_rows* sorted) {
+    for (uint32_t i = 0; i < sorted->num_runs; i++) {
+        fclose(sorted->runs[i].file);
+    }
+    free(sorted->runs);
+    free(sorted->rows);
+    free(sorted->heap);
+}
+
+/// @brief Start a new node on the right edge of a level, it stays pinned until it is finished
+/// @param b 
+/// @param level 
+void builder_open_node(tree_builder* b, uint32_t level) {
+    pager* pg = b->tbl->pager;
+    uint32_t page_num = b->spare_page_num;
+    if (page_num == INVALID_PAGE_NUM) {
+        page_num = get_unused_page_num(pg);
+    } else {
+        b->spare_page_num = INVALID_PAGE_NUM;
+    }
+
+    void* node = get_page(pg, page_num);
+    mark_page_dirty(pg, page_num);
+    if (level == 0) {
+        init_leaf_node(node);
+    } else {
+        init_internal_node(node);
+    }
+    set_node_root(node, false);
+
+    build_level* lv = &b->levels[level];
+    lv->page_num = page_num;
+    lv->nodes++;
+    if (level >= b->num_levels) {
+        b->num_levels = level + 1;
+    }
+}
+
+void builder_finish_node(tree_builder* b, uint32_t level, uint32_t page_num, uint64_t max_key);
+
+/// @brief Hang a finished node under the open node of the level above it
+/// @param b 
+/// @param level level of the parent
+/// @param child_page_num 
+/// @param child_max_key 
+void builder_add_child(tree_builder* b, uint32_t level, uint32_t child_page_num, uint64_t child_max_key) {
+    pager* pg = b->tbl->pager;
+    build_level* lv = &b->levels[level];
+
+    if (level == BTREE_MAX_DEPTH) {
+        printf("Tree is too deep to bulk load.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (lv->page_num == INVALID_PAGE_NUM) {
+        builder_open_node(b, level);
+    } else {
+        void* node = get_page(pg, lv->page_num);
+        bool full = *get_internal_node_keys_count(node) == INTERNAL_NODE_CELL_MAX_SIZE;
+        unpin_page(pg, lv->page_num);
+        if (full) {
+            uint32_t full_page_num = lv->page_num;
+            builder_open_node(b, level);
+            builder_finish_node(b, level, full_page_num, lv->max_key);
+        }
+    }
+
+    void* node = get_page(pg, lv->page_num);
+    mark_page_dirty(pg, lv->page_num);
+    uint32_t right_child = *get_internal_node_right_child(node);
+    if (right_child != INVALID_PAGE_NUM) {
+        uint32_t num_keys = (*get_internal_node_keys_count(node))++;
+        *get_internal_node_cell(node, num_keys) = right_child;
+        *get_internal_node_key(node, num_keys) = lv->max_key;
+    }
+    *get_internal_node_right_child(node) = child_page_num;
+    lv->max_key = child_max_key;
+    unpin_page(pg, lv->page_num);
+}
+
+/// @brief A node that won't receive more cells moves up into its parent and drops its pin
+/// @param b 
+/// @param level 
+/// @param page_num 
+/// @param max_key 
+void builder_finish_node(tree_builder* b, uint32_t level, uint32_t page_num, uint64_t max_key) {
+    builder_add_child(b, level + 1, page_num, max_key);
+    unpin_page(b->tbl->pager, page_num);
+}
+
+/// @brief Append a record, its key larger than the last one's, to the right edge leaf
+/// @param b 
+/// @param key 
+/// @param record 
+/// @param record_length 
+void builder_add_record(tree_builder* b, uint64_t key, const void* record, uint16_t record_length) {
+    pager* pg = b->tbl->pager;
+    build_level* lv = &b->levels[0];
+
+    if (b->rows > 0 && key == lv->max_key) {
+        b->duplicates++;
+        return;
+    }
+
+    uint32_t needed = LEAF_NODE_SLOT_SIZE + record_length;
+
+    if (lv->page_num == INVALID_PAGE_NUM) {
+        builder_open_node(b, 0);
+    } else {
+        void* node = get_page(pg, lv->page_num);
+        uint32_t free_space = leaf_node_free_space(node);
+        bool full = free_space < needed || LEAF_NODE_SPACE_FOR_CELLS - free_space + needed > b->leaf_budget;
+        unpin_page(pg, lv->page_num);
+        if (full) {
+            // The next leaf takes the following page, so siblings are linked right away
+            uint32_t full_page_num = lv->page_num;
+            builder_open_node(b, 0);
+            void* full_node = get_page(pg, full_page_num);
+            mark_page_dirty(pg, full_page_num);
+            *get_leaf_node_next_leaf(full_node) = lv->page_num;
+            unpin_page(pg, full_page_num);
+            builder_finish_node(b, 0, full_page_num, lv->max_key);
+        }
+    }
+
+    void* node = get_page(pg, lv->page_num);
+    mark_page_dirty(pg, lv->page_num);
+    leaf_node_insert_record(node, *get_leaf_node_cells_num(node), key, record, record_length);
+    unpin_page(pg, lv->page_num);
+
+    lv->max_key = key;
+    b->rows++;
+
+    // Pages being built can't be evicted before they are committed, so commit as we go
+    if (pg->pending_count >= b->commit_pages) {
+        pager_commit(pg);
+    }
+}
+
+void builder_add_row(tree_builder* b, row* r) {
+    uint8_t record[ROW_SIZE];
+    uint16_t record_length = serialize_row(r, record);
+    builder_add_record(b, r->id, record, record_length);
+}
+
+/// @brief Close the right edge bottom-up, the single node left on top becomes the root
+/// @param b 
+void builder_finish(tree_builder* b) {
+    if (b->rows == 0) {
+        return;
+    }
+
+    pager* pg = b->tbl->pager;
+    uint32_t level = 0;
+    while (level + 1 < b->num_levels || b->levels[level].nodes > 1) {
+        build_level* lv = &b->levels[level];
+        builder_finish_node(b, level, lv->page_num, lv->max_key);
+        level++;
+    }
+
+    uint32_t top_page_num = b->levels[level].page_num;
+    void* top = get_page(pg, top_page_num);
+    mark_page_dirty(pg, top_page_num);
+    set_node_root(top, true);
+    unpin_page(pg, top_page_num);
+    unpin_page(pg, top_page_num);   // the builder's pin
+
+    if (top_page_num != b->tbl->root_page_num) {
+        set_root_page_num(b->tbl, top_page_num);
+    }
+}
+
+void init_tree_builder(tree_builder* b, table* tbl, uint32_t fill_percent) {
+    pager* pg = tbl->pager;
+    *b = (tree_builder){ .tbl = tbl };
+    b->leaf_budget = LEAF_NODE_SPACE_FOR_CELLS * fill_percent / 100;
+    b->spare_page_num = tbl->root_page_num;
+    b->commit_pages = pager_commit_threshold(pg);
+    for (uint32_t i = 0; i < BTREE_MAX_DEPTH; i++) {
+        b->levels[i].page_num = INVALID_PAGE_NUM;
+    }
+}
+
+/// @brief Bulk load the records of a table, as they are, into an empty table with the same schema
+/// @param from 
+/// @param to 
+void copy_table(table* from, table* to) {
+    tree_builder b;
+    init_tree_builder(&b, to, 100);
+
+    cursor cur;
+    begin_table(from, &cur);
+    while (!cur.end_of_table) {
+        void* node = get_page(from->pager, cur.page_num);
+        builder_add_record(&b, *get_leaf_node_key(node, cur.cell_num),
+                           get_leaf_node_value(node, cur.cell_num), *get_leaf_node_record_length(node, cur.cell_num));
+        unpin_page(from->pager, cur.page_num);
+        move_cursor_forward(&cur);
+    }
+    close_cursor(&cur);
+    builder_finish(&b);
+}
+
+/// @brief Rewrite the tables into "<db>-vacuum" with the bulk builder, then swap that file in.
+///        The copy has no free pages and packed leaves. The old file stays intact
+///        until the rename, so a crash at any point leaves one of the two.
+/// @param tbl 
+void vacuum_db(table* tbl) {
+    pager* pg = tbl->pager;
+    tdb_config cfg = pg->config;
+    char* file_name = strdup(pg->file_name);
+    char* copy_name = malloc(strlen(file_name) + sizeof("-vacuum-wal"));
+
+    // A crashed vacuum may have left a copy and its log behind
+    sprintf(copy_name, "%s-vacuum-wal", file_name);
+    unlink(copy_name);
+    sprintf(copy_name, "%s-vacuum", file_name);
+    unlink(copy_name);
+
+    table* copy = open_db(copy_name, &cfg);
+    pager_set_access_hint(pg, ACCESS_SEQUENTIAL);
+    copy_table(tbl, copy);
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        if (tbl->indexes[i]->root_page_num != 0) {
+            create_index(copy, i);
+        }
+    }
+    // Tables are created in the same order, so they keep their numbers
+    for (uint32_t i = 0; i < tbl->catalog->count; i++) {
+        create_table(copy, tbl->catalog->tables[i]->schema);
+        copy_table(tbl->catalog->tables[i], copy->catalog->tables[i]);
+    }
+    close_db(copy);
+
+    close_pager(pg);
+    if (!replace_file(copy_name, file_name)) {
+        printf("Error replacing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    load_table(tbl, open_pager(file_name, &cfg));
+
+    free(copy_name);
+    free(file_name);
+}
+
+/// @brief Bulk load rows into an empty table
+/// @param tbl 
+/// @param file_name csv with one id,user_name,email per line, or serialized rows if it ends in ".bin"
+/// @param fill_percent how full leaves are packed
+void import_rows(table* tbl, const char* file_name, uint32_t fill_percent) {
+    pager* pg = tbl->pager;
+    void* root = get_page(pg, tbl->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF && *get_leaf_node_cells_num(root) == 0;
+    unpin_page(pg, tbl->root_page_num);
+    if (!empty) {
+        printf("Error: .import needs an empty table.\n");
+        return;
+    }
+
+    size_t name_len = strlen(file_name);
+    import_format format = name_len > 4 && strcmp(file_name + name_len - 4, ".bin") == 0
+                         ? IMPORT_BINARY
+                         : IMPORT_CSV;
+    FILE* file = fopen(file_name, format == IMPORT_BINARY ? "rb" : "r");
+    if (file == NULL) {
+        printf("Unable to open '%s'.\n", file_name);
+        return;
+    }
+
+    sorted_rows sorted;
+    uint32_t malformed = sort_import_rows(file, format, &sorted);
+    fclose(file);
+
+    // Indexes are built again once the rows are in, rather than kept up a row at a time
+    bool indexed[INDEX_COUNT];
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        table* idx = tbl->indexes[i];
+        indexed[i] = idx->root_page_num != 0;
+        if (indexed[i]) {
+            free_tree(pg, idx->root_page_num);
+            set_root_page_num(idx, 0);
+        }
+    }
+
+    tree_builder b;
+    init_tree_builder(&b, tbl, fill_percent);
+
+    row r;
+    while (next_sorted_row(&sorted, &r)) {
+        builder_add_row(&b, &r);
+    }
+    builder_finish(&b);
+    free_sorted_rows(&sorted);
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        if (indexed[i]) {
+            create_index(tbl, i);
+        }
+    }
+    pager_commit(pg);
+
+    printf("Imported %llu rows.\n", (unsigned long long)b.rows);
+    if (b.duplicates > 0) {
+        printf("Skipped %llu rows with duplicate ids.\n", (unsigned long long)b.duplicates);
+    }
+    if (malformed > 0) {
+        printf("Skipped %d malformed lines.\n", malformed);
+    }
+}
+
+/*
+    Integrity check.
+    `.integrity_check` checkpoints so the file holds every commit, then reads
+    it front to back once. Each page's checksum is checked, nodes are checked
+    on their own (slots inside the page, keys in order) and summed up. The
+    tables, the indexes, the catalog and the freelist are then walked through
+    the summaries: every child keeps its keys inside the bounds its parent
+    gives it, each leaf chain visits every leaf of its tree in key order,
+    every index has one entry per row, and every page is used exactly once.
+*/
+#define INTEGRITY_READ_PAGES    64
+#define INTEGRITY_MAX_PROBLEMS  100
+
+typedef struct {
+    uint8_t type;
+    bool is_root;
+    bool in_tree;
+    uint32_t tree;              // root of the tree the page is in
+    const char* node_problem;   // found while reading, reported if the page is in the tree
+    uint32_t first_word;        // next page, for a free page
+    uint32_t next_leaf;
+    uint32_t first_child;
+    uint32_t first_bounds;      // children of an internal node, in integrity_check.children
+    uint32_t num_bounds;
+    uint32_t num_keys;
+    uint64_t min_key;
+    uint64_t max_key;
+    uint32_t uses;              // references from the header, parents and the freelist
+} page_summary;
+
+// Keys of the child are > lower and <= upper, where the parent sets them
+typedef struct {
+    uint32_t parent;
+    uint32_t child;
+    uint64_t lower;
+    uint64_t upper;
+    bool has_lower;
+    bool has_upper;
+} child_bounds;
+
+typedef struct {
+    uint32_t num_pages;
+    page_summary* pages;
+    child_bounds* children;
+    uint32_t num_children;
+    uint32_t children_capacity;
+    uint32_t tree;              // root of the tree being walked
+    uint32_t problems;
+} integrity_check;
+
+void integrity_problem(integrity_check* c, uint32_t page_num, const char* problem, uint32_t value) {
+    if (c->problems++ < INTEGRITY_MAX_PROBLEMS) {
+        printf("page %d: ", page_num);
+        printf(problem, value);
+        printf("\n");
+    }
+}
+
+void add_child_bounds(integrity_check* c, child_bounds bounds) {
+    if (c->num_children == c->children_capacity) {
+        c->children_capacity = c->children_capacity ? c->children_capacity * 2 : 64;
+        c->children = realloc(c->children, c->children_capacity * sizeof(child_bounds));
+    }
+    c->children[c->num_children++] = bounds;
+}
+
+void summarize_leaf(page_summary* s, void* node) {
+    uint32_t num_cells = *get_leaf_node_cells_num(node);
+    s->num_keys = num_cells;
+    s->next_leaf = *get_leaf_node_next_leaf(node);
+    uint16_t content_start = *get_leaf_node_content_start(node);
+    if (num_cells > LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_SLOT_SIZE
+        || LEAF_NODE_HEADER_SIZE + num_cells * LEAF_NODE_SLOT_SIZE > content_start
+        || content_start > PAGE_USABLE_SIZE) {
+        s->node_problem = "leaf slots overlap its records";
+        s->num_keys = 0;
+        return;
+    }
+
+    for (uint32_t i = 0; i < num_cells; i++) {
+        uint32_t offset = *get_leaf_node_record_offset(node, i);
+        uint32_t length = *get_leaf_node_record_length(node, i);
+        if (offset < content_start || offset + length > PAGE_USABLE_SIZE) {
+            s->node_problem = "leaf record outside the record area";
+        }
+        uint64_t key = *get_leaf_node_key(node, i);
+        if (i > 0 && key <= s->max_key) {
+            s->node_problem = "leaf keys out of order";
+        }
+        s->max_key = key;
+    }
+    s->min_key = num_cells > 0 ? *get_leaf_node_key(node, 0) : 0;
+}
+
+void summarize_internal(integrity_check* c, page_summary* s, uint32_t page_num, void* node) {
+    uint32_t num_keys = *get_internal_node_keys_count(node);
+    if (num_keys > INTERNAL_NODE_CELL_MAX_SIZE) {
+        s->node_problem = "internal node has more keys than fit";
+        return;
+    }
+    s->num_keys = num_keys;
+    s->first_child = num_keys > 0 ? *get_internal_node_cell(node, 0) : *get_internal_node_right_child(node);
+    s->first_bounds = c->num_children;
+    s->num_bounds = num_keys + 1;
+
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        child_bounds bounds = { page_num, 0, 0, 0, i > 0, i < num_keys };
+        bounds.child = i < num_keys ? *get_internal_node_cell(node, i) : *get_internal_node_right_child(node);
+        if (i > 0) {
+            bounds.lower = *get_internal_node_key(node, i - 1);
+        }
+        if (i < num_keys) {
+            bounds.upper = *get_internal_node_key(node, i);
+            if (i > 0 && bounds.upper <= bounds.lower) {
+                s->node_problem = "internal keys out of order";
+            }
+        }
+        add_child_bounds(c, bounds);
+    }
+    if (num_keys > 0) {
+        s->min_key = *get_internal_node_key(node, 0);
+        s->max_key = *get_internal_node_key(node, num_keys - 1);
+    }
+}
+
+/// @brief Take the summary of a page in the tree, reporting what is wrong with it
+/// @param c 
+/// @param page_num 
+/// @return NULL if the page number is out of range or the page is already in the tree
+page_summary* claim_tree_page(integrity_check* c, uint32_t page_num, uint32_t referrer) {
+    if (page_num == DB_HEADER_PAGE_NUM || page_num >= c->num_pages) {
+        integrity_problem(c, referrer, "points at page %d, outside the tree", page_num);
+        return NULL;
+    }
+    page_summary* s = &c->pages[page_num];
+    if (s->uses++ > 0) {
+        return NULL;
+    }
+    s->in_tree = true;
+    s->tree = c->tree;
+    if (s->type != NODE_LEAF && s->type != NODE_INTERNAL) {
+        integrity_problem(c, page_num, "not a node (type %d)", s->type);
+    } else if (s->node_problem != NULL) {
+        integrity_problem(c, page_num, s->node_problem, 0);
+    }
+    return s;
+}
+
+/// @brief Walk one tree from its root, claiming its pages
+/// @param c 
+/// @param root_page_num 
+/// @return the number of cells in its leaves
+uint32_t check_tree(integrity_check* c, uint32_t root_page_num) {
+    // Top down from the root, every page joins the queue once
+    uint32_t* queue = malloc(c->num_pages * sizeof(uint32_t));
+    uint32_t head = 0, tail = 0;
+    c->tree = root_page_num;
+    page_summary* root = claim_tree_page(c, root_page_num, DB_HEADER_PAGE_NUM);
+    if (root != NULL) {
+        if (!root->is_root) {
+            integrity_problem(c, root_page_num, "is the root but not flagged as one", 0);
+        }
+        queue[tail++] = root_page_num;
+    }
+
+    uint32_t leaves = 0;
+    uint32_t cells = 0;
+    while (head < tail) {
+        page_summary* parent = &c->pages[queue[head++]];
+        if (parent->type == NODE_LEAF) {
+            leaves++;
+            cells += parent->num_keys;
+        }
+        for (uint32_t i = 0; i < parent->num_bounds; i++) {
+            child_bounds* b = &c->children[parent->first_bounds + i];
+            page_summary* s = claim_tree_page(c, b->child, b->parent);
+            if (s == NULL) {
+                continue;
+            }
+            queue[tail++] = b->child;
+            if (s->is_root) {
+                integrity_problem(c, b->child, "flagged as the root but has a parent", 0);
+            }
+            if (s->num_keys > 0 && ((b->has_lower && s->min_key <= b->lower) || (b->has_upper && s->max_key > b->upper))) {
+                integrity_problem(c, b->child, "keys outside the bounds set by page %d", b->parent);
+            }
+        }
+    }
+    free(queue);
+
+    // The leaf chain starts at the leftmost leaf and goes through all of them in key order
+    uint32_t page_num = root_page_num;
+    for (uint32_t depth = 0; depth < BTREE_MAX_DEPTH && page_num < c->num_pages
+         && c->pages[page_num].in_tree && c->pages[page_num].tree == root_page_num
+         && c->pages[page_num].type == NODE_INTERNAL; depth++) {
+        page_num = c->pages[page_num].first_child;
+    }
+    uint32_t chained = 0;
+    bool has_previous = false;
+    uint64_t previous_max = 0;
+    while (page_num != 0 && chained < leaves) {
+        page_summary* s = page_num < c->num_pages ? &c->pages[page_num] : NULL;
+        if (s == NULL || !s->in_tree || s->tree != root_page_num || s->type != NODE_LEAF) {
+            integrity_problem(c, page_num, "in the leaf chain but not a leaf of the tree", 0);
+            break;
+        }
+        if (s->num_keys > 0) {
+            if (has_previous && s->min_key <= previous_max) {
+                integrity_problem(c, page_num, "leaf chain out of key order", 0);
+            }
+            has_previous = true;
+            previous_max = s->max_key;
+        }
+        chained++;
+        page_num = s->next_leaf;
+    }
+    if (chained != leaves || page_num != 0) {
+        integrity_problem(c, root_page_num, "leaf chain doesn't link all %d leaves of its tree", leaves);
+    }
+    return cells;
+}
+
+/// @brief Walk the freelist, then make sure every page is used exactly once
+/// @param c 
+/// @param freelist_head 
+/// @param freelist_count 
+void check_page_uses(integrity_check* c, uint32_t freelist_head, uint32_t freelist_count) {
+    uint32_t free_pages = 0;
+    for (uint32_t page_num = freelist_head; page_num != 0 && free_pages <= freelist_count; free_pages++) {
+        if (page_num >= c->num_pages) {
+            integrity_problem(c, DB_HEADER_PAGE_NUM, "freelist points at page %d, past the end of the file", page_num);
+            break;
+        }
+        if (c->pages[page_num].uses++ > 0) {
+            break;
+        }
+        page_num = c->pages[page_num].first_word;
+    }
+    if (free_pages != freelist_count) {
+        integrity_problem(c, DB_HEADER_PAGE_NUM, "freelist count is %d but the list is longer or shorter", freelist_count);
+    }
+
+    for (uint32_t page_num = 1; page_num < c->num_pages; page_num++) {
+        page_summary* s = &c->pages[page_num];
+        if (s->uses == 0) {
+            integrity_problem(c, page_num, "neither in a tree nor on the freelist", 0);
+        } else if (s->uses > 1) {
+            integrity_problem(c, page_num, "used %d times", s->uses);
+        }
+    }
+}
+
+/// @brief Check the checksums, the tree and the freelist in one pass over the file
+/// @param tbl 
+void check_integrity(table* tbl) {
+    pager* pg = tbl->pager;
+    pager_checkpoint(pg);
+
+    integrity_check c = {0};
+    c.num_pages = pg->num_pages;
+    c.pages = calloc(c.num_pages, sizeof(page_summary));
+    uint8_t* chunk = malloc((size_t)INTEGRITY_READ_PAGES * PAGE_SIZE);
+    uint32_t root_page_num = 0, freelist_head = 0, freelist_count = 0, catalog_root = 0;
+    uint32_t index_roots[INDEX_COUNT] = {0};
+    uint32_t table_roots[TABLE_MAX_COUNT] = {0};
+    catalog* cat = tbl->catalog;
+
+    for (uint32_t first = 0; first < c.num_pages; first += INTEGRITY_READ_PAGES) {
+        uint32_t count = c.num_pages - first < INTEGRITY_READ_PAGES ? c.num_pages - first : INTEGRITY_READ_PAGES;
+        // The pool lock keeps page loads off the file offset
+        pthread_rwlock_wrlock(&pg->pool_lock);
+        bool read_ok = store_read_pages(&pg->store, first, count, chunk);
+        pthread_rwlock_unlock(&pg->pool_lock);
+        if (!read_ok) {
+            printf("Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t page_num = first + i;
+            void* page = chunk + (size_t)i * PAGE_SIZE;
+            page_summary* s = &c.pages[page_num];
+            if (!page_checksum_ok(page)) {
+                integrity_problem(&c, page_num, "checksum mismatch", 0);
+            }
+            if (page_num == DB_HEADER_PAGE_NUM) {
+                root_page_num = *get_header_root_slot(page, tbl);
+                for (uint32_t j = 0; j < INDEX_COUNT; j++) {
+                    index_roots[j] = *get_header_root_slot(page, tbl->indexes[j]);
+                }
+                catalog_root = *get_header_root_slot(page, &cat->tree);
+                for (uint32_t j = 0; j < cat->count; j++) {
+                    table_roots[j] = *get_header_root_slot(page, cat->tables[j]);
+                }
+                freelist_head = *get_header_freelist_head(page);
+                freelist_count = *get_header_freelist_count(page);
+                continue;
+            }
+
+            s->type = get_node_type(page);
+            s->is_root = is_node_root(page);
+            s->first_word = *get_free_page_next(page);
+            if (s->type == NODE_LEAF) {
+                summarize_leaf(s, page);
+            } else if (s->type == NODE_INTERNAL) {
+                summarize_internal(&c, s, page_num, page);
+            }
+        }
+    }
+
+    uint32_t rows = check_tree(&c, root_page_num);
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        if (index_roots[i] == 0) {
+            continue;
+        }
+        uint32_t entries = check_tree(&c, index_roots[i]);
+        if (entries != rows) {
+            char problem[80];
+            snprintf(problem, sizeof(problem), "index on %s has %%d entries, not one for each row", INDEX_COLUMN_NAMES[i]);
+            integrity_problem(&c, index_roots[i], problem, entries);
+        }
+    }
+    if (catalog_root != 0) {
+        uint32_t entries = check_tree(&c, catalog_root);
+        if (entries != cat->count) {
+            integrity_problem(&c, catalog_root, "catalog has %d entries, not one for each table", entries);
+        }
+    }
+    for (uint32_t i = 0; i < cat->count; i++) {
+        check_tree(&c, table_roots[i]);
+    }
+    check_page_uses(&c, freelist_head, freelist_count);
+    if (c.problems == 0) {
+        printf("ok\n");
+    } else {
+        printf("%d %s found.\n", c.problems, c.problems == 1 ? "problem" : "problems");
+    }
+
+    free(chunk);
+    free(c.children);
+    free(c.pages);
+}
+
+/// @brief Whether find_table left the cursor on the key, rather than where it would go
+/// @param cur 
+/// @param key 
+/// @return 
+bool cursor_finds_key(cursor* cur, uint64_t key) {
+    pager* pg = cur->table->pager;
+    void* node = get_page(pg, cur->page_num);
+    bool found = cur->cell_num < *get_leaf_node_cells_num(node) && *get_leaf_node_key(node, cur->cell_num) == key;
+    unpin_page(pg, cur->page_num);
+    return found;
+}
+
+/// @brief Insert one row and its index entries
+/// @param tbl 
+/// @param row_to_insert 
+/// @return 
+execute_result insert_row(table* tbl, row* row_to_insert) {
+    cursor cur;
+    find_table(tbl, row_to_insert->id, &cur);
+    if (cursor_finds_key(&cur, row_to_insert->id)) {
+        close_cursor(&cur);
+        return EXECUTE_DUPICATE_KEY;
+    }
+
+    insert_leaf_node(&cur, row_to_insert->id, row_to_insert);
+
+    close_cursor(&cur);
+    update_index_entries(tbl, NULL, row_to_insert);
+
+    return EXECUTE_SUCCESS;
+}
+
+/// @brief Insert one record into a table made with create table
+/// @param tbl 
+/// @param key 
+/// @param record 
+/// @param record_length 
+/// @return 
+execute_result insert_record(table* tbl, uint64_t key, const void* record, uint16_t record_length) {
+    cursor cur;
+    find_table(tbl, key, &cur);
+    execute_result result = EXECUTE_DUPICATE_KEY;
+    if (!cursor_finds_key(&cur, key)) {
+        insert_leaf_record(&cur, key, record, record_length);
+        result = EXECUTE_SUCCESS;
+    }
+    close_cursor(&cur);
+    return result;
+}
+
+/*
+    Batched inserts.
+    The batch is sorted by id and goes into the tree a leaf at a time: one
+    descent finds the leaf for the next id together with its fence, the
+    largest id that still routes to it, and every batch row up to the fence
+    is merged with the leaf's cells in a single pass. Whatever no longer fits
+    spills into fresh leaves chained after it, so a leaf splits at most once
+    per batch however many rows land in it.
+*/
+
+/// @brief Chain a fresh leaf after the one being filled
+/// @param pg 
+/// @param page_num leaf being filled, moved on to the new leaf
+/// @param spilled pages started so far, the new one is appended
+/// @param spilled_count 
+/// @param spilled_capacity 
+/// @return the new leaf
+void* start_batch_leaf(pager* pg, uint32_t* page_num, uint32_t** spilled, uint32_t* spilled_count, uint32_t* spilled_capacity) {
+    void* node = get_page(pg, *page_num);
+    uint32_t new_page_num = get_unused_page_num(pg);
+    void* new_node = get_page(pg, new_page_num);
+    mark_page_dirty(pg, new_page_num);
+    init_leaf_node(new_node);
+    *get_leaf_node_next_leaf(new_node) = *get_leaf_node_next_leaf(node);
+    *get_leaf_node_next_leaf(node) = new_page_num;
+
+    if (*spilled_count == *spilled_capacity) {
+        *spilled_capacity = *spilled_capacity == 0 ? 8 : *spilled_capacity * 2;
+        *spilled = realloc(*spilled, *spilled_capacity * sizeof(uint32_t));
+    }
+    (*spilled)[(*spilled_count)++] = new_page_num;
+
+    // Once for the get_page above and once for the caller's pin, which moves to the new leaf
+    unpin_page(pg, *page_num);
+    unpin_page(pg, *page_num);
+    *page_num = new_page_num;
+    return new_node;
+}
+
+/// @brief Add the leaves a batch spilled into to the tree
+/// @param tbl 
+/// @param page_num the leaf the run was routed to
+/// @param fence 
+/// @param spilled new leaves in key order
+/// @param count 
+void link_batch_leaves(table* tbl, uint32_t page_num, uint64_t fence, uint32_t* spilled, uint32_t count) {
+    /*
+        Highest first, so the right edge of every node on the way always
+        holds its true max key: a split further up works out its separator
+        from it. Each leaf then goes into the parent of the one on its right,
+        found by descending to that leaf's first key.
+    */
+    pager* pg = tbl->pager;
+    void* node = get_page(pg, page_num);
+    uint32_t last_page_num = spilled[count - 1];
+
+    if (is_node_root(node)) {
+        create_new_root(tbl, last_page_num);
+    } else {
+        // A key for the first leaf in its parent is the fence, the leaf now ends lower
+        btree_path path;
+        find_path(tbl, fence, &path);
+        uint32_t parent_page_num = path.pages[path.depth - 2];
+        void* parent = get_page(pg, parent_page_num);
+        mark_page_dirty(pg, parent_page_num);
+        update_internal_node_key(parent, fence, get_node_max_key(pg, node));
+        unpin_page(pg, parent_page_num);
+        insert_internal_node(tbl, &path, path.depth - 2, last_page_num);
+    }
+    unpin_page(pg, page_num);
+
+    for (uint32_t i = count - 1; i-- > 0;) {
+        void* right = get_page(pg, spilled[i + 1]);
+        uint64_t right_key = *get_leaf_node_key(right, 0);
+        unpin_page(pg, spilled[i + 1]);
+
+        btree_path path;
+        find_path(tbl, right_key, &path);
+        insert_internal_node(tbl, &path, path.depth - 2, spilled[i]);
+    }
+}
+
+/// @brief Bytes to put in the next leaf so the rest spread evenly over as few leaves as hold them
+/// @param remaining_bytes cells and slots still to be placed
+/// @return 
+uint32_t batch_leaf_budget(uint32_t remaining_bytes) {
+    uint32_t leaves = (remaining_bytes + LEAF_NODE_SPACE_FOR_CELLS - 1) / LEAF_NODE_SPACE_FOR_CELLS;
+    return leaves == 0 ? 0 : (remaining_bytes + leaves - 1) / leaves;
+}
+
+/// @brief Merge the sorted rows routed to the cursor's leaf into it
+/// @param cur leaf found for rows[0]
+/// @param fence largest id routed to that leaf
+/// @param rows 
+/// @param count 
+/// @param duplicates incremented for every row skipped because its id is taken
+/// @return number of rows consumed, all of them up to the fence unless there are too many
+uint32_t insert_batch_run(cursor* cur, uint64_t fence, row* rows, uint32_t count, uint32_t* duplicates) {
+    table* tbl = cur->table;
+    pager* pg = tbl->pager;
+
+    // A run longer than a quarter of the commit threshold in leaves is left for the next descent
+    uint32_t max_run_bytes = pager_commit_threshold(pg) / 4 * LEAF_NODE_SPACE_FOR_CELLS;
+    uint32_t run = 0;
+    uint32_t run_bytes = 0;
+    while (run < count && rows[run].id <= fence && (run == 0 || run_bytes < max_run_bytes)) {
+        run_bytes += serialized_row_size(&rows[run]) + LEAF_NODE_SLOT_SIZE;
+        run++;
+    }
+
+    uint32_t page_num = cur->page_num;
+    void* node = get_page(pg, page_num);
+    mark_page_dirty(pg, page_num);
+
+    uint32_t remaining_bytes = leaf_node_used_space(node) + run_bytes;
+    uint32_t leaf_budget = batch_leaf_budget(remaining_bytes);
+
+    uint8_t copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
+    uint32_t old_cells = *get_leaf_node_cells_num(copy);
+    *get_leaf_node_cells_num(node) = 0;
+    *get_leaf_node_content_start(node) = PAGE_USABLE_SIZE;
+    *get_leaf_node_fragmented(node) = 0;
+
+    uint8_t record[ROW_SIZE];
+    uint32_t* spilled = NULL;
+    uint32_t spilled_count = 0;
+    uint32_t spilled_capacity = 0;
+    bool any = false;
+    uint64_t last_key = 0;
+    uint32_t old_idx = 0;
+    uint32_t new_idx = 0;
+    while (old_idx < old_cells || new_idx < run) {
+        uint64_t key;
+        void* cell_record;
+        uint16_t cell_length;
+        if (new_idx == run || (old_idx < old_cells && *get_leaf_node_key(copy, old_idx) <= rows[new_idx].id)) {
+            key = *get_leaf_node_key(copy, old_idx);
+            cell_record = get_leaf_node_value(copy, old_idx);
+            cell_length = *get_leaf_node_record_length(copy, old_idx);
+            old_idx++;
+        } else {
+            key = rows[new_idx].id;
+            cell_length = serialize_row(&rows[new_idx], record);
+            cell_record = record;
+            new_idx++;
+        }
+
+        remaining_bytes -= cell_length + LEAF_NODE_SLOT_SIZE;
+
+        // A batch row loses to a row already stored and to an earlier row of the batch
+        if (any && key == last_key) {
+            (*duplicates)++;
+            continue;
+        }
+
+        uint32_t used = leaf_node_used_space(node);
+        if (*get_leaf_node_cells_num(node) > 0
+                && (used >= leaf_budget || used + cell_length + LEAF_NODE_SLOT_SIZE > LEAF_NODE_SPACE_FOR_CELLS)) {
+            node = start_batch_leaf(pg, &page_num, &spilled, &spilled_count, &spilled_capacity);
+            leaf_budget = batch_leaf_budget(remaining_bytes + cell_length + LEAF_NODE_SLOT_SIZE);
+        }
+        leaf_node_insert_record(node, *get_leaf_node_cells_num(node), key, cell_record, cell_length);
+        last_key = key;
+        any = true;
+    }
+
+    unpin_page(pg, page_num);
+    if (spilled_count > 0) {
+        link_batch_leaves(tbl, cur->page_num, fence, spilled, spilled_count);
+        free(spilled);
+    }
+    return run;
+}
+
+/// @brief Insert rows in one pass over the tree, skipping ids already taken.
+///        A batch that dirties many pages commits part way, like a bulk load,
+///        unless a transaction is open.
+/// @param tbl 
+/// @param rows sorted by id in place
+/// @param count 
+/// @param done set to the number of rows gone through, less than count if the batch stopped short
+/// @param duplicates set to the number of rows skipped as duplicates
+/// @return EXECUTE_SUCCESS or EXECUTE_DUPICATE_KEY, or EXECUTE_TRANSACTION_FULL if the batch stopped short
+execute_result insert_batch(table* tbl, row* rows, uint32_t count, uint32_t* done, uint32_t* duplicates) {
+    pager* pg = tbl->pager;
+    qsort(rows, count, sizeof(row), compare_row_ids);
+    pager_set_access_hint(pg, ACCESS_NORMAL);
+
+    // The single pass fills leaves of the table only, a table with indexes takes a row at a time
+    bool indexed = table_has_indexes(tbl);
+    *done = 0;
+    *duplicates = 0;
+    while (*done < count && !pager_transaction_full(pg)) {
+        if (indexed) {
+            *duplicates += insert_row(tbl, &rows[*done]) == EXECUTE_DUPICATE_KEY;
+            (*done)++;
+        } else {
+            cursor cur;
+            uint64_t fence;
+            find_table_fence(tbl, rows[*done].id, &cur, &fence);
+            *done += insert_batch_run(&cur, fence, rows + *done, count - *done, duplicates);
+            close_cursor(&cur);
+        }
+
+        // Inside a transaction everything waits for its commit
+        if (!pg->in_transaction && pg->pending_count >= pager_commit_threshold(pg) / 2) {
+            pager_commit(pg);
+        }
+    }
+
+    if (*done < count) {
+        return EXECUTE_TRANSACTION_FULL;
+    }
+    return *duplicates > 0 ? EXECUTE_DUPICATE_KEY : EXECUTE_SUCCESS;
+}
+
+/// @brief Key of a record of a table made with create table, its first column
+/// @param record 
+/// @return 
+uint64_t get_record_key(const uint8_t* record) {
+    uint32_t id;
+    memcpy(&id, record, sizeof(uint32_t));
+    return id;
+}
+
+/// @brief Order the length and record slots of a batch by key, the record's first 4 bytes
+/// @param a 
+/// @param b 
+/// @return 
+int compare_record_keys(const void* a, const void* b) {
+    uint64_t key_a = get_record_key((const uint8_t*)a + sizeof(uint16_t));
+    uint64_t key_b = get_record_key((const uint8_t*)b + sizeof(uint16_t));
+    return key_a < key_b ? -1 : key_a > key_b;
+}
+
+/// @brief Insert the batch of a table made with create table, a record at a time in key
+///        order, committing part way as insert_batch does
+/// @param tbl 
+/// @param records count slots of slot_size bytes: length (2 bytes) and record
+/// @param count 
+/// @param slot_size 
+/// @return 
+execute_result insert_records(table* tbl, uint8_t* records, uint32_t count, uint32_t slot_size) {
+    pager* pg = tbl->pager;
+    qsort(records, count, slot_size, compare_record_keys);
+    pager_set_access_hint(pg, ACCESS_NORMAL);
+
+    uint32_t done = 0;
+    uint32_t duplicates = 0;
+    while (done < count && !pager_transaction_full(pg)) {
+        uint8_t* slot = records + done * slot_size;
+        uint16_t length;
+        memcpy(&length, slot, sizeof(uint16_t));
+        uint64_t key = get_record_key(slot + sizeof(uint16_t));
+        duplicates += insert_record(tbl, key, slot + sizeof(uint16_t), length) == EXECUTE_DUPICATE_KEY;
+        done++;
+
+        if (!pg->in_transaction && pg->pending_count >= pager_commit_threshold(pg) / 2) {
+            pager_commit(pg);
+        }
+    }
+
+    if (done < count) {
+        return EXECUTE_TRANSACTION_FULL;
+    }
+    return duplicates > 0 ? EXECUTE_DUPICATE_KEY : EXECUTE_SUCCESS;
+}
+
+void print_constants() {
+    printf("ROW_SIZE: %d\n", ROW_SIZE);
+    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+    printf("LEAF_NODE_MIN_CELLS: %d\n", LEAF_NODE_MIN_CELLS);
+}
+
+void print_version_stats(pager* pg) {
+    pthread_mutex_lock(&pg->versions_lock);
+    uint32_t versions = pg->version_count;
+    uint32_t snapshots = pg->snapshot_count;
+    pthread_mutex_unlock(&pg->versions_lock);
+    printf("page versions: %d\n", versions);
+    printf("snapshots: %d\n", snapshots);
+}
+
+/// @brief How small a compressed file's pages are, as of their last write
+/// @param store 
+void print_store_stats(page_store* store) {
+    uint64_t stored = 0;
+    uint32_t pages = 0;
+    uint32_t raw = 0;
+    for (uint32_t i = 0; i < store->page_count; i++) {
+        if (store->map[i].offset != 0) {
+            pages++;
+            stored += store->map[i].length;
+            raw += (store->map[i].flags & STORE_PAGE_RAW) != 0;
+        }
+    }
+    printf("stored pages: %d, %d of them uncompressed\n", pages, raw);
+    printf("stored bytes: %llu (%.1f%% of the pages)\n", (unsigned long long)stored,
+           pages == 0 ? 0.0 : 100.0 * stored / ((double)pages * PAGE_SIZE));
+    uint64_t free_units = 0;
+    for (uint32_t i = 0; i < store->free.count; i++) {
+        free_units += store->free.items[i].units;
+    }
+    printf("file bytes: %llu, free: %llu\n", (unsigned long long)store->end_unit * STORE_UNIT,
+           (unsigned long long)free_units * STORE_UNIT);
+}
+
+void print_pool_stats(pager* pg) {
+    if (pg->mode == TDB_PAGER_MMAP) {
+        uint32_t dirty = 0;
+        for (uint32_t i = 0; i < pg->num_pages; i++) {
+            dirty += bitmap_test(&pg->dirty_map, i);
+        }
+        printf("mode: mmap\n");
+        printf("mapped pages: %d\n", pg->mapped_pages);
+        printf("dirty: %d\n", dirty);
+        print_version_stats(pg);
+        return;
+    }
+
+    uint32_t resident = 0;
+    uint32_t pinned = 0;
+    uint32_t dirty = 0;
+    pthread_rwlock_wrlock(&pg->pool_lock);
+    for (uint32_t i = 0; i < pg->frames_used; i++) {
+        frame* fr = &pg->frames[i];
+        if (fr->page_num == INVALID_PAGE_NUM) {
+            continue;
+        }
+        resident++;
+        pinned += fr->pin_count > 0;
+        dirty += fr->dirty;
+    }
+    pool_stats stats = pg->stats;
+    pthread_rwlock_unlock(&pg->pool_lock);
+
+    printf("frames: %d\n", pg->frame_count);
+    printf("resident: %d\n", resident);
+    printf("pinned: %d\n", pinned);
+    printf("dirty: %d\n", dirty);
+    printf("hits: %llu\n", (unsigned long long)stats.hits);
+    printf("misses: %llu\n", (unsigned long long)stats.misses);
+    printf("evictions: %llu\n", (unsigned long long)stats.evictions);
+    printf("write-backs: %llu\n", (unsigned long long)stats.write_backs);
+    printf("read-aheads: %llu\n", (unsigned long long)stats.read_aheads);
+    printf("page reads: %llu\n", (unsigned long long)stats.reads);
+    printf("page writes: %llu\n", (unsigned long long)stats.writes);
+    printf("background writes: %llu\n", (unsigned long long)stats.background_writes);
+    if (pg->store.compressed) {
+        print_store_stats(&pg->store);
+    }
+    print_version_stats(pg);
+}
+
+/// @brief The latency under which pct percent of a histogram's fall, to its bucket's precision
+/// @param h 
+/// @param pct 
+/// @return 
+uint64_t histogram_percentile(histogram* h, uint32_t pct) {
+    uint64_t rank = (h->count * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen > 0) {
+            uint64_t ns = histogram_bucket_max(i);
+            return ns < h->max_ns ? ns : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+void print_histogram(const char* name, histogram* h) {
+    printf("%-16s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, (unsigned long long)h->count,
+           h->count == 0 ? 0.0 : h->total_ns / 1e3 / h->count,
+           histogram_percentile(h, 50) / 1e3, histogram_percentile(h, 90) / 1e3,
+           histogram_percentile(h, 99) / 1e3, h->max_ns / 1e3);
+}
+
+void print_op_stats(pager* pg) {
+#ifdef TDB_NO_STATS
+    (void)pg;
+    printf("Statistics were compiled out (TDB_NO_STATS).\n");
+#else
+    op_stats ops = pg->ops;
+    printf("page gets: %llu\n", (unsigned long long)ops.page_gets);
+    printf("cursor steps: %llu\n", (unsigned long long)ops.cursor_steps);
+    printf("leaf hops: %llu\n", (unsigned long long)ops.leaf_hops);
+    printf("%-16s %10s %10s %10s %10s %10s %10s\n", "latency (us)", "count", "mean", "p50", "p90", "p99", "max");
+    print_histogram("page reads", &ops.page_reads);
+    print_histogram("page flushes", &ops.page_flushes);
+    print_histogram("descents", &ops.descents);
+    print_histogram("leaf splits", &ops.leaf_splits);
+    print_histogram("internal splits", &ops.internal_splits);
+#endif
+}
+
+void print_wal_stats(wal* w) {
+    printf("frames: %d\n", w->frame_count);
+    printf("commits: %llu\n", (unsigned long long)w->stats.commits);
+    printf("syncs: %llu\n", (unsigned long long)w->stats.syncs);
+    printf("checkpoints: %llu\n", (unsigned long long)w->stats.checkpoints);
+}
+
+bool is_param(const char* token) {
+    return token != NULL && strcmp(token, "?") == 0;
+}
+
+prepare_result add_param(statement* stmt, param_target target) {
+    if (stmt->param_count == STATEMENT_MAX_PARAMS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    stmt->params[stmt->param_count++] = target;
+    return PREPARE_SUCCESS;
+}
+
+prepare_result parse_id(char* str, uint32_t* id) {
+    if (str == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    char* end;
+    long value = strtol(str, &end, 10);
+    if (*end != '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (value < 0) {
+        return PREPARE_NEGATIVE_ID;
+    }
+
+    *id = value > UINT32_MAX ? UINT32_MAX : value;
+    return PREPARE_SUCCESS;
+}
+
+prepare_result parse_int(char* str, int64_t* value) {
+    if (str == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    char* end;
+    long long number = strtoll(str, &end, 10);
+    if (*end != '\0' || end == str || number < INT32_MIN || number > INT32_MAX) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *value = number;
+    return PREPARE_SUCCESS;
+}
+
+/// @brief A value for a column of a table made with create table, or a ? that fills it when bound
+/// @param stmt 
+/// @param column 
+/// @param str 
+/// @return 
+prepare_result parse_column_value(statement* stmt, uint32_t column, char* str) {
+    column_def* def = &stmt->table->schema->columns[column];
+    if (str == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (is_param(str)) {
+        return add_param(stmt, PARAM_COLUMN + column);
+    }
+
+    if (def->type == COLUMN_TEXT) {
+        if (strlen(str) > def->size) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        strcpy(stmt->values->texts[column], str);
+        return PREPARE_SUCCESS;
+    }
+    if (column == 0) {
+        uint32_t key;
+        prepare_result result = parse_id(str, &key);
+        if (result == PREPARE_SUCCESS) {
+            stmt->values->numbers[0] = key;
+        }
+        return result;
+    }
+    return parse_int(str, &stmt->values->numbers[column]);
+}
+
+#define INSERT_BATCH_INITIAL_ROWS 16
+
+/// @brief Room for one row of a batch on a table made with create table: its length, then its record
+/// @param s 
+/// @return 
+uint32_t batch_record_slot_size(schema* s) {
+    return sizeof(uint16_t) + max_record_size(s);
+}
+
+/// @brief Add a row of insert (...), (...) to the statement's batch
+/// @param stmt 
+/// @param values one for each column of the table, none of them ?
+/// @param capacity rows the batch has room for, grown as needed
+/// @return 
+prepare_result add_batch_row(statement* stmt, char** values, uint32_t* capacity) {
+    bool users = is_users_table(stmt->table);
+    schema* s = stmt->table->schema;
+    if (stmt->batch_count == *capacity) {
+        *capacity = *capacity == 0 ? INSERT_BATCH_INITIAL_ROWS : *capacity * 2;
+        if (users) {
+            stmt->batch = realloc(stmt->batch, *capacity * sizeof(row));
+        } else {
+            stmt->records = realloc(stmt->records, *capacity * batch_record_slot_size(s));
+        }
+    }
+
+    if (users) {
+        if (strlen(values[1]) > COLUMN_USERNAME_SIZE || strlen(values[2]) > COLUMN_EMAIL_SIZE) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        row* r = &stmt->batch[stmt->batch_count];
+        prepare_result result = parse_id(values[0], &r->id);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        strcpy(r->user_name, values[1]);
+        strcpy(r->email, values[2]);
+    } else {
+        for (uint32_t i = 0; i < s->column_count; i++) {
+            prepare_result result = parse_column_value(stmt, i, values[i]);
+            if (result != PREPARE_SUCCESS) {
+                return result;
+            }
+        }
+        uint8_t* slot = stmt->records + stmt->batch_count * batch_record_slot_size(s);
+        uint16_t length = serialize_row_values(s, stmt->values, slot + sizeof(uint16_t));
+        memcpy(slot, &length, sizeof(uint16_t));
+    }
+    stmt->batch_count++;
+    return PREPARE_SUCCESS;
+}
+
+/// @brief The rows of insert (v1, v2, ...), (v1, v2, ...), ... with a value for each column
+/// @param values text after the keyword
+/// @param stmt 
+/// @return 
+prepare_result prepare_insert_values(char* values, statement* stmt) {
+    uint32_t column_count = stmt->table->schema->column_count;
+    uint32_t capacity = 0;
+    stmt->batch_count = 0;
+
+    prepare_result result = PREPARE_SUCCESS;
+    char* p = values;
+    for (;;) {
+        while (*p == ' ') {
+            p++;
+        }
+        char* end = strchr(p, ')');
+        if (*p != '(' || end == NULL) {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+        *end = '\0';
+
+        char* tokens[TABLE_MAX_COLUMNS];
+        uint32_t count = 0;
+        char* token = strtok(p + 1, " ,");
+        while (token != NULL && count < column_count && !is_param(token)) {
+            tokens[count++] = token;
+            token = strtok(NULL, " ,");
+        }
+        if (token != NULL || count < column_count) {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+        if ((result = add_batch_row(stmt, tokens, &capacity)) != PREPARE_SUCCESS) {
+            break;
+        }
+
+        p = end + 1;
+        while (*p == ' ') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (*p++ != ',') {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+    }
+
+    if (result != PREPARE_SUCCESS) {
+        free(stmt->batch);
+        free(stmt->records);
+        stmt->batch = NULL;
+        stmt->records = NULL;
+    }
+    return result;
+}
+
+/// @brief insert into NAME with a value for each column, any of them may be ?,
+///        commas between them are optional
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_insert_columns(char* input, statement* stmt) {
+    schema* s = stmt->table->schema;
+    strtok(input, " ");     // the keyword
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        prepare_result result = parse_column_value(stmt, i, strtok(NULL, " ,"));
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    }
+    return strtok(NULL, " ,") == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/// @brief insert id user_name email, any of them may be ?, commas between them are optional,
+///        or insert (id, user_name, email), ... for several rows at once
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_insert(char* input, statement* stmt) {
+    stmt->type = STATEMENT_INSERT;
+    char* values = input + strlen("insert");
+    while (*values == ' ') {
+        values++;
+    }
+    if (*values == '(') {
+        return prepare_insert_values(values, stmt);
+    }
+    if (!is_users_table(stmt->table)) {
+        return prepare_insert_columns(input, stmt);
+    }
+
+    strtok(input, " ");     // the keyword
+    char* id_str = strtok(NULL, " ,");
+    char* user_name = strtok(NULL, " ,");
+    char* email = strtok(NULL, " ,");
+
+    if (id_str == NULL || user_name == NULL || email == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (is_param(id_str)) {
+        add_param(stmt, PARAM_ID);
+    } else {
+        int id = atoi(id_str);
+        if (id < 0) {
+            return PREPARE_NEGATIVE_ID;
+        }
+        stmt->row_to_insert.id = id;
+    }
+
+    if (is_param(user_name)) {
+        add_param(stmt, PARAM_USER_NAME);
+    } else if (strlen(user_name) > COLUMN_USERNAME_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    } else {
+        strcpy(stmt->row_to_insert.user_name, user_name);
+    }
+
+    if (is_param(email)) {
+        add_param(stmt, PARAM_EMAIL);
+    } else if (strlen(email) > COLUMN_EMAIL_SIZE) {
+        return PREPARE_STRING_TOO_LONG;
+    } else {
+        strcpy(stmt->row_to_insert.email, email);
+    }
+
+    return PREPARE_SUCCESS;
+}
+
+/// @brief An id literal, or a ? that fills target when bound
+/// @param stmt 
+/// @param str 
+/// @param id 
+/// @param target 
+/// @return 
+prepare_result parse_id_operand(statement* stmt, char* str, uint32_t* id, param_target target) {
+    if (is_param(str)) {
+        return add_param(stmt, target);
+    }
+    return parse_id(str, id);
+}
+
+/// @brief Column named by token, INDEX_COUNT if it isn't user_name or email
+/// @param token 
+/// @return 
+index_column parse_index_column(const char* token) {
+    for (uint32_t i = 0; i < INDEX_COUNT; i++) {
+        if (strcmp(token, INDEX_COLUMN_NAMES[i]) == 0) {
+            return i;
+        }
+    }
+    return INDEX_COUNT;
+}
+
+/// @brief Drop the single quotes around a string, if it has them
+/// @param str 
+/// @return 
+char* unquote(char* str) {
+    size_t length = strlen(str);
+    if (length >= 2 && str[0] == '\'' && str[length - 1] == '\'') {
+        str[length - 1] = '\0';
+        return str + 1;
+    }
+    return str;
+}
+
+/// @brief Parse "where user_name = X" or "where email = X", X may be quoted
+/// @param stmt 
+/// @param column 
+/// @return 
+prepare_result prepare_where_value(statement* stmt, index_column column) {
+    char* op = strtok(NULL, " ");
+    char* value = strtok(NULL, " ");
+    if (op == NULL || value == NULL || strcmp(op, "=") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    stmt->column = column;
+    if (is_param(value)) {
+        return add_param(stmt, PARAM_VALUE);
+    }
+    value = unquote(value);
+    if (strlen(value) > (column == INDEX_USER_NAME ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE)) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    strcpy(stmt->value, value);
+    return PREPARE_SUCCESS;
+}
+
+/// @brief Parse an optional "where id = N" or "where id between A and B" into the id bounds,
+///        id being whatever the table's key column is called
+/// @param stmt 
+/// @param token current token, left on the first one after the clause
+/// @param by_value also take "where user_name = X" or "where email = X"
+/// @return 
+prepare_result prepare_where(statement* stmt, char** token, bool by_value) {
+    stmt->lower_id = 0;
+    stmt->upper_id = UINT32_MAX;
+    stmt->column = INDEX_COUNT;
+    if (*token == NULL || strcmp(*token, "where") != 0) {
+        return PREPARE_SUCCESS;
+    }
+
+    char* column = strtok(NULL, " ");
+    if (column != NULL && by_value && parse_index_column(column) != INDEX_COUNT) {
+        prepare_result result = prepare_where_value(stmt, parse_index_column(column));
+        *token = strtok(NULL, " ");
+        return result;
+    }
+
+    char* op = strtok(NULL, " ");
+    if (column == NULL || op == NULL || strcmp(column, stmt->table->schema->columns[0].name) != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    prepare_result result;
+    if (strcmp(op, "=") == 0) {
+        if ((result = parse_id_operand(stmt, strtok(NULL, " "), &stmt->lower_id, PARAM_EQUAL_ID)) != PREPARE_SUCCESS) {
+            return result;
+        }
+        stmt->upper_id = stmt->lower_id;
+    } else if (strcmp(op, "between") == 0) {
+        if ((result = parse_id_operand(stmt, strtok(NULL, " "), &stmt->lower_id, PARAM_LOWER_ID)) != PREPARE_SUCCESS) {
+            return result;
+        }
+        char* and_token = strtok(NULL, " ");
+        if (and_token == NULL || strcmp(and_token, "and") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if ((result = parse_id_operand(stmt, strtok(NULL, " "), &stmt->upper_id, PARAM_UPPER_ID)) != PREPARE_SUCCESS) {
+            return result;
+        }
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    *token = strtok(NULL, " ");
+    return PREPARE_SUCCESS;
+}
+
+/// @brief select [where ...] [limit N]
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_select(char* input, statement* stmt) {
+    stmt->type = STATEMENT_SELECT;
+    stmt->limit = SELECT_NO_LIMIT;
+
+    char* keyword = strtok(input, " ");
+    if (strcmp(keyword, "select") != 0) {
+        return PREPARE_FAIL;
+    }
+
+    char* token = strtok(NULL, " ");
+    prepare_result result = prepare_where(stmt, &token, is_users_table(stmt->table));
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+
+    if (token != NULL && strcmp(token, "limit") == 0) {
+        if (parse_id_operand(stmt, strtok(NULL, " "), &stmt->limit, PARAM_LIMIT) != PREPARE_SUCCESS) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+    }
+
+    return token == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/// @brief delete [where ...]
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_delete(char* input, statement* stmt) {
+    stmt->type = STATEMENT_DELETE;
+
+    char* keyword = strtok(input, " ");
+    if (strcmp(keyword, "delete") != 0) {
+        return PREPARE_FAIL;
+    }
+
+    char* token = strtok(NULL, " ");
+    prepare_result result = prepare_where(stmt, &token, false);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+
+    return token == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/// @brief Position of a column in a schema
+/// @param s 
+/// @param name 
+/// @return column_count if the schema has no such column
+uint32_t find_column(schema* s, const char* name) {
+    for (uint32_t i = 0; i < s->column_count; i++) {
+        if (strcmp(s->columns[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return s->column_count;
+}
+
+/// @brief update NAME set column = X [,] ... [where ...] on a table made with create table,
+///        any column but the key may be set
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_update_columns(char* input, statement* stmt) {
+    schema* s = stmt->table->schema;
+    stmt->set_columns = 0;
+
+    strtok(input, " ");     // the keyword
+    char* set = strtok(NULL, " ");
+    if (set == NULL || strcmp(set, "set") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    prepare_result result;
+    char* token = strtok(NULL, " ,");
+    while (token != NULL && strcmp(token, "where") != 0) {
+        uint32_t column = find_column(s, token);
+        char* op = strtok(NULL, " ");
+        if (column == 0 || column == s->column_count || op == NULL || strcmp(op, "=") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if ((result = parse_column_value(stmt, column, strtok(NULL, " ,"))) != PREPARE_SUCCESS) {
+            return result;
+        }
+        stmt->set_columns |= 1u << column;
+        token = strtok(NULL, " ,");
+    }
+
+    if (stmt->set_columns == 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    result = prepare_where(stmt, &token, false);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+
+    return token == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/// @brief update set user_name = X [,] email = Y [where ...], either column may be left out
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_update(char* input, statement* stmt) {
+    stmt->type = STATEMENT_UPDATE;
+    stmt->set_user_name = false;
+    stmt->set_email = false;
+    if (!is_users_table(stmt->table)) {
+        return prepare_update_columns(input, stmt);
+    }
+
+    char* keyword = strtok(input, " ");
+    char* set = strtok(NULL, " ");
+    if (strcmp(keyword, "update") != 0 || set == NULL || strcmp(set, "set") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    char* token = strtok(NULL, " ,");
+    while (token != NULL && strcmp(token, "where") != 0) {
+        char* op = strtok(NULL, " ");
+        char* value = strtok(NULL, " ,");
+        if (op == NULL || value == NULL || strcmp(op, "=") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        if (strcmp(token, "user_name") == 0) {
+            if (is_param(value)) {
+                add_param(stmt, PARAM_USER_NAME);
+            } else if (strlen(value) > COLUMN_USERNAME_SIZE) {
+                return PREPARE_STRING_TOO_LONG;
+            } else {
+                strcpy(stmt->row_to_insert.user_name, value);
+            }
+            stmt->set_user_name = true;
+        } else if (strcmp(token, "email") == 0) {
+            if (is_param(value)) {
+                add_param(stmt, PARAM_EMAIL);
+            } else if (strlen(value) > COLUMN_EMAIL_SIZE) {
+                return PREPARE_STRING_TOO_LONG;
+            } else {
+                strcpy(stmt->row_to_insert.email, value);
+            }
+            stmt->set_email = true;
+        } else {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ,");
+    }
+
+    if (!stmt->set_user_name && !stmt->set_email) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    prepare_result result = prepare_where(stmt, &token, false);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+
+    return token == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/// @brief create index on user_name|email
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_create_index(char* input, statement* stmt) {
+    stmt->type = STATEMENT_CREATE_INDEX;
+
+    char* keyword = strtok(input, " ");
+    char* index = strtok(NULL, " ");
+    char* on = strtok(NULL, " ");
+    char* column = strtok(NULL, " ");
+    if (strcmp(keyword, "create") != 0 || index == NULL || strcmp(index, "index") != 0
+            || on == NULL || strcmp(on, "on") != 0 || column == NULL || strtok(NULL, " ") != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    stmt->column = parse_index_column(column);
+    return stmt->column == INDEX_COUNT ? PREPARE_SYNTAX_ERROR : PREPARE_SUCCESS;
+}
+
+/// @brief Table and column names are letters, digits and '_', and don't start with a digit
+/// @param name 
+/// @return 
+bool is_valid_name(const char* name) {
+    size_t length = strlen(name);
+    if (length == 0 || length > TABLE_NAME_SIZE || isdigit((unsigned char)name[0])) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Add "name int", "name text" or "name text(N)" to a schema
+/// @param s 
+/// @param def 
+/// @return 
+prepare_result parse_column_def(schema* s, char* def) {
+    char* name = strtok(def, " ");
+    char* type = strtok(NULL, " ");
+    if (name == NULL || type == NULL || strtok(NULL, " ") != NULL
+            || !is_valid_name(name) || find_column(s, name) != s->column_count) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    column_def* column = &s->columns[s->column_count];
+    int size = COLUMN_TEXT_MAX_SIZE;
+    int length = 0;
+    if (strcmp(type, "int") == 0) {
+        column->type = COLUMN_INT;
+        size = 0;
+    } else if (strcmp(type, "text") == 0
+            || (sscanf(type, "text(%d)%n", &size, &length) == 1 && length > 0 && type[length] == '\0')) {
+        column->type = COLUMN_TEXT;
+        if (size < 1 || size > COLUMN_TEXT_MAX_SIZE) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    } else {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    strcpy(column->name, name);
+    column->size = size;
+    s->column_count++;
+    return PREPARE_SUCCESS;
+}
+
+/// @brief create table NAME (column type, ...), the first column is an int and is the key
+/// @param input 
+/// @param stmt 
+/// @return 
+prepare_result prepare_create_table(char* input, statement* stmt) {
+    stmt->type = STATEMENT_CREATE_TABLE;
+
+    // text(N) has parentheses of its own
+    char* open = strchr(input, '(');
+    char* close = strrchr(input, ')');
+    if (open == NULL || close == NULL || close < open || close[1 + strspn(close + 1, " ")] != '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *open = '\0';
+    *close = '\0';
+
+    strtok(input, " ");     // the keyword
+    char* table_keyword = strtok(NULL, " ");
+    char* name = strtok(NULL, " ");
+    if (strcmp(table_keyword, "table") != 0 || name == NULL || strtok(NULL, " ") != NULL || !is_valid_name(name)) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    schema* s = calloc(1, sizeof(schema));
+    stmt->new_schema = s;
+    strcpy(s->name, name);
+    char* def = open + 1;
+    for (;;) {
+        char* comma = strchr(def, ',');
+        if (comma != NULL) {
+            *comma = '\0';
+        }
+        if (s->column_count == TABLE_MAX_COLUMNS) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        prepare_result result = parse_column_def(s, def);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        if (comma == NULL) {
+            break;
+        }
+        def = comma + 1;
+    }
+
+    if (s->columns[0].type != COLUMN_INT) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return max_record_size(s) > ROW_SIZE ? PREPARE_ROW_TOO_LARGE : PREPARE_SUCCESS;
+}
+
+/// @brief Resolve the table of "insert into NAME", "select from NAME", "delete from NAME" or
+///        "update NAME set" and cut the clause out, which leaves the statement as it reads
+///        for the users table. Statements without the clause are on the users table.
+/// @param input 
+/// @param preposition into or from, NULL for update
+/// @param users 
+/// @param stmt 
+/// @return 
+prepare_result prepare_table_name(char* input, const char* preposition, table* users, statement* stmt) {
+    char* clause = input + strcspn(input, " ");
+    char* p = clause + strspn(clause, " ");
+    if (preposition != NULL) {
+        size_t length = strlen(preposition);
+        if (strncmp(p, preposition, length) != 0 || (p[length] != ' ' && p[length] != '\0')) {
+            return PREPARE_SUCCESS;
+        }
+        p += length;
+        p += strspn(p, " ");
+    }
+
+    size_t length = strcspn(p, " ");
+    if (preposition == NULL && (length == 0 || strncmp(p, "set ", 4) == 0 || strcmp(p, "set") == 0)) {
+        return PREPARE_SUCCESS;
+    }
+    if (length == 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (length > TABLE_NAME_SIZE) {
+        return PREPARE_NO_SUCH_TABLE;
+    }
+
+    char name[TABLE_NAME_SIZE + 1];
+    memcpy(name, p, length);
+    name[length] = '\0';
+    stmt->table = find_table_by_name(users, name);
+    if (stmt->table == NULL) {
+        return PREPARE_NO_SUCH_TABLE;
+    }
+    memmove(clause, p + length, strlen(p + length) + 1);
+
+    if (!is_users_table(stmt->table)) {
+        stmt->values = alloc_row_values(stmt->table->schema);
+        stmt->current = alloc_row_values(stmt->table->schema);
+    }
+    return PREPARE_SUCCESS;
+}
+
+prepare_result prepare_statement(char* input, statement* stmt, table* users) {
+    stmt->param_count = 0;
+    stmt->batch = NULL;
+    stmt->batch_count = 0;
+    stmt->column = INDEX_COUNT;
+    stmt->table = users;
+    stmt->values = NULL;
+    stmt->current = NULL;
+    stmt->records = NULL;
+    stmt->new_schema = NULL;
+    prepare_result result;
+
+    if (strncmp(input, "insert", 6) == 0) {
+        result = prepare_table_name(input, "into", users, stmt);
+        return result == PREPARE_SUCCESS ? prepare_insert(input, stmt) : result;
+    }
+
+    if (strncmp(input, "select", 6) == 0) {
+        result = prepare_table_name(input, "from", users, stmt);
+        return result == PREPARE_SUCCESS ? prepare_select(input, stmt) : result;
+    }
+
+    if (strncmp(input, "delete", 6) == 0) {
+        result = prepare_table_name(input, "from", users, stmt);
+        return result == PREPARE_SUCCESS ? prepare_delete(input, stmt) : result;
+    }
+
+    if (strncmp(input, "update", 6) == 0) {
+        result = prepare_table_name(input, NULL, users, stmt);
+        return result == PREPARE_SUCCESS ? prepare_update(input, stmt) : result;
+    }
+
+    if (strncmp(input, "create table", 12) == 0) {
+        return prepare_create_table(input, stmt);
+    }
+
+    if (strncmp(input, "create", 6) == 0) {
+        return prepare_create_index(input, stmt);
+    }
+
+    if (strcmp(input, "begin") == 0) {
+        stmt->type = STATEMENT_BEGIN;
+        return PREPARE_SUCCESS;
+    }
+
+    if (strcmp(input, "commit") == 0) {
+        stmt->type = STATEMENT_COMMIT;
+        return PREPARE_SUCCESS;
+    }
+
+    if (strcmp(input, "rollback") == 0) {
+        stmt->type = STATEMENT_ROLLBACK;
+        return PREPARE_SUCCESS;
+    }
+
+    return PREPARE_FAIL;
+}
+
+execute_result execute_insert(statement* stmt, table* tbl) {
+    if (!is_users_table(tbl)) {
+        schema* s = tbl->schema;
+        if (stmt->records != NULL) {
+            return insert_records(tbl, stmt->records, stmt->batch_count, batch_record_slot_size(s));
+        }
+        pager_set_access_hint(tbl->pager, ACCESS_RANDOM);
+        uint8_t record[ROW_SIZE];
+        uint16_t length = serialize_row_values(s, stmt->values, record);
+        return insert_record(tbl, stmt->values->numbers[0], record, length);
+    }
+
+    if (stmt->batch != NULL) {
+        // Sorting in place is harmless, a rerun inserts the same rows
+        uint32_t done, duplicates;
+        return insert_batch(tbl, stmt->batch, stmt->batch_count, &done, &duplicates);
+    }
+
+    pager_set_access_hint(tbl->pager, ACCESS_RANDOM);
+    return insert_row(tbl, &stmt->row_to_insert);
+}
+
+/// @brief Delete the rows in the statement's id range and their index entries.
+///        A delete that dirties many pages commits part way, like a batch insert,
+///        unless a transaction is open.
+/// @param stmt 
+/// @param tbl 
+/// @return EXECUTE_SUCCESS, or EXECUTE_TRANSACTION_FULL if the open transaction filled up before the last row
+execute_result execute_delete(statement* stmt, table* tbl) {
+    pager* pg = tbl->pager;
+    pager_set_access_hint(pg, ACCESS_RANDOM);
+    uint32_t lower_id = stmt->lower_id;
+    bool indexed = table_has_indexes(tbl);
+
+    // Seek again after every row, rebalancing can move rows off or free the page the cursor was on
+    for (;;) {
+        if (pager_transaction_full(pg)) {
+            return EXECUTE_TRANSACTION_FULL;
+        }
+        cursor cur;
+        seek_table(tbl, lower_id, &cur);
+        if (cur.end_of_table || get_cursor_key(&cur) > stmt->upper_id) {
+            close_cursor(&cur);
+            break;
+        }
+
+        uint32_t key = get_cursor_key(&cur);
+        row old;
+        if (indexed) {
+            deserialize_row(get_cursor_value(&cur), &old);
+        }
+        bool underflow = delete_cursor_row(&cur);
+        close_cursor(&cur);
+        if (underflow) {
+            rebalance_leaf_node(tbl, key);
+        }
+        if (indexed) {
+            update_index_entries(tbl, &old, NULL);
+        }
+
+        // Inside a transaction everything waits for its commit
+        if (!pg->in_transaction && pg->pending_count >= pager_commit_threshold(pg) / 2) {
+            pager_commit(pg);
+        }
+        if (key == UINT32_MAX) {
+            break;
+        }
+        lower_id = key + 1;
+    }
+
+    return EXECUTE_SUCCESS;
+}
+
+/// @brief Update the users row at the cursor and its index entries, closing the cursor
+/// @param stmt 
+/// @param cur 
+void update_row_at_cursor(statement* stmt, cursor* cur) {
+    table* tbl = cur->table;
+    row old, row;
+    deserialize_row(get_cursor_value(cur), &row);
+    old = row;
+    if (stmt->set_user_name) {
+        strcpy(row.user_name, stmt->row_to_insert.user_name);
+    }
+    if (stmt->set_email) {
+        strcpy(row.email, stmt->row_to_insert.email);
+    }
+    update_cursor_row(cur, &row);
+    close_cursor(cur);
+    update_index_entries(tbl, &old, &row);
+}
+
+/// @brief Update the row of a table made with create table at the cursor, closing the cursor
+/// @param stmt 
+/// @param cur 
+void update_values_at_cursor(statement* stmt, cursor* cur) {
+    schema* s = cur->table->schema;
+    row_values* v = stmt->current;
+    deserialize_row_values(s, get_cursor_value(cur), v);
+    for (uint32_t i = 1; i < s->column_count; i++) {
+        if (!(stmt->set_columns & (1u << i))) {
+            continue;
+        }
+        if (s->columns[i].type == COLUMN_INT) {
+            v->numbers[i] = stmt->values->numbers[i];
+        } else {
+            strcpy(v->texts[i], stmt->values->texts[i]);
+        }
+    }
+
+    uint8_t record[ROW_SIZE];
+    uint16_t length = serialize_row_values(s, v, record);
+    update_cursor_record(cur, record, length);
+    close_cursor(cur);
+}
+
+/// @brief Update the rows in the statement's id range and their index entries.
+///        An update that dirties many pages commits part way, like a batch insert,
+///        unless a transaction is open.
+/// @param stmt 
+/// @param tbl 
+/// @return EXECUTE_SUCCESS, or EXECUTE_TRANSACTION_FULL if the open transaction filled up before the last row
+execute_result execute_update(statement* stmt, table* tbl) {
+    pager* pg = tbl->pager;
+    pager_set_access_hint(pg, ACCESS_RANDOM);
+    uint32_t lower_id = stmt->lower_id;
+    bool users = is_users_table(tbl);
+
+    // Seek again after every row, a record that outgrows its leaf splits it
+    for (;;) {
+        if (pager_transaction_full(pg)) {
+            return EXECUTE_TRANSACTION_FULL;
+        }
+        cursor cur;
+        seek_table(tbl, lower_id, &cur);
+        if (cur.end_of_table || get_cursor_key(&cur) > stmt->upper_id) {
+            close_cursor(&cur);
+            break;
+        }
+
+        uint32_t key = get_cursor_key(&cur);
+        if (!users) {
+            update_values_at_cursor(stmt, &cur);
+        } else {
+            update_row_at_cursor(stmt, &cur);
+        }
+
+        // Inside a transaction everything waits for its commit
+        if (!pg->in_transaction && pg->pending_count >= pager_commit_threshold(pg) / 2) {
+            pager_commit(pg);
+        }
+        if (key == UINT32_MAX) {
+            break;
+        }
+        lower_id = key + 1;
+    }
+
+    return EXECUTE_SUCCESS;
+}
+
+/*
+    Finalized statements are kept per connection, keyed by their SQL text,
+    so preparing the same text again skips parsing and allocation.
+
+    Threads may share a connection. Selects read through snapshots side by
+    side, everything that writes takes write_lock and runs one at a time.
+*/
+#define STATEMENT_CACHE_SIZE 16
+
+// The parser tokenizes with strtok
+pthread_mutex_t parse_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct tdb {
+    table* table;
+    tdb_stmt* cache[STATEMENT_CACHE_SIZE];  // least recently finalized first
+    uint32_t cache_count;
+    pthread_mutex_t cache_lock;
+    pthread_mutex_t write_lock;
+
+    // Background checkpoints, when checkpoint_interval_ms isn't 0
+    uint32_t checkpoint_interval_ms;
+    uint32_t checkpoint_pages;
+    pthread_t checkpointer;
+    pthread_mutex_t checkpointer_lock;
+    pthread_cond_t checkpointer_wake;   // signalled on close
+    bool closing;
+};
+
+struct tdb_stmt {
+    tdb* db;
+    char* sql;
+    statement stmt;
+    uint32_t bound;             // bit i is set once parameter i + 1 has a value
+    cursor cur;                 // select: the next row, or the next entry of an index
+    uint8_t* leaf;              // select: the cursor's copy of its leaf
+    uint8_t* row_leaf;          // select by value: where rows found through an index are read
+    bool cursor_open;
+    bool via_index;             // select by value: the cursor walks the index's bucket for the value
+    uint32_t rows_returned;
+    bool done;
+    tdb_row own_row;            // select: where a row goes when tdb_step is given none
+    tdb_row* row;               // select on the users table: the row last handed out
+};
+
+/// @brief Throw away the changes of the open transaction
+/// @param tbl 
+void rollback_transaction(table* tbl) {
+    pager* pg = tbl->pager;
+    __atomic_store_n(&pg->in_transaction, false, __ATOMIC_RELEASE);
+    pager_rollback(pg);
+
+    // Roots may have moved, or an index been created, since the last commit
+    void* header = get_page(pg, DB_HEADER_PAGE_NUM);
+    load_root_page_nums(tbl, header);
+    unpin_page(pg, DB_HEADER_PAGE_NUM);
+}
+
+/// @brief begin, commit or rollback
+/// @param stmt 
+/// @param tbl 
+/// @return 
+execute_result execute_transaction(statement* stmt, table* tbl) {
+    pager* pg = tbl->pager;
+    if (stmt->type == STATEMENT_BEGIN) {
+        if (pg->in_transaction) {
+            return EXECUTE_TRANSACTION_OPEN;
+        }
+        __atomic_store_n(&pg->in_transaction, true, __ATOMIC_RELEASE);
+        return EXECUTE_SUCCESS;
+    }
+
+    if (!pg->in_transaction) {
+        return EXECUTE_NO_TRANSACTION;
+    }
+    if (stmt->type == STATEMENT_COMMIT) {
+        __atomic_store_n(&pg->in_transaction, false, __ATOMIC_RELEASE);
+        pager_commit(pg);
+    } else {
+        rollback_transaction(tbl);
+    }
+    return EXECUTE_SUCCESS;
+}
+
+void tdb_default_config(tdb_config* cfg) {
+    cfg->mode = TDB_PAGER_BUFFERED;
+    cfg->pool_frames = DEFAULT_POOL_FRAMES;
+    cfg->wal_sync_window_ms = 0;
+    cfg->compress = false;
+    cfg->checkpoint_interval_ms = 0;
+    cfg->checkpoint_pages = DEFAULT_CHECKPOINT_PAGES;
+}
+
+/// @brief Write back a few pages every checkpoint_interval_ms until the connection closes
+/// @param arg the connection
+/// @return 
+void* run_checkpointer(void* arg) {
+    tdb* db = arg;
+    pthread_mutex_lock(&db->checkpointer_lock);
+    while (!db->closing) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        uint64_t ns = until.tv_nsec + (uint64_t)db->checkpoint_interval_ms * 1000000;
+        until.tv_sec += ns / 1000000000;
+        until.tv_nsec = ns % 1000000000;
+        while (!db->closing && pthread_cond_timedwait(&db->checkpointer_wake, &db->checkpointer_lock, &until) != ETIMEDOUT) {
+        }
+        if (db->closing) {
+            break;
+        }
+        pthread_mutex_unlock(&db->checkpointer_lock);
+
+        // The table's pager is another one after a vacuum
+        pthread_mutex_lock(&db->write_lock);
+        pager_write_back(db->table->pager, db->checkpoint_pages);
+        pthread_mutex_unlock(&db->write_lock);
+
+        pthread_mutex_lock(&db->checkpointer_lock);
+    }
+    pthread_mutex_unlock(&db->checkpointer_lock);
+    return NULL;
+}
+
+tdb* tdb_open(const char* file_name, const tdb_config* cfg) {
+    tdb_config defaults;
+    if (cfg == NULL) {
+        tdb_default_config(&defaults);
+        cfg = &defaults;
+    }
+
+    tdb* db = malloc(sizeof(tdb));
+    db->table = open_db(file_name, cfg);
+    db->cache_count = 0;
+    pthread_mutex_init(&db->cache_lock, NULL);
+    pthread_mutex_init(&db->write_lock, NULL);
+
+    db->checkpoint_interval_ms = cfg->checkpoint_interval_ms;
+    db->checkpoint_pages = cfg->checkpoint_pages == 0 ? DEFAULT_CHECKPOINT_PAGES : cfg->checkpoint_pages;
+    db->closing = false;
+    pthread_mutex_init(&db->checkpointer_lock, NULL);
+    pthread_cond_init(&db->checkpointer_wake, NULL);
+    if (db->checkpoint_interval_ms > 0) {
+        pthread_create(&db->checkpointer, NULL, run_checkpointer, db);
+    }
+    return db;
+}
+
+void free_statement(statement* stmt) {
+    free(stmt->batch);
+    free(stmt->records);
+    free(stmt->values);
+    free(stmt->current);
+    free(stmt->new_schema);
+}
+
+void free_stmt(tdb_stmt* st) {
+    free_statement(&st->stmt);
+    free(st->leaf);
+    free(st->row_leaf);
+    free(st->sql);
+    free(st);
+}
+
+void tdb_close(tdb* db) {
+    if (db->checkpoint_interval_ms > 0) {
+        pthread_mutex_lock(&db->checkpointer_lock);
+        db->closing = true;
+        pthread_cond_signal(&db->checkpointer_wake);
+        pthread_mutex_unlock(&db->checkpointer_lock);
+        pthread_join(db->checkpointer, NULL);
+    }
+    for (uint32_t i = 0; i < db->cache_count; i++) {
+        free_stmt(db->cache[i]);
+    }
+    if (db->table->pager->in_transaction) {
+        // As after a crash, nothing of an unfinished transaction is kept
+        rollback_transaction(db->table);
+    }
+    close_db(db->table);
+    pthread_mutex_destroy(&db->cache_lock);
+    pthread_mutex_destroy(&db->write_lock);
+    pthread_mutex_destroy(&db->checkpointer_lock);
+    pthread_cond_destroy(&db->checkpointer_wake);
+    free(db);
+}
+
+void reset_stmt(tdb_stmt* st) {
+    if (st->cursor_open) {
+        close_cursor(&st->cur);
+        st->cursor_open = false;
+    }
+    st->rows_returned = 0;
+    st->done = false;
+}
+
+tdb_result tdb_prepare(tdb* db, const char* sql, tdb_stmt** stmt) {
+    pthread_mutex_lock(&db->cache_lock);
+    for (uint32_t i = db->cache_count; i-- > 0;) {
+        tdb_stmt* cached = db->cache[i];
+        if (strcmp(cached->sql, sql) == 0) {
+            memmove(&db->cache[i], &db->cache[i + 1], (db->cache_count - i - 1) * sizeof(tdb_stmt*));
+            db->cache_count--;
+            pthread_mutex_unlock(&db->cache_lock);
+            cached->bound = 0;
+            *stmt = cached;
+            return TDB_OK;
+        }
+    }
+    pthread_mutex_unlock(&db->cache_lock);
+
+    // The parser tokenizes in place
+    char* input = malloc(strlen(sql) + 1);
+    strcpy(input, sql);
+
+    tdb_stmt* st = malloc(sizeof(tdb_stmt));
+    pthread_mutex_lock(&parse_lock);
+    prepare_result result = prepare_statement(input, &st->stmt, db->table);
+    pthread_mutex_unlock(&parse_lock);
+    free(input);
+
+    if (result != PREPARE_SUCCESS) {
+        free_statement(&st->stmt);
+        free(st);
+        switch (result) {
+            case PREPARE_SYNTAX_ERROR:
+                return TDB_SYNTAX_ERROR;
+            case PREPARE_STRING_TOO_LONG:
+                return TDB_STRING_TOO_LONG;
+            case PREPARE_NEGATIVE_ID:
+                return TDB_NEGATIVE_ID;
+            case PREPARE_NO_SUCH_TABLE:
+                return TDB_NO_SUCH_TABLE;
+            case PREPARE_ROW_TOO_LARGE:
+                return TDB_ROW_TOO_LARGE;
+            default:
+                return TDB_UNRECOGNIZED;
+        }
+    }
+
+    st->db = db;
+    st->leaf = st->stmt.type == STATEMENT_SELECT ? malloc(PAGE_SIZE) : NULL;
+    st->row_leaf = st->stmt.type == STATEMENT_SELECT && st->stmt.column != INDEX_COUNT ? malloc(PAGE_SIZE) : NULL;
+    st->sql = malloc(strlen(sql) + 1);
+    strcpy(st->sql, sql);
+    st->bound = 0;
+    st->cursor_open = false;
+    st->row = &st->own_row;
+    reset_stmt(st);
+    *stmt = st;
+    return TDB_OK;
+}
+
+tdb_result tdb_bind_int(tdb_stmt* st, uint32_t index, int64_t value) {
+    statement* stmt = &st->stmt;
+    if (index < 1 || index > stmt->param_count) {
+        return TDB_MISUSE;
+    }
+
+    param_target target = stmt->params[index - 1];
+    if (target > PARAM_COLUMN) {
+        // An int column other than the key, which takes any 32 bit value
+        uint32_t column = target - PARAM_COLUMN;
+        if (stmt->table->schema->columns[column].type != COLUMN_INT || value < INT32_MIN || value > INT32_MAX) {
+            return TDB_MISUSE;
+        }
+        stmt->values->numbers[column] = value;
+        st->bound |= 1u << (index - 1);
+        return TDB_OK;
+    }
+    if (value < 0) {
+        return TDB_NEGATIVE_ID;
+    }
+
+    uint32_t id = value > UINT32_MAX ? UINT32_MAX : value;
+    switch (target) {
+        case PARAM_ID:
+            stmt->row_to_insert.id = id;
+            break;
+        case PARAM_COLUMN:
+            stmt->values->numbers[0] = id;
+            break;
+        case PARAM_LOWER_ID:
+            stmt->lower_id = id;
+            break;
+        case PARAM_UPPER_ID:
+            stmt->upper_id = id;
+            break;
+        case PARAM_EQUAL_ID:
+            stmt->lower_id = id;
+            stmt->upper_id = id;
+            break;
+        case PARAM_LIMIT:
+            stmt->limit = id;
+            break;
+        default:
+            return TDB_MISUSE;
+    }
+    st->bound |= 1u << (index - 1);
+    return TDB_OK;
+}
+
+tdb_result tdb_bind_text(tdb_stmt* st, uint32_t index, const char* value) {
+    statement* stmt = &st->stmt;
+    if (index < 1 || index > stmt->param_count) {
+        return TDB_MISUSE;
+    }
+
+    size_t length = strlen(value);
+    param_target target = stmt->params[index - 1];
+    if (target >= PARAM_COLUMN) {
+        column_def* column = &stmt->table->schema->columns[target - PARAM_COLUMN];
+        if (column->type != COLUMN_TEXT) {
+            return TDB_MISUSE;
+        }
+        if (length > column->size) {
+            return TDB_STRING_TOO_LONG;
+        }
+        memcpy(stmt->values->texts[target - PARAM_COLUMN], value, length + 1);
+        st->bound |= 1u << (index - 1);
+        return TDB_OK;
+    }
+
+    switch (target) {
+        case PARAM_USER_NAME:
+            if (length > COLUMN_USERNAME_SIZE) {
+                return TDB_STRING_TOO_LONG;
+            }
+            memcpy(stmt->row_to_insert.user_name, value, length + 1);
+            break;
+        case PARAM_EMAIL:
+            if (length > COLUMN_EMAIL_SIZE) {
+                return TDB_STRING_TOO_LONG;
+            }
+            memcpy(stmt->row_to_insert.email, value, length + 1);
+            break;
+        case PARAM_VALUE:
+            if (length > (stmt->column == INDEX_USER_NAME ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE)) {
+                return TDB_STRING_TOO_LONG;
+            }
+            memcpy(stmt->value, value, length + 1);
+            break;
+        default:
+            return TDB_MISUSE;
+    }
+    st->bound |= 1u << (index - 1);
+    return TDB_OK;
+}
+
+void tdb_reset(tdb_stmt* st) {
+    reset_stmt(st);
+}
+
+/// @brief Look up the row with an id as of a snapshot
+/// @param tbl 
+/// @param id 
+/// @param snapshot 
+/// @param leaf PAGE_SIZE bytes to read pages into
+/// @param out 
+/// @return false if there is no such row
+bool read_row_at(table* tbl, uint32_t id, uint64_t snapshot, uint8_t* leaf, row* out) {
+    cursor cur = { .leaf = leaf, .snapshot = snapshot };
+    descend_snapshot(tbl, id, &cur);
+    if (cur.cell_num >= *get_leaf_node_cells_num(leaf) || *get_leaf_node_key(leaf, cur.cell_num) != id) {
+        return false;
+    }
+    deserialize_row(get_leaf_node_value(leaf, cur.cell_num), out);
+    return true;
+}
+
+/// @brief Open a select on user_name or email: at the value's bucket in the index when
+///        the snapshot has one, otherwise at the first row of the table to check them all
+/// @param st 
+/// @param live 
+void seek_value(tdb_stmt* st, bool live) {
+    table* tbl = st->db->table;
+    table* idx = tbl->indexes[st->stmt.column];
+    cursor* cur = &st->cur;
+    cur->leaf = st->leaf;
+    cur->snapshot = live ? SNAPSHOT_LIVE : open_snapshot(tbl->pager);
+    cur->ahead_count = 0;
+
+    read_page_at(tbl->pager, DB_HEADER_PAGE_NUM, cur->snapshot, cur->leaf);
+    st->via_index = *get_header_root_slot(cur->leaf, idx) != 0;
+    pager_set_access_hint(tbl->pager, st->via_index ? ACCESS_RANDOM : ACCESS_SEQUENTIAL);
+    cur->read_ahead = !st->via_index;
+    if (st->via_index) {
+        descend_snapshot(idx, index_key(st->stmt.value, 0), cur);
+    } else {
+        descend_snapshot(tbl, 0, cur);
+    }
+    skip_snapshot_leaves(cur);
+}
+
+/// @brief Hand out the next row whose user_name or email is the statement's value
+/// @param st 
+/// @param out 
+/// @return 
+tdb_result step_value(tdb_stmt* st, row* out) {
+    statement* stmt = &st->stmt;
+    cursor* cur = &st->cur;
+    uint64_t last_key = index_key(stmt->value, UINT32_MAX);
+    while (!cur->end_of_table && st->rows_returned < stmt->limit) {
+        bool found;
+        if (st->via_index) {
+            uint64_t key = get_cursor_key(cur);
+            if (key > last_key) {
+                break;
+            }
+            found = index_entry_matches(get_cursor_value(cur), stmt->value)
+                 && read_row_at(st->db->table, (uint32_t)key, cur->snapshot, st->row_leaf, out);
+        } else {
+            deserialize_row(get_cursor_value(cur), out);
+            found = strcmp(get_indexed_value(out, stmt->column), stmt->value) == 0;
+        }
+        move_cursor_forward(cur);
+        if (found) {
+            st->rows_returned++;
+            return TDB_ROW;
+        }
+    }
+    return TDB_DONE;
+}
+
+/// @brief Hand out the next row of a select, seeking to the lower bound on the first call
+/// @param st 
+/// @param out 
+/// @return 
+tdb_result step_cursor(tdb_stmt* st, row* out, bool live) {
+    statement* stmt = &st->stmt;
+    cursor* cur = &st->cur;
+    if (!st->cursor_open) {
+        table* tbl = stmt->table;
+        if (stmt->column != INDEX_COUNT) {
+            seek_value(st, live);
+        } else {
+            bool point_lookup = stmt->lower_id == stmt->upper_id;
+            pager_set_access_hint(tbl->pager, point_lookup ? ACCESS_RANDOM : ACCESS_SEQUENTIAL);
+            cur->read_ahead = !point_lookup;
+            seek_snapshot(tbl, stmt->lower_id, cur, st->leaf, live);
+        }
+        st->cursor_open = true;
+    }
+    if (stmt->column != INDEX_COUNT) {
+        return step_value(st, out);
+    }
+
+    if (cur->end_of_table || st->rows_returned >= stmt->limit || get_cursor_key(cur) > stmt->upper_id) {
+        return TDB_DONE;
+    }
+
+    if (is_users_table(stmt->table)) {
+        deserialize_row(get_cursor_value(cur), out);
+    } else {
+        deserialize_row_values(stmt->table->schema, get_cursor_value(cur), stmt->current);
+    }
+    st->rows_returned++;
+    move_cursor_forward(cur);
+    return TDB_ROW;
+}
+
+tdb_result step_select(tdb_stmt* st, row* out) {
+    pager* pg = st->db->table->pager;
+    bool live = st->cursor_open ? st->cur.snapshot == SNAPSHOT_LIVE
+                                : __atomic_load_n(&pg->in_transaction, __ATOMIC_ACQUIRE);
+    if (!live) {
+        return step_cursor(st, out, false);
+    }
+
+    // Inside a transaction a select sees its changes. It reads the live
+    // pages, between the statements that write, and ends with the transaction.
+    pthread_mutex_lock(&st->db->write_lock);
+    tdb_result result = TDB_DONE;
+    if (pg->in_transaction || !st->cursor_open) {
+        result = step_cursor(st, out, pg->in_transaction);
+    }
+    pthread_mutex_unlock(&st->db->write_lock);
+    return result;
+}
+
+execute_result execute_write(statement* stmt, table* tbl) {
+    if (pager_transaction_full(tbl->pager) && stmt->type != STATEMENT_COMMIT && stmt->type != STATEMENT_ROLLBACK) {
+        return EXECUTE_TRANSACTION_FULL;
+    }
+
+    switch (stmt->type) {
+        case STATEMENT_BEGIN:
+        case STATEMENT_COMMIT:
+        case STATEMENT_ROLLBACK:
+            return execute_transaction(stmt, tbl);
+        case STATEMENT_INSERT:
+            return execute_insert(stmt, stmt->table);
+        case STATEMENT_DELETE:
+            return execute_delete(stmt, stmt->table);
+        case STATEMENT_UPDATE:
+            return execute_update(stmt, stmt->table);
+        case STATEMENT_CREATE_INDEX:
+            return create_index(tbl, stmt->column);
+        case STATEMENT_CREATE_TABLE:
+            return create_table(tbl, stmt->new_schema);
+        default:
+            return EXECUTE_SUCCESS;
+    }
+}
+
+tdb_result tdb_step(tdb_stmt* st, tdb_row* out) {
+    if (st->done) {
+        return TDB_DONE;
+    }
+    if (st->bound != (1u << st->stmt.param_count) - 1) {
+        return TDB_MISUSE;
+    }
+
+    table* tbl = st->db->table;
+    execute_result result = EXECUTE_SUCCESS;
+    switch (st->stmt.type) {
+        case STATEMENT_SELECT:
+            st->row = out != NULL ? out : &st->own_row;
+            if (step_select(st, st->row) == TDB_ROW) {
+                return TDB_ROW;
+            }
+            close_cursor(&st->cur);
+            st->cursor_open = false;
+            break;
+        default:
+            pthread_mutex_lock(&st->db->write_lock);
+            result = execute_write(&st->stmt, tbl);
+            // Every statement commits on its own, unless a transaction is open
+            if (!tbl->pager->in_transaction) {
+                pager_commit(tbl->pager);
+            }
+            pthread_mutex_unlock(&st->db->write_lock);
+            break;
+    }
+    st->done = true;
+
+    switch (result) {
+        case EXECUTE_DUPICATE_KEY:
+            return TDB_DUPLICATE_KEY;
+        case EXECUTE_TATBLE_FULL:
+            return TDB_TABLE_FULL;
+        case EXECUTE_TRANSACTION_OPEN:
+            return TDB_TRANSACTION_OPEN;
+        case EXECUTE_NO_TRANSACTION:
+            return TDB_NO_TRANSACTION;
+        case EXECUTE_TRANSACTION_FULL:
+            return TDB_TRANSACTION_FULL;
+        case EXECUTE_INDEX_EXISTS:
+            return TDB_INDEX_EXISTS;
+        case EXECUTE_TABLE_EXISTS:
+            return TDB_TABLE_EXISTS;
+        default:
+            return TDB_DONE;
+    }
+}
+
+uint32_t tdb_column_count(tdb_stmt* st) {
+    return st->stmt.type == STATEMENT_SELECT ? st->stmt.table->schema->column_count : 0;
+}
+
+const char* tdb_column_name(tdb_stmt* st, uint32_t column) {
+    schema* s = st->stmt.table->schema;
+    return column < s->column_count ? s->columns[column].name : NULL;
+}
+
+tdb_type tdb_column_type(tdb_stmt* st, uint32_t column) {
+    return st->stmt.table->schema->columns[column].type == COLUMN_INT ? TDB_TYPE_INT : TDB_TYPE_TEXT;
+}
+
+int64_t tdb_column_int(tdb_stmt* st, uint32_t column) {
+    schema* s = st->stmt.table->schema;
+    if (column >= s->column_count || s->columns[column].type != COLUMN_INT) {
+        return 0;
+    }
+    return is_users_table(st->stmt.table) ? st->row->id : st->stmt.current->numbers[column];
+}
+
+const char* tdb_column_text(tdb_stmt* st, uint32_t column) {
+    schema* s = st->stmt.table->schema;
+    if (column >= s->column_count || s->columns[column].type != COLUMN_TEXT) {
+        return NULL;
+    }
+    if (is_users_table(st->stmt.table)) {
+        return column == 1 ? st->row->user_name : st->row->email;
+    }
+    return st->stmt.current->texts[column];
+}
+
+void tdb_finalize(tdb_stmt* st) {
+    reset_stmt(st);
+
+    tdb* db = st->db;
+    pthread_mutex_lock(&db->cache_lock);
+    if (db->cache_count == STATEMENT_CACHE_SIZE) {
+        free_stmt(db->cache[0]);
+        memmove(&db->cache[0], &db->cache[1], (STATEMENT_CACHE_SIZE - 1) * sizeof(tdb_stmt*));
+        db->cache_count--;
+    }
+    db->cache[db->cache_count++] = st;
+    pthread_mutex_unlock(&db->cache_lock);
+}
+
+tdb_result tdb_insert_batch(tdb* db, tdb_row* rows, uint32_t count, uint32_t* inserted) {
+    table* tbl = db->table;
+    pthread_mutex_lock(&db->write_lock);
+    uint32_t done, duplicates;
+    execute_result result = insert_batch(tbl, rows, count, &done, &duplicates);
+    if (!tbl->pager->in_transaction) {
+        pager_commit(tbl->pager);
+    }
+    pthread_mutex_unlock(&db->write_lock);
+
+    if (inserted != NULL) {
+        *inserted = done - duplicates;
+    }
+    switch (result) {
+        case EXECUTE_TRANSACTION_FULL:
+            return TDB_TRANSACTION_FULL;
+        case EXECUTE_DUPICATE_KEY:
+            return TDB_DUPLICATE_KEY;
+        default:
+            return TDB_OK;
+    }
+}
+
+/// @brief Take the write lock for a maintenance command, which can't run inside a transaction
+/// @param db 
+/// @param command 
+/// @return false, with the lock not taken, if a transaction is open
+bool lock_for_maintenance(tdb* db, const char* command) {
+    pthread_mutex_lock(&db->write_lock);
+    if (db->table->pager->in_transaction) {
+        pthread_mutex_unlock(&db->write_lock);
+        printf("Error: %s can't run inside a transaction.\n", command);
+        return false;
+    }
+    return true;
+}
+
+void tdb_checkpoint(tdb* db) {
+    if (!lock_for_maintenance(db, ".checkpoint")) {
+        return;
+    }
+    pager_checkpoint(db->table->pager);
+    pthread_mutex_unlock(&db->write_lock);
+}
+
+void tdb_vacuum(tdb* db) {
+    if (!lock_for_maintenance(db, ".vacuum")) {
+        return;
+    }
+    vacuum_db(db->table);
+    pthread_mutex_unlock(&db->write_lock);
+}
+
+void tdb_import(tdb* db, const char* file_name, uint32_t fill_percent) {
+    if (!lock_for_maintenance(db, ".import")) {
+        return;
+    }
+    import_rows(db->table, file_name, fill_percent);
+    pthread_mutex_unlock(&db->write_lock);
+}
+
+void tdb_integrity_check(tdb* db) {
+    if (!lock_for_maintenance(db, ".integrity_check")) {
+        return;
+    }
+    check_integrity(db->table);
+    pthread_mutex_unlock(&db->write_lock);
+}
+
+void tdb_print_constants(void) {
+    print_constants();
+}
+
+void tdb_print_tree(tdb* db) {
+    pthread_mutex_lock(&db->write_lock);
+    print_tree(db->table->pager, db->table->root_page_num, 0);
+    pthread_mutex_unlock(&db->write_lock);
+}
+
+void tdb_print_pool_stats(tdb* db) {
+    print_pool_stats(db->table->pager);
+}
+
+void tdb_print_wal_stats(tdb* db) {
+    print_wal_stats(db->table->pager->wal);
+}
+
+void tdb_print_stats(tdb* db) {
+    print_op_stats(db->table->pager);
+}
+
+void tdb_reset_stats(tdb* db) {
+    // Counts bumped by statements running on other threads meanwhile may be lost
+    memset(&db->table->pager->ops, 0, sizeof(op_stats));
+}
+
+void tdb_get_io_stats(tdb* db, tdb_io_stats* stats) {
+    pager* pg = db->table->pager;
+    pthread_rwlock_rdlock(&pg->pool_lock);
+    stats->pages_read = pg->stats.reads;
+    stats->pages_written = pg->stats.writes;
+    stats->wal_frames = pg->wal->stats.frames;
+    pthread_rwlock_unlock(&pg->pool_lock);
+}
@@ -0,0 +1,260 @@
+#ifndef TOYDB_H
+#define TOYDB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    ToyDB library API.
+
+    A database is opened with tdb_open. Statements use the same text as the
+    REPL ("insert 1 alice a@b.c", "select where id between 1 and 9", ...).
+    tdb_prepare compiles a statement. tdb_step runs it: a select hands back
+    one row per call with TDB_ROW, and every statement ends with TDB_DONE or
+    an error. A statement commits when it finishes, and tdb_finalize
+    releases it.
+
+    A '?' stands for a value bound later with tdb_bind_int or tdb_bind_text,
+    numbered from 1 in the order they appear:
+
+        insert ?, ?, ?
+        select where id between ? and ? limit ?
+        update set email = ? where id = ?
+
+    A prepared statement runs again after tdb_reset and keeps its bindings.
+    Finalized statements go to a small per-connection cache keyed by their
+    text, so preparing the same text again skips parsing. A loop of
+    prepare, bind, step and finalize does no parsing and no heap allocation.
+
+    Several rows go in with one statement, "insert (1, a, a@b.c), (2, b,
+    b@c.d)", or from an array with tdb_insert_batch. Either way the rows are
+    sorted by id and the tree is walked once, a leaf at a time, rather than
+    once per row. Rows whose id is taken are skipped and the rest are
+    inserted, and the result is TDB_DUPLICATE_KEY if any were skipped. A
+    batch, update or delete too large for the buffer pool commits in several
+    steps.
+
+    "begin" opens a transaction. The statements after it commit together
+    with "commit", in one WAL write and one fsync, or are all undone with
+    "rollback". Selects inside the transaction see its changes, others see
+    none of them until it commits. Its changed pages stay in the buffer
+    pool until then, so a transaction may change at most half of the pool's
+    frames, past that statements that write fail with TDB_TRANSACTION_FULL,
+    or stop with it part way through their rows.
+    A transaction left open by tdb_close is rolled back.
+
+    "create index on email" (or user_name) builds a secondary index, kept up
+    to date by every insert, update and delete from then on. "select where
+    email = 'a@b.c'" looks rows up through it, or checks every row when
+    there is no index on the column, and hands them back in id order. Any
+    number of rows may share a value.
+
+    "create table items (id int, name text(40), price int)" makes another
+    table. Its first column is the key: an int that isn't negative, which
+    "where" ranges over under the column's name. The other columns are ints
+    of 32 bits or texts of up to 255 bytes, "text" alone being "text(255)".
+    Statements name the table with "insert into items ...", "select from
+    items ...", "delete from items ..." and "update items set price = 3
+    where id = 1"; without a name they go to the table every database
+    starts with, users, whose rows are tdb_rows. Rows of other tables are
+    read with the tdb_column functions, which work for users as well. A
+    database holds up to 64 tables besides users, a table up to 16 columns
+    and rows of up to 293 bytes, the size of a users row. Past 64 tables
+    create table fails with TDB_TABLE_FULL, and it doesn't run inside a
+    transaction. Every table shares the connection's buffer pool and WAL.
+
+    Threads may share a connection, each stepping statements of its own.
+    Statements that write, batches and the maintenance calls run one at a
+    time. Selects from any number of threads run beside them: a select sees
+    the table as it was when its first row was stepped, whatever commits
+    while it is open, and holds up no writer however long it stays open.
+    Pages it still needs are kept in memory until it is finalized, reset or
+    finished. A transaction belongs to the connection, so the writes of
+    every thread go into it while it is open. tdb_vacuum and tdb_import
+    rebuild the tree and expect no other statements to be running, and
+    neither they nor tdb_checkpoint run inside a transaction.
+
+    A file created with tdb_config.compress keeps each page LZ4 compressed,
+    in as little of the file as it takes. The buffer pool holds pages as
+    they are, so only reads from the file and writes to it pay for the
+    compression. The file stays compressed whatever later opens ask for, a
+    vacuum included, and is read through the buffer pool even when the
+    mmap pager is asked for.
+
+    Committed pages reach the db file at a checkpoint: after every 1000
+    pages written to the log, on tdb_checkpoint and on close. With
+    tdb_config.checkpoint_interval_ms set, a thread of the connection also
+    writes them back in the background, up to checkpoint_pages every
+    interval in page order, and finishes the checkpoint once none is left.
+    The writes are then spread out, and close has little left to write.
+*/
+
+#define TDB_COLUMN_USERNAME_SIZE 32
+#define TDB_COLUMN_EMAIL_SIZE 255
+#define TDB_MAX_COLUMNS 16
+
+typedef struct {
+    uint32_t id;
+    char user_name[TDB_COLUMN_USERNAME_SIZE + 1];
+    char email[TDB_COLUMN_EMAIL_SIZE + 1];
+} tdb_row;
+
+typedef enum {
+    TDB_PAGER_BUFFERED,
+    TDB_PAGER_MMAP,
+} tdb_pager_mode;
+
+typedef struct {
+    tdb_pager_mode mode;
+    uint32_t pool_frames;
+    uint32_t wal_sync_window_ms;
+    bool compress;              // a file created by this open stores its pages compressed
+    uint32_t checkpoint_interval_ms;    // 0 for no background checkpoints
+    uint32_t checkpoint_pages;          // pages a background checkpoint writes at most
+} tdb_config;
+
+typedef enum {
+    TDB_OK,
+    TDB_ROW,                // tdb_step: a row was written to the caller's tdb_row
+    TDB_DONE,               // tdb_step: the statement has finished and committed
+    TDB_UNRECOGNIZED,       // tdb_prepare: unknown statement keyword
+    TDB_SYNTAX_ERROR,
+    TDB_STRING_TOO_LONG,
+    TDB_NEGATIVE_ID,
+    TDB_DUPLICATE_KEY,
+    TDB_TABLE_FULL,
+    TDB_MISUSE,             // bad parameter index or type, or tdb_step with parameters unbound
+    TDB_TRANSACTION_OPEN,   // begin while a transaction is open
+    TDB_NO_TRANSACTION,     // commit or rollback with no transaction open
+    TDB_TRANSACTION_FULL,   // the transaction changed as many pages as the buffer pool holds
+    TDB_INDEX_EXISTS,       // create index on a column that has one
+    TDB_NO_SUCH_TABLE,      // tdb_prepare: the statement names a table that hasn't been created
+    TDB_ROW_TOO_LARGE,      // tdb_prepare: create table with columns too wide for a row
+    TDB_TABLE_EXISTS,       // create table with the name of a table that exists
+} tdb_result;
+
+typedef struct {
+    uint64_t pages_read;        // from the db file, 0 with the mmap pager, whose reads are page faults
+    uint64_t pages_written;     // to the db file, by evictions and checkpoints
+    uint64_t wal_frames;        // pages appended to the WAL
+} tdb_io_stats;
+
+typedef enum {
+    TDB_TYPE_INT,
+    TDB_TYPE_TEXT,
+} tdb_type;
+
+typedef struct tdb tdb;
+typedef struct tdb_stmt tdb_stmt;
+
+/// @brief Fill in the configuration tdb_open uses when it is given NULL
+/// @param cfg
+void tdb_default_config(tdb_config* cfg);
+
+/// @brief Open a database file, creating it if needed, and recover its WAL
+/// @param file_name
+/// @param cfg NULL for the defaults
+/// @return
+tdb* tdb_open(const char* file_name, const tdb_config* cfg);
+
+/// @brief Parse one statement
+/// @param db
+/// @param sql
+/// @param stmt set to the new statement on TDB_OK
+/// @return TDB_OK or the reason the statement was rejected
+tdb_result tdb_prepare(tdb* db, const char* sql, tdb_stmt** stmt);
+
+/// @brief Run a statement up to its next row or to its end
+/// @param stmt
+/// @param row receives the row on TDB_ROW of a select on users, may be NULL
+/// @return TDB_ROW, TDB_DONE or an error
+tdb_result tdb_step(tdb_stmt* stmt, tdb_row* row);
+
+/// @brief Number of columns in the rows the statement hands back
+/// @param stmt
+/// @return the columns of the select's table, 0 for statements that aren't selects
+uint32_t tdb_column_count(tdb_stmt* stmt);
+
+/// @brief Name of a column of the statement's table, as create table gave it
+/// @param stmt
+/// @param column 0 for the key
+/// @return NULL past the last column
+const char* tdb_column_name(tdb_stmt* stmt, uint32_t column);
+
+/// @brief Type of a column of the statement's table
+/// @param stmt
+/// @param column 0 for the key, below tdb_column_count
+/// @return
+tdb_type tdb_column_type(tdb_stmt* stmt, uint32_t column);
+
+/// @brief A column of the row tdb_step last handed out
+/// @param stmt
+/// @param column 0 for the key
+/// @return 0 if the column isn't an int
+int64_t tdb_column_int(tdb_stmt* stmt, uint32_t column);
+
+/// @brief A column of the row tdb_step last handed out, valid until the next step
+/// @param stmt
+/// @param column
+/// @return NULL if the column isn't a text
+const char* tdb_column_text(tdb_stmt* stmt, uint32_t column);
+
+/// @brief Bind an id, limit or int column parameter
+/// @param stmt
+/// @param index 1 for the first ?
+/// @param value
+/// @return TDB_OK, TDB_NEGATIVE_ID or TDB_MISUSE, also for an int column value out of 32 bit range
+tdb_result tdb_bind_int(tdb_stmt* stmt, uint32_t index, int64_t value);
+
+/// @brief Bind a text parameter, the text is copied
+/// @param stmt
+/// @param index 1 for the first ?
+/// @param value
+/// @return TDB_OK, TDB_STRING_TOO_LONG or TDB_MISUSE
+tdb_result tdb_bind_text(tdb_stmt* stmt, uint32_t index, const char* value);
+
+/// @brief Make a statement ready to run again, its bindings are kept
+/// @param stmt
+void tdb_reset(tdb_stmt* stmt);
+
+/// @brief Release a statement back to the connection's statement cache
+/// @param stmt
+void tdb_finalize(tdb_stmt* stmt);
+
+/// @brief Insert many rows in one pass over the tree and commit them, unless a transaction is open
+/// @param db 
+/// @param rows sorted by id in place
+/// @param count 
+/// @param inserted if not NULL, set to the number of rows inserted
+/// @return TDB_OK, TDB_DUPLICATE_KEY if rows with ids already taken were skipped,
+///         or TDB_TRANSACTION_FULL if the open transaction filled up before the last row
+tdb_result tdb_insert_batch(tdb* db, tdb_row* rows, uint32_t count, uint32_t* inserted);
+
+/// @brief Commit, checkpoint and close
+/// @param db
+void tdb_close(tdb* db);
+
+/*
+    Maintenance and diagnostics, behind the REPL's dot commands. The print,
+    import and integrity check functions report on stdout. tdb_print_stats
+    shows how often the engine's hot paths ran and how long they took, as
+    counted since the database was opened or tdb_reset_stats was called.
+    Building with TDB_NO_STATS leaves that bookkeeping out.
+*/
+void tdb_checkpoint(tdb* db);
+void tdb_vacuum(tdb* db);
+void tdb_import(tdb* db, const char* file_name, uint32_t fill_percent);
+void tdb_integrity_check(tdb* db);
+void tdb_print_constants(void);
+void tdb_print_tree(tdb* db);
+void tdb_print_pool_stats(tdb* db);
+void tdb_print_wal_stats(tdb* db);
+void tdb_print_stats(tdb* db);
+void tdb_reset_stats(tdb* db);
+
+/// @brief Pages read and written since the database was opened, or last vacuumed
+/// @param db
+/// @param stats
+void tdb_get_io_stats(tdb* db, tdb_io_stats* stats);
+
+#endif